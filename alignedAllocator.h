@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace io {
+
+    /**
+     * Standard allocator returning memory aligned to a fixed boundary, e.g. for O_DIRECT blocks or SIMD loads.
+     *
+     * @tparam T value type
+     * @tparam Alignment alignment in bytes, a power of two and a multiple of sizeof(void*)
+     */
+    template <class T, size_t Alignment>
+    struct AlignedAllocator {
+        typedef T value_type;
+
+        template <class U>
+        struct rebind {
+            typedef AlignedAllocator<U, Alignment> other;
+        };
+
+        AlignedAllocator() {}
+
+        template <class U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+        T *allocate(size_t n) {
+            void *mem = nullptr;
+            if (posix_memalign(&mem, Alignment, n * sizeof(T)) != 0) throw std::bad_alloc();
+            return (T*)mem;
+        }
+
+        void deallocate(T *p, size_t) {
+            free(p);
+        }
+    };
+
+    template <class T, class U, size_t Alignment>
+    bool operator==(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) { return true; }
+
+    template <class T, class U, size_t Alignment>
+    bool operator!=(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) { return false; }
+
+    /**
+     * Byte buffer aligned to the 4 KiB logical block size used for direct I/O.
+     */
+    typedef std::vector<char, AlignedAllocator<char, 4096>> AlignedBuffer;
+}
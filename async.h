@@ -0,0 +1,335 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace async {
+
+    /**
+     * Where coroutines run. Implementations decide on the threads, e.g. a shared pool serving many players.
+     * Both functions may be called from any thread and must not run the work inline.
+     */
+    class Executor {
+    public:
+        virtual ~Executor() {}
+
+        virtual void post(std::function<void()> work) = 0;
+
+        /**
+         * Runs work once the delay has passed, timers are how coroutines sleep without holding a thread.
+         */
+        virtual void postAfter(std::chrono::microseconds delay, std::function<void()> work) = 0;
+    };
+
+    /**
+     * Executor running on a fixed number of threads, with a timer queue shared by all of them.
+     */
+    class ThreadPool : public Executor {
+    public:
+        explicit ThreadPool(size_t threads = std::thread::hardware_concurrency()) : m_stopping(false) {
+            if (threads == 0) threads = 1;
+            for (size_t i = 0; i < threads; ++i) m_threads.emplace_back(&ThreadPool::run, this);
+        }
+
+        /**
+         * Runs what is ready and drops pending timers.
+         */
+        ~ThreadPool() override {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            m_changed.notify_all();
+            for (std::thread &thread : m_threads) thread.join();
+        }
+
+        void post(std::function<void()> work) override {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_ready.push_back(std::move(work));
+            }
+            m_changed.notify_one();
+        }
+
+        void postAfter(std::chrono::microseconds delay, std::function<void()> work) override {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_timers.emplace(Clock::now() + delay, std::move(work));
+            }
+            m_changed.notify_one();
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        void run() {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (true) {
+                //move due timers over to the ready list
+                auto now = Clock::now();
+                while (!m_timers.empty() && m_timers.begin()->first <= now) {
+                    m_ready.push_back(std::move(m_timers.begin()->second));
+                    m_timers.erase(m_timers.begin());
+                }
+
+                if (!m_ready.empty()) {
+                    std::function<void()> work = std::move(m_ready.front());
+                    m_ready.pop_front();
+                    if (!m_ready.empty()) m_changed.notify_one();
+                    lock.unlock();
+                    work();
+                    lock.lock();
+                    continue;
+                }
+
+                if (m_stopping) return;
+                if (m_timers.empty()) m_changed.wait(lock);
+                else m_changed.wait_until(lock, m_timers.begin()->first);
+            }
+        }
+
+        std::vector<std::thread> m_threads;
+        std::mutex m_mutex;
+        std::condition_variable m_changed;
+        std::deque<std::function<void()>> m_ready;
+        std::multimap<Clock::time_point, std::function<void()>> m_timers;
+        bool m_stopping;
+    };
+
+    template <class T> class Task;
+
+    namespace detail {
+        template <class T>
+        struct Result {
+            T value;
+            void return_value(T v) { value = std::move(v); }
+            T take() { return std::move(value); }
+        };
+
+        template <>
+        struct Result<void> {
+            void return_void() {}
+            void take() {}
+        };
+    }
+
+    /**
+     * Lazily started coroutine returning a T. It runs when awaited and resumes the awaiting coroutine when
+     * done (symmetric transfer, so long chains don't grow the stack). Exceptions propagate to the awaiter.
+     */
+    template <class T = void>
+    class Task {
+    public:
+        struct promise_type : detail::Result<T> {
+            std::coroutine_handle<> continuation;
+            std::exception_ptr error;
+
+            Task get_return_object() {
+                return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            struct FinalAwaiter {
+                bool await_ready() noexcept { return false; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                    std::coroutine_handle<> next = h.promise().continuation;
+                    return next ? next : std::noop_coroutine();
+                }
+                void await_resume() noexcept {}
+            };
+            FinalAwaiter final_suspend() noexcept { return {}; }
+
+            void unhandled_exception() { error = std::current_exception(); }
+        };
+
+        Task(Task &&other) noexcept : m_handle(other.m_handle) { other.m_handle = nullptr; }
+        Task(const Task &) = delete;
+        Task &operator=(const Task &) = delete;
+        ~Task() { if (m_handle) m_handle.destroy(); }
+
+        bool await_ready() const noexcept { return false; }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            m_handle.promise().continuation = awaiting;
+            return m_handle;
+        }
+
+        T await_resume() {
+            if (m_handle.promise().error) std::rethrow_exception(m_handle.promise().error);
+            return m_handle.promise().take();
+        }
+
+    private:
+        explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+
+        std::coroutine_handle<promise_type> m_handle;
+    };
+
+    namespace detail {
+        //eagerly started, self destroying coroutine used to run a Task without awaiting it
+        struct Detached {
+            struct promise_type {
+                Detached get_return_object() { return {}; }
+                std::suspend_never initial_suspend() noexcept { return {}; }
+                std::suspend_never final_suspend() noexcept { return {}; }
+                void return_void() {}
+                void unhandled_exception() { std::terminate(); }
+            };
+        };
+    }
+
+    /**
+     * Awaitable moving the coroutine over to an executor thread.
+     */
+    struct ResumeOn {
+        Executor &executor;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) { executor.post([h]{ h.resume(); }); }
+        void await_resume() const noexcept {}
+    };
+
+    inline ResumeOn resumeOn(Executor &executor) {
+        return {executor};
+    }
+
+    /**
+     * Awaitable suspending the coroutine for a while, resumed by the executor's timer.
+     */
+    struct SleepFor {
+        Executor &executor;
+        std::chrono::microseconds delay;
+
+        bool await_ready() const noexcept { return delay.count() <= 0; }
+        void await_suspend(std::coroutine_handle<> h) { executor.postAfter(delay, [h]{ h.resume(); }); }
+        void await_resume() const noexcept {}
+    };
+
+    inline SleepFor sleepFor(Executor &executor, std::chrono::microseconds delay) {
+        return {executor, delay};
+    }
+
+    /**
+     * Awaitable for callback based waits. arm(wake) returns true if there is nothing to wait for, or
+     * registers wake to be called exactly once, from any thread, when there is. The coroutine then
+     * resumes on the executor.
+     */
+    template <class Arm>
+    struct Until {
+        Executor &executor;
+        Arm arm;
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h) {
+            Executor *ex = &executor;
+            return !arm(std::function<void()>([ex, h]{ ex->post([h]{ h.resume(); }); }));
+        }
+        void await_resume() const noexcept {}
+    };
+
+    template <class Arm>
+    Until<Arm> until(Executor &executor, Arm arm) {
+        return {executor, std::move(arm)};
+    }
+
+    /**
+     * One-shot event, awaitable by coroutines and waitable by threads.
+     */
+    class Event {
+    public:
+        Event() : m_set(false) {}
+
+        void reset() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_set = false;
+        }
+
+        void set() {
+            std::vector<std::function<void()>> waiters;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_set = true;
+                waiters.swap(m_waiters);
+                m_changed.notify_all(); //under the lock, a woken thread may destroy the event right away
+            }
+            for (auto &wake : waiters) wake();
+        }
+
+        /**
+         * Blocks the calling thread until set.
+         */
+        void wait() {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [&]{ return m_set; });
+        }
+
+        /**
+         * @return awaitable resuming the coroutine on the executor once set
+         */
+        auto wait(Executor &executor) {
+            return until(executor, [this](std::function<void()> wake) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_set) return true;
+                m_waiters.push_back(std::move(wake));
+                return false;
+            });
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_changed;
+        std::vector<std::function<void()>> m_waiters;
+        bool m_set;
+    };
+
+    /**
+     * Starts a task on the executor without waiting for it. The task must not throw.
+     *
+     * @param done optional event set when the task finished
+     */
+    template <class T>
+    void spawn(Executor &executor, Task<T> task, Event *done = nullptr) {
+        [](Executor &ex, Task<T> t, Event *finished) -> detail::Detached {
+            co_await resumeOn(ex);
+            co_await t;
+            if (finished) finished->set();
+        }(executor, std::move(task), done);
+    }
+
+    /**
+     * Runs a task on the executor and blocks the calling thread until it finished, e.g. from main().
+     * Must not be called from an executor thread.
+     */
+    template <class T>
+    T blockOn(Executor &executor, Task<T> task) {
+        std::promise<T> result;
+        std::future<T> future = result.get_future();
+        [](Executor &ex, Task<T> t, std::promise<T> &p) -> detail::Detached {
+            co_await resumeOn(ex);
+            try {
+                if constexpr (std::is_void<T>::value) {
+                    co_await t;
+                    p.set_value();
+                } else {
+                    p.set_value(co_await t);
+                }
+            } catch (...) {
+                p.set_exception(std::current_exception());
+            }
+        }(executor, std::move(task), result);
+        return future.get();
+    }
+}
@@ -0,0 +1,130 @@
+#include "../mixBus.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+/**
+ * Output conversion benchmark: what dithering the float bus down to S16LE costs per sample.
+ *
+ * Times audio::storeS16Stereo() without dither, with TPDF dither and with noise shaped TPDF dither, in the
+ * mixer's chunks (72 samples by default), and for comparison the conversion with TPDF dither drawn from std::mt19937
+ * per sample, the way NetworkReader draws its bandwidth profile. The dither overhead is reported relative
+ * to the plain conversion; the budget is 0.5 ns per sample, with and without noise shaping.
+ *
+ * Usage: ditherBench [runs] [seconds] [chunk]   (defaults: 15 runs of 10 seconds of audio each, chunks of 72)
+ */
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    const size_t SampleRate = 48000; //SAMPLE_RATE of player.h
+    const double BudgetNs = 0.5;
+
+    struct Signal {
+        std::vector<float> bus;
+        std::vector<int16_t> out;
+    };
+
+    Signal makeSignal(size_t seconds) {
+        Signal signal;
+        signal.bus.resize(seconds * SampleRate);
+        for (size_t i = 0; i < signal.bus.size(); ++i) {
+            //two mixed sources at half gain, so the bus has fractions
+            signal.bus[i] = (float)(0.5 * 8000 * std::sin(2 * M_PI * 440 * (double)i / SampleRate) +
+                                    0.5 * 8000 * std::sin(2 * M_PI * 660 * (double)i / SampleRate));
+        }
+        signal.out.resize(2 * signal.bus.size());
+        return signal;
+    }
+
+    template <audio::DitherMode Mode>
+    void convert(Signal &signal, size_t chunk, audio::LevelMeter &meter, audio::Dither &dither) {
+        for (size_t i = 0; i + chunk <= signal.bus.size(); i += chunk) {
+            meter.count(chunk); //as MixBus::render() does
+            audio::storeS16Stereo<false, Mode>(signal.out.data() + 2 * i, signal.bus.data() + i, chunk, meter, dither);
+        }
+    }
+
+    /**
+     * Reference: the plain scalar conversion with TPDF dither from std::mt19937.
+     */
+    void convertMt(Signal &signal, std::mt19937 &gen) {
+        std::uniform_real_distribution<float> uniform(-0.5f, 0.5f);
+        for (size_t i = 0; i < signal.bus.size(); ++i) {
+            float f = signal.bus[i] + uniform(gen) + uniform(gen);
+            f = std::min(std::max(f, -32768.0f), 32767.0f);
+            int16_t s = (int16_t)std::lrint(f);
+            signal.out[2 * i] = s;
+            signal.out[2 * i + 1] = s;
+        }
+    }
+
+    double median(std::vector<double> values) {
+        std::sort(values.begin(), values.end());
+        size_t n = values.size();
+        return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+    }
+
+    /**
+     * @return median ns per sample
+     */
+    template <typename Convert>
+    double measure(Signal &signal, size_t runs, Convert convert) {
+        convert(); //warm up caches and page in the output
+        std::vector<double> ns;
+        for (size_t r = 0; r < runs; ++r) {
+            auto start = Clock::now();
+            convert();
+            ns.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count() / (double)signal.bus.size());
+        }
+        return median(ns);
+    }
+
+    uint64_t checksum(const Signal &signal) {
+        uint64_t hash = 14695981039346656037ull;
+        for (int16_t s : signal.out) hash = (hash ^ (uint16_t)s) * 1099511628211ull;
+        return hash;
+    }
+}
+
+int main(int argc, char **argv) {
+
+    size_t runs = argc > 1 ? (size_t)std::max(1, std::atoi(argv[1])) : 15;
+    size_t seconds = argc > 2 ? (size_t)std::max(1, std::atoi(argv[2])) : 10;
+    size_t chunk = argc > 3 ? (size_t)std::max(1, std::atoi(argv[3])) : 72; //the mixer's chunk
+    Signal signal = makeSignal(seconds);
+    audio::LevelMeter meter;
+    audio::Dither dither;
+    std::mt19937 gen(1);
+
+    double plain = measure(signal, runs, [&] { convert<audio::DitherMode::None>(signal, chunk, meter, dither); });
+    uint64_t sink = checksum(signal);
+    double tpdf = measure(signal, runs, [&] { convert<audio::DitherMode::Tpdf>(signal, chunk, meter, dither); });
+    sink ^= checksum(signal);
+    double shaped = measure(signal, runs, [&] { convert<audio::DitherMode::Shaped>(signal, chunk, meter, dither); });
+    sink ^= checksum(signal);
+    double mt = measure(signal, runs, [&] { convertMt(signal, gen); });
+    sink ^= checksum(signal);
+
+#if defined(__AVX2__) && defined(__FMA__)
+    const char *path = "AVX2";
+#else
+    const char *path = "scalar";
+#endif
+    std::printf("median of %zu runs over %zu s of audio in chunks of %zu, %s kernels (checksum %016llx)\n",
+                runs, seconds, chunk, path, (unsigned long long)sink);
+    std::printf("%-16s %10s %10s\n", "conversion", "ns/sample", "dither");
+    std::printf("%-16s %10.3f %10s\n", "none", plain, "-");
+    std::printf("%-16s %10.3f %10.3f  %s\n", "tpdf", tpdf, tpdf - plain, tpdf - plain < BudgetNs ? "within budget" : "OVER BUDGET");
+    std::printf("%-16s %10.3f %10.3f  %s\n", "tpdf shaped", shaped, shaped - plain,
+                shaped - plain < BudgetNs ? "within budget" : "OVER BUDGET");
+    std::printf("%-16s %10.3f %10.3f\n", "mt19937 scalar", mt, mt - plain);
+    return 0;
+
+}
@@ -0,0 +1,167 @@
+#include "../player.h"
+#include "../tests/testSupport.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * Startup latency benchmark: how long it takes from nothing to the first byte hitting the sink.
+ *
+ * The cold start is split into its phases
+ *  - NetworkReader construction: bandwidth profile generation and loading the stream
+ *  - Player construction and the open() call itself
+ *  - open() until the player is ready
+ *  - time to first sample: open() until the mixer wrote the first chunk (play() is called right away)
+ * and measured for source files of increasing length, with a warm and a cold page cache. Cold means the
+ * cached pages of both source files are dropped with POSIX_FADV_DONTNEED before every run, which needs no
+ * privileges but leaves the disk's own cache alone.
+ *
+ * Usage: startupBench [runs] [seconds...]   (defaults: 5 runs of 10, 60 and 600 seconds long sources)
+ * The sources are generated in a temporary directory, output goes to the null sink.
+ */
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    using test::NetworkFile;
+    using test::PlayerFile;
+
+    struct Phases {
+        double profile;   //NetworkReader bandwidth profile
+        double load;      //NetworkReader stream load
+        double construct; //Player constructor
+        double open;      //open() call
+        double ready;     //open() until ready
+        double firstByte; //open() until the first chunk was written
+    };
+
+    double ms(Clock::time_point from, Clock::time_point to) {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+
+    void dropCache(const char *path) {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(fd);
+    }
+
+    void warmCache(const char *path) {
+        std::vector<char> buffer(1 << 20);
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return;
+        while (::read(fd, buffer.data(), buffer.size()) > 0) {}
+        ::close(fd);
+    }
+
+    void prepareCache(bool cold) {
+        for (const char *path : {NetworkFile, PlayerFile}) {
+            if (cold) dropCache(path);
+            else warmCache(path);
+        }
+    }
+
+    Phases run(bool cold) {
+        Phases phases;
+
+        prepareCache(cold);
+        auto start = Clock::now();
+        net::NetworkReader reader(1, false);
+        auto profiled = Clock::now();
+        if (!reader.load()) std::exit(1);
+        auto loaded = Clock::now();
+        phases.profile = ms(start, profiled);
+        phases.load = ms(profiled, loaded);
+
+        prepareCache(cold); //the reader warmed the network file
+        char networkUrl[] = "network";
+        char filename[] = "file";
+        start = Clock::now();
+        Player player;
+        player.setOutputMode(OutputMode::Null);
+        auto constructed = Clock::now();
+        std::shared_future<void> ready = player.open(networkUrl, filename);
+        auto opened = Clock::now();
+        player.play();
+
+        //poll instead of spinning, the background threads may share the CPU with us
+        Clock::time_point readyAt, firstByteAt;
+        bool isReady = false;
+        while (player.getPosition() == 0) {
+            if (!isReady && ready.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                readyAt = Clock::now();
+                isReady = true;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        firstByteAt = Clock::now();
+        if (!isReady) readyAt = firstByteAt;
+        player.close();
+
+        phases.construct = ms(start, constructed);
+        phases.open = ms(constructed, opened);
+        phases.ready = ms(opened, readyAt);
+        phases.firstByte = ms(opened, firstByteAt);
+        return phases;
+    }
+
+    double median(std::vector<double> values) {
+        std::sort(values.begin(), values.end());
+        size_t n = values.size();
+        return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+    }
+
+    void report(size_t seconds, bool cold, const std::vector<Phases> &runs) {
+        auto column = [&](double Phases::*phase) {
+            std::vector<double> values;
+            for (const Phases &p : runs) values.push_back(p.*phase);
+            return median(values);
+        };
+        double worst = 0;
+        for (const Phases &p : runs) worst = std::max(worst, p.firstByte);
+        std::printf("%7zu s  %-4s  %9.2f %9.2f %9.2f %9.2f %9.2f %11.2f %9.2f\n", seconds, cold ? "cold" : "warm",
+                    column(&Phases::profile), column(&Phases::load), column(&Phases::construct),
+                    column(&Phases::open), column(&Phases::ready), column(&Phases::firstByte), worst);
+    }
+}
+
+int main(int argc, char **argv) {
+
+    size_t runs = argc > 1 ? (size_t)std::max(1, std::atoi(argv[1])) : 5;
+    std::vector<size_t> sizes;
+    for (int i = 2; i < argc; ++i) sizes.push_back((size_t)std::max(1, std::atoi(argv[i])));
+    if (sizes.empty()) sizes = {10, 60, 600};
+
+    test::ScratchDirectory dir("startupBench");
+    if (!dir.enter()) {
+        std::perror("startupBench: temporary directory");
+        return 1;
+    }
+
+    std::printf("median of %zu runs in ms, first byte max in the last column\n", runs);
+    std::printf(" source   cache   profile      load      ctor      open     ready  first byte       max\n");
+    for (size_t seconds : sizes) {
+        if (!test::writeSource(NetworkFile, seconds * SAMPLE_RATE, 440) ||
+            !test::writeSource(PlayerFile, seconds * SAMPLE_RATE, 660)) {
+            std::perror("startupBench: writing sources");
+            return 1;
+        }
+        for (bool cold : {false, true}) {
+            std::vector<Phases> results;
+            for (size_t i = 0; i < runs; ++i) results.push_back(run(cold));
+            report(seconds, cold, results);
+        }
+    }
+
+    dir.leave();
+    return 0;
+
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "alignedAllocator.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace io {
+
+    /**
+     * Output file opened with O_DIRECT, so long renders bypass the page cache instead of evicting hot data.
+     * Data is collected in an aligned buffer and written in whole 4 KiB blocks. The unaligned tail is
+     * zero-padded to a full block on close() and the file is then truncated to its real length.
+     *
+     * Filesystems without O_DIRECT support (e.g. tmpfs) transparently get a buffered file instead, also when
+     * they only reject it on the first write.
+     */
+    class DirectFileWriter {
+    public:
+        static const size_t BlockSize = 4096;
+        static const size_t BufferSize = 1024 * 1024;
+
+        DirectFileWriter() : m_fd(-1), m_used(0), m_offset(0), m_direct(false), m_error(0) {}
+        ~DirectFileWriter() { close(); }
+
+        bool open(const std::string &path) {
+            m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+            m_direct = m_fd >= 0;
+            if (m_fd < 0 && errno == EINVAL) {
+                m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            }
+            m_buffer.resize(BufferSize);
+            m_used = 0;
+            m_offset = 0;
+            m_error = m_fd < 0 ? errno : 0;
+            return m_fd >= 0;
+        }
+
+        void write(const char *data, size_t len) {
+            while (len > 0) {
+                size_t n = std::min(len, BufferSize - m_used);
+                std::memcpy(m_buffer.data() + m_used, data, n);
+                m_used += n;
+                data += n;
+                len -= n;
+                if (m_used == BufferSize) {
+                    writeBlocks(BufferSize);
+                    m_offset += BufferSize;
+                    m_used = 0;
+                }
+            }
+        }
+
+        /**
+         * Writes the padded tail block and trims the file to the bytes actually written.
+         *
+         * @return false if any write failed
+         */
+        bool close() {
+            if (m_fd < 0) return true;
+            if (m_used > 0) {
+                size_t padded = (m_used + BlockSize - 1) / BlockSize * BlockSize;
+                std::memset(m_buffer.data() + m_used, 0, padded - m_used);
+                writeBlocks(padded);
+                if (!m_error && ftruncate(m_fd, (off_t)(m_offset + m_used)) != 0) m_error = errno;
+                m_offset += m_used;
+                m_used = 0;
+            }
+            if (::close(m_fd) != 0 && !m_error) m_error = errno;
+            m_fd = -1;
+            return m_error == 0;
+        }
+
+        /**
+         * @return true if the file really bypasses the page cache
+         */
+        bool direct() const { return m_direct; }
+
+    private:
+        void writeBlocks(size_t len) {
+            const char *data = m_buffer.data();
+            uint64_t offset = m_offset;
+            while (len > 0 && !m_error) {
+                ssize_t n = pwrite(m_fd, data, len, (off_t)offset);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno == EINVAL && m_direct && dropDirect()) continue; //accepted at open() but not here
+                    m_error = errno;
+                    break;
+                }
+                if (n == 0) { //no progress, retrying would spin
+                    m_error = EIO;
+                    break;
+                }
+                //direct I/O only ever completes whole blocks, so the remainder stays aligned
+                data += n;
+                offset += n;
+                len -= n;
+            }
+        }
+
+        /**
+         * Switches the open file to buffered writes.
+         *
+         * @return false if the flag can't be cleared
+         */
+        bool dropDirect() {
+            int flags = fcntl(m_fd, F_GETFL);
+            if (flags < 0 || fcntl(m_fd, F_SETFL, flags & ~O_DIRECT) != 0) return false;
+            m_direct = false;
+            return true;
+        }
+
+        int m_fd;
+        AlignedBuffer m_buffer;
+        size_t m_used;
+        uint64_t m_offset;
+        bool m_direct;
+        int m_error;
+    };
+}
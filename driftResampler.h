@@ -0,0 +1,192 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace audio {
+
+    /**
+     * Estimates the clock drift between a remote source and the local output from the fill of the buffer
+     * in between, and turns it into a resampling ratio that holds the fill at a target depth.
+     *
+     * The fill is low-pass filtered (it moves in whole network reads) and drives a PI controller: the
+     * integral converges to the relative clock offset, the proportional part pulls the buffer back to the
+     * target after a disturbance. The ratio stays within MaxDeviation of 1, i.e. far below audibility.
+     */
+    class DriftEstimator {
+    public:
+        static constexpr double MaxDeviation = 0.002;   //2000 ppm
+        static constexpr double SmoothingTime = 2.0;    //seconds
+        static constexpr double Kp = 0.005;             //ratio offset per relative fill error
+        static constexpr double Ki = 0.0005;            //per second
+
+        DriftEstimator() : m_target(1), m_smoothed(-1), m_integral(0), m_ratio(1) {}
+
+        /**
+         * @param targetFill buffer fill (samples) to hold
+         */
+        void reset(double targetFill) {
+            m_target = std::max(targetFill, 1.0);
+            m_smoothed = -1;
+            m_integral = 0;
+            m_ratio = 1;
+        }
+
+        /**
+         * Restarts the fill measurement, e.g. after the buffer was flushed by a seek.
+         * The drift estimate is kept.
+         */
+        void settle() {
+            m_smoothed = -1;
+        }
+
+        /**
+         * @param fill current buffer fill in samples
+         * @param dt time since the last update in seconds
+         * @return input samples to consume per output sample
+         */
+        double update(double fill, double dt) {
+            if (m_smoothed < 0) m_smoothed = fill;
+            m_smoothed += (1 - std::exp(-dt / SmoothingTime)) * (fill - m_smoothed);
+
+            double error = (m_smoothed - m_target) / m_target;
+            m_integral = clamp(m_integral + Ki * error * dt);
+            m_ratio = 1 + clamp(m_integral + Kp * error);
+            return m_ratio;
+        }
+
+        /**
+         * @return estimated clock offset of the source in ppm, positive if it runs fast
+         */
+        double drift() const {
+            return m_integral * 1e6;
+        }
+
+        double ratio() const {
+            return m_ratio;
+        }
+
+    private:
+        static double clamp(double v) {
+            const double limit = MaxDeviation;
+            return std::max(-limit, std::min(limit, v));
+        }
+
+        double m_target;
+        double m_smoothed;
+        double m_integral;
+        double m_ratio;
+    };
+
+    /**
+     * Asynchronous resampler for ratios close to 1 (clock drift compensation of a mono S16 stream).
+     *
+     * Band-limited interpolation with a 16 tap Kaiser windowed sinc. The filter is tabulated at 256
+     * fractional phases and linearly interpolated between them, so the ratio can change at every chunk
+     * with arbitrarily fine resolution and without discontinuities.
+     */
+    class DriftResampler {
+    public:
+        static const size_t Taps = 16;
+        static const size_t Phases = 256;
+
+        DriftResampler() : m_time(0), m_finished(false) {
+            m_filter.resize((Phases + 1) * Taps);
+            const double cutoff = 0.9, beta = 8.0;
+            for (size_t p = 0; p <= Phases; ++p) {
+                double sum = 0;
+                for (size_t k = 0; k < Taps; ++k) {
+                    double d = (double)p / Phases + (Taps / 2 - 1) - (double)k; //distance to the output instant
+                    double x = d / (Taps / 2);
+                    double w = std::fabs(x) < 1 ? besselI0(beta * std::sqrt(1 - x * x)) / besselI0(beta) : 0;
+                    double s = d == 0 ? 1 : std::sin(M_PI * cutoff * d) / (M_PI * cutoff * d);
+                    m_filter[p * Taps + k] = (float)(w * s);
+                    sum += w * s;
+                }
+                for (size_t k = 0; k < Taps; ++k) m_filter[p * Taps + k] /= (float)sum; //unity DC gain
+            }
+            reset();
+        }
+
+        /**
+         * Drops all buffered input, e.g. after a seek.
+         */
+        void reset() {
+            m_history.assign(Taps / 2 - 1, 0.0f);
+            m_time = Taps / 2 - 1;
+            m_finished = false;
+        }
+
+        /**
+         * @return number of input samples to push() before n output samples can be produced at this ratio
+         */
+        size_t inputNeeded(size_t n, double ratio) const {
+            if (n == 0) return 0;
+            size_t last = (size_t)(m_time + (n - 1) * ratio) + Taps / 2 + 1;
+            return last > m_history.size() ? last - m_history.size() : 0;
+        }
+
+        void push(const int16_t *src, size_t n) {
+            m_history.insert(m_history.end(), src, src + n);
+        }
+
+        /**
+         * Marks the end of the input. The filter looks Taps / 2 samples ahead, so the history is padded
+         * with silence to let the last pushed samples come out of process(). Only the first call pads.
+         */
+        void finish() {
+            if (m_finished) return;
+            m_history.insert(m_history.end(), Taps / 2, 0.0f);
+            m_finished = true;
+        }
+
+        /**
+         * Produces up to n output samples from the pushed input.
+         *
+         * @param ratio input samples per output sample
+         * @return number of samples written to dst
+         */
+        size_t process(int16_t *dst, size_t n, double ratio) {
+            size_t produced = 0;
+            while (produced < n && (size_t)m_time + Taps / 2 < m_history.size()) {
+                size_t base = (size_t)m_time - (Taps / 2 - 1);
+                double phase = (m_time - std::floor(m_time)) * Phases;
+                size_t p = (size_t)phase;
+                float mu = (float)(phase - p);
+                const float *c0 = &m_filter[p * Taps];
+                const float *c1 = c0 + Taps;
+                const float *x = &m_history[base];
+                float acc = 0;
+                for (size_t k = 0; k < Taps; ++k) acc += x[k] * (c0[k] + mu * (c1[k] - c0[k]));
+                dst[produced++] = (int16_t)std::max(-32768.0f, std::min(32767.0f, std::nearbyint(acc)));
+                m_time += ratio;
+            }
+
+            //keep only the history the next output still needs
+            size_t drop = std::min((size_t)m_time - std::min((size_t)m_time, Taps / 2 - 1), m_history.size());
+            if (drop > 0) {
+                m_history.erase(m_history.begin(), m_history.begin() + drop);
+                m_time -= drop;
+            }
+            return produced;
+        }
+
+    private:
+        static double besselI0(double x) {
+            double sum = 1, term = 1;
+            for (int k = 1; k < 32; ++k) {
+                term *= (x / (2 * k)) * (x / (2 * k));
+                sum += term;
+            }
+            return sum;
+        }
+
+        std::vector<float> m_filter; //(Phases + 1) rows of Taps coefficients
+        std::vector<float> m_history;
+        double m_time; //position of the next output sample within m_history
+        bool m_finished; //finish() padded the history
+    };
+}
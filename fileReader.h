@@ -0,0 +1,236 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+namespace io {
+
+    /**
+     * Streaming S16 file source with constant memory use, regardless of the file size.
+     *
+     * A read-ahead thread fills a small ring of large buffers with pread() (64 bit offsets, so files over
+     * 4 GB are fine) while the consumer copies samples out of the filled ones. The kernel is told the file
+     * is read sequentially, and the page cache of every buffer that was consumed is dropped when that
+     * buffer is refilled, so a multi-hour file does not evict everything else either.
+     *
+     * seek() starts a new generation: the ring is emptied and read-ahead restarts at the new offset, a read
+     * that was in flight for the old position is thrown away.
+     *
+     * Optionally the read-ahead goes through io_uring instead of pread(), on the read-ahead thread's own
+     * ring (see Uring::forThisThread()); without kernel support it stays with pread().
+     */
+    class StreamingFileReader {
+    public:
+        static const size_t BufferCount = 4;
+        static const size_t BufferSize = 1024 * 1024;
+
+        StreamingFileReader() : m_fd(-1), m_size(0), m_useUring(false), m_head(0), m_count(0), m_consumed(0),
+                                m_nextOffset(0), m_generation(0), m_eof(false), m_stopping(false), m_error(0) {}
+        ~StreamingFileReader() { close(); }
+
+        /**
+         * @param useUring read ahead through io_uring if the kernel supports it
+         */
+        bool open(const std::string &path, bool useUring = false) {
+            m_useUring = useUring;
+            m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat st;
+            if (m_fd < 0 || fstat(m_fd, &st) != 0) {
+                m_error = errno;
+                return false;
+            }
+            m_size = (uint64_t)st.st_size / sizeof(int16_t) * sizeof(int16_t); //whole samples only
+            posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+            for (Slot &slot : m_slots) {
+                slot.data.resize(BufferSize);
+                slot.offset = 0;
+                slot.size = 0;
+            }
+            m_head = 0;
+            m_count = 0;
+            m_consumed = 0;
+            m_nextOffset = 0;
+            m_generation = 0;
+            m_eof = false;
+            m_stopping = false;
+            m_error = 0;
+            m_thread = std::thread(&StreamingFileReader::readAhead, this);
+            return true;
+        }
+
+        void close() {
+            if (m_fd < 0) return;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            m_slotFree.notify_all();
+            m_slotFilled.notify_all();
+            if (m_thread.joinable()) m_thread.join();
+            ::close(m_fd);
+            m_fd = -1;
+        }
+
+        /**
+         * @return file length in samples
+         */
+        uint64_t length() const {
+            return m_size / sizeof(int16_t);
+        }
+
+        /**
+         * Copies up to n samples. Blocks only if the read-ahead has not caught up yet (e.g. right after a seek).
+         *
+         * @return number of samples copied, 0 at the end of the file
+         */
+        size_t read(int16_t *dst, size_t n) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            size_t bytes = n * sizeof(int16_t);
+            size_t copied = 0;
+            while (copied < bytes) {
+                m_slotFilled.wait(lock, [&]{ return m_count > 0 || m_eof || m_stopping; });
+                if (m_count == 0) break; //end of file, read error or shutdown
+
+                Slot &slot = m_slots[m_head];
+                size_t take = std::min(bytes - copied, slot.size - m_consumed);
+                std::memcpy((char*)dst + copied, slot.data.data() + m_consumed, take);
+                copied += take;
+                m_consumed += take;
+                if (m_consumed == slot.size) {
+                    m_head = (m_head + 1) % BufferCount;
+                    m_count--;
+                    m_consumed = 0;
+                    m_slotFree.notify_one();
+                }
+            }
+            return copied / sizeof(int16_t);
+        }
+
+        /**
+         * Repositions the reader, positions past the end read as end of file.
+         *
+         * @param sample file position in samples
+         */
+        void seek(uint64_t sample) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_generation++;
+                m_count = 0;
+                m_consumed = 0;
+                m_nextOffset = std::min<uint64_t>(sample * sizeof(int16_t), m_size);
+                m_eof = false;
+            }
+            m_slotFree.notify_all();
+        }
+
+        /**
+         * Adds the read-ahead buffers to a list of (address, size) ranges, e.g. to lock them into memory.
+         */
+        void memoryRanges(std::vector<std::pair<const void*, size_t>> &ranges) const {
+            for (const Slot &slot : m_slots) ranges.emplace_back(slot.data.data(), slot.data.size());
+        }
+
+        /**
+         * @return errno of the last failed read, 0 if none
+         */
+        int error() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_error;
+        }
+
+    private:
+        struct Slot {
+            std::vector<char> data;
+            uint64_t offset; //file offset of data[0]
+            size_t size;     //valid bytes
+        };
+
+        void readAhead() {
+            std::shared_ptr<Uring> ring = m_useUring ? Uring::forThisThread() : nullptr;
+            while (true) {
+                size_t index;
+                uint64_t offset, generation;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_slotFree.wait(lock, [&]{ return m_stopping || (m_count < BufferCount && !m_eof); });
+                    if (m_stopping) return;
+                    index = (m_head + m_count) % BufferCount;
+                    offset = m_nextOffset;
+                    generation = m_generation;
+                }
+
+                //the slot is neither counted nor visible to the consumer, fill it without the lock
+                Slot &slot = m_slots[index];
+                if (slot.size > 0) posix_fadvise(m_fd, (off_t)slot.offset, (off_t)slot.size, POSIX_FADV_DONTNEED);
+                size_t len = (size_t)std::min<uint64_t>(BufferSize, m_size - offset);
+                size_t done = 0;
+                int error = 0;
+                if (ring) {
+                    UringOwner owner;
+                    ring->read(&owner, m_fd, slot.data.data(), len, offset);
+                    ring->wait(&owner);
+                    done = (size_t)owner.bytes;
+                    error = owner.error;
+                } else {
+                    while (done < len) {
+                        ssize_t n = pread(m_fd, slot.data.data() + done, len - done, (off_t)(offset + done));
+                        if (n < 0 && errno == EINTR) continue;
+                        if (n <= 0) {
+                            error = n < 0 ? errno : 0;
+                            break;
+                        }
+                        done += n;
+                    }
+                }
+                done = done / sizeof(int16_t) * sizeof(int16_t);
+
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    slot.offset = offset;
+                    slot.size = done;
+                    if (generation != m_generation) continue; //seeked away meanwhile
+                    if (error) m_error = error;
+                    if (done == 0) {
+                        m_eof = true;
+                    } else {
+                        m_count++;
+                        m_nextOffset = offset + done;
+                    }
+                }
+                m_slotFilled.notify_one();
+            }
+        }
+
+        int m_fd;
+        uint64_t m_size; //bytes
+        bool m_useUring;
+        Slot m_slots[BufferCount];
+        size_t m_head;          //oldest filled slot
+        size_t m_count;         //filled slots
+        size_t m_consumed;      //bytes of the head slot already read
+        uint64_t m_nextOffset;  //file offset the next slot is filled from
+        uint64_t m_generation;
+        bool m_eof;
+        bool m_stopping;
+        int m_error;
+        std::thread m_thread;
+        mutable std::mutex m_mutex;
+        std::condition_variable m_slotFree;
+        std::condition_variable m_slotFilled;
+    };
+}
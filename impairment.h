@@ -0,0 +1,107 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <random>
+
+namespace net {
+
+    /**
+     * Link impairments on top of the bandwidth profile. Everything is off by default.
+     */
+    struct ImpairmentConfig {
+        //request latency of every read (RTT plus server time), log-normally distributed
+        std::chrono::microseconds latencyMean;
+        std::chrono::microseconds latencyJitter; //standard deviation
+
+        //Gilbert-Elliott burst stalls: a two state Markov chain advanced once per read,
+        //every read in the bad state stalls for stallDuration
+        double stallEnterProbability; //good -> bad
+        double stallExitProbability;  //bad -> good, the mean burst is 1 / stallExitProbability reads
+        std::chrono::milliseconds stallDuration;
+
+        //periodic hiccups, e.g. a Wi-Fi scan or a radio handover: nothing gets through for hiccupDuration
+        //once every hiccupPeriod
+        std::chrono::milliseconds hiccupPeriod; //0 disables hiccups
+        std::chrono::milliseconds hiccupDuration;
+
+        uint64_t seed;
+
+        ImpairmentConfig() : latencyMean(0), latencyJitter(0), stallEnterProbability(0), stallExitProbability(1),
+                             stallDuration(0), hiccupPeriod(0), hiccupDuration(0), seed(1) {}
+    };
+
+    /**
+     * Computes the extra delay of every read from an ImpairmentConfig. Deterministic for a given seed
+     * and sequence of reads, it never looks at the wall clock itself.
+     */
+    class ImpairmentModel {
+    public:
+        ImpairmentModel() : m_bad(false) {
+            configure(ImpairmentConfig());
+        }
+
+        void configure(const ImpairmentConfig &config) {
+            m_config = config;
+            m_gen.seed(config.seed);
+            m_bad = false;
+
+            //log-normal parameters for the requested mean and standard deviation
+            double mean = (double)config.latencyMean.count();
+            double jitter = (double)config.latencyJitter.count();
+            double sigma2 = mean > 0 ? std::log(1 + jitter * jitter / (mean * mean)) : 0;
+            m_latency = std::lognormal_distribution<double>(mean > 0 ? std::log(mean) - sigma2 / 2 : 0, std::sqrt(sigma2));
+        }
+
+        const ImpairmentConfig &config() const {
+            return m_config;
+        }
+
+        bool enabled() const {
+            return m_config.latencyMean.count() > 0 || m_config.stallEnterProbability > 0 ||
+                   (m_config.hiccupPeriod.count() > 0 && m_config.hiccupDuration.count() > 0);
+        }
+
+        /**
+         * @param start time the read is issued, on the reader's clock
+         * @param transfer time the payload takes at the current bandwidth
+         * @return delay to add to the transfer time
+         */
+        std::chrono::microseconds delay(std::chrono::microseconds start, std::chrono::microseconds transfer) {
+            std::chrono::microseconds extra(0);
+
+            if (m_config.latencyMean.count() > 0) {
+                extra += std::chrono::microseconds((int64_t)(m_config.latencyJitter.count() > 0 ? m_latency(m_gen)
+                                                                                              : m_config.latencyMean.count()));
+            }
+
+            std::uniform_real_distribution<double> uniform(0, 1);
+            if (m_config.stallEnterProbability > 0) {
+                m_bad = m_bad ? uniform(m_gen) >= m_config.stallExitProbability
+                              : uniform(m_gen) < m_config.stallEnterProbability;
+                if (m_bad) extra += m_config.stallDuration;
+            }
+
+            int64_t period = std::chrono::duration_cast<std::chrono::microseconds>(m_config.hiccupPeriod).count();
+            int64_t length = std::chrono::duration_cast<std::chrono::microseconds>(m_config.hiccupDuration).count();
+            if (period > 0 && length > 0) {
+                //a read issued during a hiccup waits for its end, a read running into one is held up by all of it
+                int64_t begin = start.count();
+                int64_t phase = begin % period;
+                if (phase < length) {
+                    extra += std::chrono::microseconds(length - phase);
+                } else if (begin + (extra + transfer).count() > begin - phase + period) {
+                    extra += std::chrono::microseconds(length);
+                }
+            }
+            return extra;
+        }
+
+    private:
+        ImpairmentConfig m_config;
+        std::mt19937_64 m_gen;
+        std::lognormal_distribution<double> m_latency;
+        bool m_bad; //Gilbert-Elliott state
+    };
+}
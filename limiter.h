@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace audio {
+
+    /**
+     * Lookahead peak limiter for the float master bus.
+     *
+     * The signal is handled in blocks of Block samples. Every block entering the lookahead gets the gain that
+     * brings its peak down to the ceiling. The gain applied to the block leaving the lookahead is the
+     * minimum of those over the lookahead, released smoothly, and averaged over the last LookaheadBlocks
+     * blocks. So the gain is fully down by the time a peak leaves, and the ceiling holds without clipping.
+     * The gain also ramps down ahead of the peak instead of jumping. Within a block it is interpolated
+     * linearly.
+     *
+     * The output lags the input by Lookahead samples. Nothing is padded: after a reset the first chunk comes
+     * out shorter while the lookahead fills, and drain() returns what is still held at the end. The limiter
+     * works in place on a line owned by the caller, who keeps the held samples in front of the next chunk
+     * (see MixBus), so the samples are never copied in and out.
+     *
+     * While the gain is at unity and a chunk stays below the ceiling, only the chunk's peak is computed, so
+     * the limiter costs next to nothing until it has work to do.
+     */
+    class Limiter {
+    public:
+        static const size_t Block = 8;
+        static const size_t LookaheadBlocks = 8;
+        static const size_t Lookahead = Block * LookaheadBlocks; //1.3 ms at 48kHz
+        static const size_t DrainSamples = Lookahead + Block;  //most samples drain() returns
+
+        Limiter() { configure(0.75f * 32767.0f, 4800); }
+
+        /**
+         * Sets the parameters and resets.
+         *
+         * @param ceiling largest absolute sample value let through
+         * @param releaseSamples time constant the gain recovers with after a peak passed
+         */
+        void configure(float ceiling, size_t releaseSamples) {
+            m_ceiling = ceiling;
+            m_release = 1.0f - (float)std::exp(-(double)Block / (double)std::max<size_t>(releaseSamples, 1));
+            reset();
+        }
+
+        /**
+         * Drops what the lookahead holds and returns to unity gain, e.g. after a seek.
+         */
+        void reset() {
+            m_held = 0;
+            m_entered = 0;
+            std::fill(m_targets, m_targets + LookaheadBlocks + 1, 1.0f);
+            std::fill(m_envelopes, m_envelopes + LookaheadBlocks, 1.0f);
+            m_next = 0;
+            m_envelope = 1.0f;
+            m_gain = 1.0f;
+            m_restarted = true;
+            m_unity = LookaheadBlocks + 1;
+        }
+
+        /**
+         * Limits a chunk in place.
+         *
+         * @param line the held() samples left over by the last call, followed by the new chunk
+         * @param n number of samples in the new chunk
+         * @return number of samples at the start of line that are limited and left the lookahead, the
+         *         held() ones after them have to start the next line
+         */
+        size_t process(float *line, size_t n) {
+            m_held += n;
+            return run(line);
+        }
+
+        /**
+         * Pushes the held samples out with silence, and resets.
+         *
+         * @param line the held() samples, with room for DrainSamples more
+         * @return number of samples at the start of line that left the lookahead
+         */
+        size_t drain(float *line) {
+            size_t held = m_held;
+            if (held == 0) return 0;
+            size_t padded = held + (Block - held % Block) % Block + Lookahead;
+            std::fill(line + held, line + padded, 0.0f);
+            m_held = padded;
+            run(line);
+            reset();
+            return held;
+        }
+
+        /**
+         * @return number of samples held back in the lookahead
+         */
+        size_t held() const { return m_held; }
+
+    private:
+        /**
+         * Moves the complete blocks of the line through the lookahead.
+         */
+        size_t run(float *line) {
+            size_t blocks = m_held / Block;
+            size_t exits = blocks > LookaheadBlocks ? blocks - LookaheadBlocks : 0;
+            if (m_unity > LookaheadBlocks && peak(line + m_entered * Block, (blocks - m_entered) * Block) <= m_ceiling) {
+                //nothing to limit, the gain stays at unity; the rings hold nothing but unity, so they only
+                //move on, which keeps the output independent of how the stream is chunked
+                m_unity += blocks - m_entered;
+                m_next += blocks - m_entered;
+                if (exits > 0) m_restarted = false;
+            } else {
+                for (size_t b = m_entered; b < blocks; ++b) {
+                    float gain = enter(peak(line + b * Block, Block));
+                    if (b >= LookaheadBlocks) apply(line + (b - LookaheadBlocks) * Block, gain);
+                }
+            }
+            m_held -= exits * Block;
+            m_entered = blocks - exits;
+            return exits * Block;
+        }
+
+        /**
+         * Takes a block into the lookahead.
+         *
+         * @param peak largest absolute sample of the block
+         * @return gain for the block leaving the lookahead
+         */
+        float enter(float peak) {
+            m_targets[m_next % (LookaheadBlocks + 1)] = peak > m_ceiling ? m_ceiling / peak : 1.0f;
+            float held = *std::min_element(m_targets, m_targets + LookaheadBlocks + 1);
+            //instant attack on the held minimum, exponential release, snapped to unity at the end
+            m_envelope = std::min(held, m_envelope + (1.0f - m_envelope) * m_release);
+            if (m_envelope > 0.9999f) m_envelope = 1.0f;
+            m_envelopes[m_next % LookaheadBlocks] = m_envelope;
+            m_next++;
+            m_unity = m_envelope == 1.0f ? m_unity + 1 : 0;
+
+            float sum = 0;
+            for (float e : m_envelopes) sum += e;
+            return sum / (float)LookaheadBlocks;
+        }
+
+        /**
+         * Applies a gain to a block, interpolated from the previous block's gain. The first block after a
+         * reset has no previous one and gets its own gain flat: ramping from unity would let a peak at the
+         * very start through.
+         */
+        void apply(float *block, float gain) {
+            if (m_restarted) {
+                m_gain = gain;
+                m_restarted = false;
+            }
+            size_t i = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+            const __m256 steps = _mm256_setr_ps(1, 2, 3, 4, 5, 6, 7, 8);
+            __m256 g = _mm256_fmadd_ps(_mm256_set1_ps((gain - m_gain) / (float)Block), steps, _mm256_set1_ps(m_gain));
+            _mm256_storeu_ps(block, _mm256_mul_ps(_mm256_loadu_ps(block), g));
+            i = Block;
+#endif
+            for (; i < Block; ++i) {
+                block[i] *= m_gain + (gain - m_gain) * (float)(i + 1) / (float)Block;
+            }
+            m_gain = gain;
+        }
+
+        /**
+         * @return largest absolute value of n samples, n a multiple of Block
+         */
+        static float peak(const float *x, size_t n) {
+            size_t i = 0;
+            float result = 0;
+#if defined(__AVX2__)
+            const __m256 sign = _mm256_set1_ps(-0.0f);
+            __m256 m = _mm256_setzero_ps();
+            if (n >= 32) { //four independent chains, max has a latency of several cycles
+                __m256 m1 = m, m2 = m, m3 = m;
+                for (; i + 32 <= n; i += 32) {
+                    m = _mm256_max_ps(m, _mm256_andnot_ps(sign, _mm256_loadu_ps(x + i)));
+                    m1 = _mm256_max_ps(m1, _mm256_andnot_ps(sign, _mm256_loadu_ps(x + i + 8)));
+                    m2 = _mm256_max_ps(m2, _mm256_andnot_ps(sign, _mm256_loadu_ps(x + i + 16)));
+                    m3 = _mm256_max_ps(m3, _mm256_andnot_ps(sign, _mm256_loadu_ps(x + i + 24)));
+                }
+                m = _mm256_max_ps(_mm256_max_ps(m, m1), _mm256_max_ps(m2, m3));
+            }
+            for (; i + 8 <= n; i += 8) {
+                m = _mm256_max_ps(m, _mm256_andnot_ps(sign, _mm256_loadu_ps(x + i)));
+            }
+            __m128 h = _mm_max_ps(_mm256_castps256_ps128(m), _mm256_extractf128_ps(m, 1));
+            h = _mm_max_ps(h, _mm_movehl_ps(h, h));
+            h = _mm_max_ss(h, _mm_shuffle_ps(h, h, 1));
+            result = _mm_cvtss_f32(h);
+#endif
+            for (; i < n; ++i) {
+                result = std::max(result, std::fabs(x[i]));
+            }
+            return result;
+        }
+
+        size_t m_held;                           //samples in the lookahead, then the incomplete block
+        size_t m_entered;                        //blocks at the start of the line that entered the lookahead
+        float m_targets[LookaheadBlocks + 1];    //gains the blocks in the lookahead ask for
+        float m_envelopes[LookaheadBlocks];      //released held minimum of the last blocks, averaged
+        size_t m_next;                           //ring position of the next block
+        float m_envelope;
+        float m_gain;                            //gain applied to the end of the last block that left
+        bool m_restarted;                        //no block left since the reset
+        size_t m_unity;                          //blocks entered in a row with the envelope at unity
+        float m_ceiling;
+        float m_release;                         //per block step of the release towards unity
+    };
+}
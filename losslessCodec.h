@@ -0,0 +1,397 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace audio {
+
+    /**
+     * Simple FLAC-like lossless codec for interleaved S16 audio.
+     *
+     * Stream layout: a 16 byte header ("SPLC", version, channels, sample rate, block size) followed by
+     * independently decodable, byte aligned blocks. Within a block each channel is coded separately, the
+     * second channel of a stereo pair as the side signal R - L. A channel is either constant zero, verbatim,
+     * or the residual of a fixed polynomial predictor (order 0..3) coded with a single Rice parameter.
+     */
+    namespace lossless {
+
+        static const uint8_t Version = 1;
+        static const size_t HeaderSize = 16;
+        static const size_t BlockFrames = 4096;
+
+        enum ChannelMode : uint32_t {
+            Fixed0 = 0, Fixed1 = 1, Fixed2 = 2, Fixed3 = 3, //fixed predictor of that order
+            Zero = 4,                                       //all samples are zero
+            Verbatim = 5                                    //18 bit zigzag samples
+        };
+
+        /**
+         * MSB-first bit packer.
+         */
+        class BitWriter {
+        public:
+            explicit BitWriter(std::vector<uint8_t> &out) : m_out(out), m_acc(0), m_bits(0) {}
+
+            /**
+             * @param value right aligned bits to append
+             * @param n number of bits, at most 32
+             */
+            void put(uint32_t value, unsigned n) {
+                m_acc = (m_acc << n) | value;
+                m_bits += n;
+                if (m_bits >= 32) {
+                    m_bits -= 32;
+                    uint32_t word = (uint32_t)(m_acc >> m_bits);
+                    uint8_t bytes[4] = {(uint8_t)(word >> 24), (uint8_t)(word >> 16), (uint8_t)(word >> 8), (uint8_t)word};
+                    m_out.insert(m_out.end(), bytes, bytes + 4);
+                }
+            }
+
+            /**
+             * Appends a Rice code: q zeros, a one, then the k low bits.
+             */
+            void putRice(uint32_t q, uint32_t low, unsigned k) {
+                if (q + 1 + k <= 32) {
+                    put((1u << k) | low, q + 1 + k);
+                    return;
+                }
+                while (q >= 32) {
+                    put(0, 32);
+                    q -= 32;
+                }
+                put(1, q + 1);
+                if (k > 0) put(low, k);
+            }
+
+            /**
+             * Pads the last byte with zeros.
+             */
+            void align() {
+                while (m_bits >= 8) {
+                    m_bits -= 8;
+                    m_out.push_back((uint8_t)(m_acc >> m_bits));
+                }
+                if (m_bits > 0) {
+                    m_out.push_back((uint8_t)(m_acc << (8 - m_bits)));
+                    m_bits = 0;
+                }
+                m_acc = 0;
+            }
+
+        private:
+            std::vector<uint8_t> &m_out;
+            uint64_t m_acc;
+            unsigned m_bits;
+        };
+
+        /**
+         * MSB-first bit reader over a byte range.
+         */
+        class BitReader {
+        public:
+            BitReader(const uint8_t *data, size_t size) : m_data(data), m_size(size), m_pos(0), m_acc(0), m_bits(0),
+                                                          m_overrun(false) {}
+
+            uint32_t get(unsigned n) {
+                if (n == 0) return 0;
+                refill();
+                if (n > m_bits) m_overrun = true;
+                uint32_t v = (uint32_t)(m_acc >> (64 - n));
+                m_acc <<= n;
+                m_bits -= std::min(n, m_bits);
+                return v;
+            }
+
+            /**
+             * @return number of zeros before the next one bit (the one is consumed)
+             */
+            uint32_t unary() {
+                uint32_t count = 0;
+                while (true) {
+                    refill();
+                    if (m_bits == 0) { //truncated stream
+                        m_overrun = true;
+                        return count;
+                    }
+                    if (m_acc == 0) {
+                        count += m_bits;
+                        m_bits = 0;
+                        continue;
+                    }
+                    unsigned zeros = (unsigned)__builtin_clzll(m_acc);
+                    count += zeros;
+                    m_acc <<= zeros + 1;
+                    m_bits -= zeros + 1;
+                    return count;
+                }
+            }
+
+            /**
+             * Skips to the next byte boundary.
+             */
+            void align() {
+                unsigned drop = m_bits % 8;
+                m_acc <<= drop;
+                m_bits -= drop;
+            }
+
+            bool exhausted() const { return m_pos >= m_size && m_bits == 0; }
+
+            /**
+             * @return true once more bits were read than the range holds, the missing ones read as zeros
+             */
+            bool overrun() const { return m_overrun; }
+
+        private:
+            void refill() {
+                while (m_bits <= 56 && m_pos < m_size) {
+                    m_acc |= (uint64_t)m_data[m_pos++] << (56 - m_bits);
+                    m_bits += 8;
+                }
+            }
+
+            const uint8_t *m_data;
+            size_t m_size;
+            size_t m_pos;
+            uint64_t m_acc;
+            unsigned m_bits;
+            bool m_overrun;
+        };
+
+        inline uint32_t zigzag(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+        inline int32_t unzigzag(uint32_t u) { return (int32_t)(u >> 1) ^ -(int32_t)(u & 1); }
+
+        /**
+         * Sums of absolute residuals of the fixed predictors of order 0..3, evaluated from sample 3 on.
+         * Blocks are at most BlockFrames long, so the 32 bit lane sums cannot overflow.
+         */
+        inline void predictorCosts(const int32_t *x, size_t n, uint64_t cost[4]) {
+            cost[0] = cost[1] = cost[2] = cost[3] = 0;
+            size_t i = 3;
+#if defined(__AVX2__)
+            __m256i c0 = _mm256_setzero_si256(), c1 = c0, c2 = c0, c3 = c0;
+            for (; i + 8 <= n; i += 8) {
+                __m256i x0 = _mm256_loadu_si256((const __m256i*)(x + i));
+                __m256i x1 = _mm256_loadu_si256((const __m256i*)(x + i - 1));
+                __m256i x2 = _mm256_loadu_si256((const __m256i*)(x + i - 2));
+                __m256i x3 = _mm256_loadu_si256((const __m256i*)(x + i - 3));
+                __m256i d1 = _mm256_sub_epi32(x1, x2);
+                __m256i e1 = _mm256_sub_epi32(x0, x1);
+                __m256i e2 = _mm256_sub_epi32(e1, d1);
+                __m256i e3 = _mm256_sub_epi32(e2, _mm256_sub_epi32(d1, _mm256_sub_epi32(x2, x3)));
+                c0 = _mm256_add_epi32(c0, _mm256_abs_epi32(x0));
+                c1 = _mm256_add_epi32(c1, _mm256_abs_epi32(e1));
+                c2 = _mm256_add_epi32(c2, _mm256_abs_epi32(e2));
+                c3 = _mm256_add_epi32(c3, _mm256_abs_epi32(e3));
+            }
+            uint32_t lanes[4][8];
+            _mm256_storeu_si256((__m256i*)lanes[0], c0);
+            _mm256_storeu_si256((__m256i*)lanes[1], c1);
+            _mm256_storeu_si256((__m256i*)lanes[2], c2);
+            _mm256_storeu_si256((__m256i*)lanes[3], c3);
+            for (int o = 0; o < 4; ++o) {
+                for (int l = 0; l < 8; ++l) cost[o] += lanes[o][l];
+            }
+#endif
+            for (; i < n; ++i) {
+                int32_t e1 = x[i] - x[i - 1];
+                int32_t e2 = e1 - (x[i - 1] - x[i - 2]);
+                int32_t e3 = e2 - ((x[i - 1] - x[i - 2]) - (x[i - 2] - x[i - 3]));
+                cost[0] += (uint32_t)std::abs(x[i]);
+                cost[1] += (uint32_t)std::abs(e1);
+                cost[2] += (uint32_t)std::abs(e2);
+                cost[3] += (uint32_t)std::abs(e3);
+            }
+        }
+
+        /**
+         * Zigzag coded residuals of the fixed predictor, for samples order..n-1.
+         */
+        inline void residuals(const int32_t *x, size_t n, unsigned order, uint32_t *u) {
+            static const int32_t coeffs[4][3] = {{0, 0, 0}, {1, 0, 0}, {2, -1, 0}, {3, -3, 1}};
+            const int32_t a = coeffs[order][0], b = coeffs[order][1], c = coeffs[order][2];
+            for (size_t i = order; i < n; ++i) { //branch free, auto-vectorized
+                int32_t p = a * x[i - (order > 0)] + b * x[i - 2 * (order > 1)] + c * x[i - 3 * (order > 2)];
+                u[i] = zigzag(x[i] - p);
+            }
+        }
+
+        /**
+         * Exact number of bits needed to Rice code u with parameter k.
+         */
+        inline uint64_t riceBits(const uint32_t *u, size_t n, unsigned k) {
+            uint64_t bits = (uint64_t)n * (k + 1);
+            for (size_t i = 0; i < n; ++i) bits += u[i] >> k; //auto-vectorized
+            return bits;
+        }
+
+        inline void encodeChannel(BitWriter &bw, const int32_t *x, size_t n, std::vector<uint32_t> &u) {
+            bool zero = true;
+            for (size_t i = 0; i < n; ++i) zero &= x[i] == 0;
+            if (zero) {
+                bw.put(Zero, 3);
+                return;
+            }
+
+            unsigned order = 0;
+            if (n > 3) {
+                uint64_t cost[4];
+                predictorCosts(x, n, cost);
+                order = (unsigned)(std::min_element(cost, cost + 4) - cost);
+            }
+            order = (unsigned)std::min<size_t>(order, n);
+
+            u.resize(n);
+            residuals(x, n, order, u.data());
+            const uint32_t *res = u.data() + order;
+            size_t count = n - order;
+
+            //start from the parameter matching the mean and refine locally
+            uint64_t sum = 0;
+            for (size_t i = 0; i < count; ++i) sum += res[i];
+            uint64_t mean = count > 0 ? sum / count : 0;
+            unsigned k = 0;
+            while (k < 20 && (1ull << (k + 1)) <= mean) ++k;
+            uint64_t best = riceBits(res, count, k);
+            while (k > 0) {
+                uint64_t bits = riceBits(res, count, k - 1);
+                if (bits >= best) break;
+                best = bits;
+                --k;
+            }
+            while (k < 20) {
+                uint64_t bits = riceBits(res, count, k + 1);
+                if (bits >= best) break;
+                best = bits;
+                ++k;
+            }
+
+            if (best + order * 18 + 5 >= n * 18) {
+                bw.put(Verbatim, 3);
+                for (size_t i = 0; i < n; ++i) bw.put(zigzag(x[i]), 18);
+                return;
+            }
+
+            bw.put(order, 3);
+            bw.put(k, 5);
+            for (unsigned i = 0; i < order; ++i) bw.put(zigzag(x[i]), 18);
+            const uint32_t mask = (1u << k) - 1;
+            for (size_t i = 0; i < count; ++i) bw.putRice(res[i] >> k, res[i] & mask, k);
+        }
+
+        inline bool decodeChannel(BitReader &br, int32_t *x, size_t n) {
+            uint32_t mode = br.get(3);
+            if (mode == Zero) {
+                std::fill(x, x + n, 0);
+                return true;
+            }
+            if (mode == Verbatim) {
+                for (size_t i = 0; i < n; ++i) x[i] = unzigzag(br.get(18));
+                return true;
+            }
+            if (mode > Fixed3) return false;
+            unsigned order = mode;
+            unsigned k = br.get(5);
+            for (unsigned i = 0; i < order && i < n; ++i) x[i] = unzigzag(br.get(18));
+            for (size_t i = order; i < n; ++i) {
+                uint32_t q = br.unary();
+                int32_t e = unzigzag((q << k) | br.get(k));
+                //wrapping arithmetic, a corrupt stream may push the prediction out of range
+                uint32_t p = 0;
+                switch (order) {
+                    case 1: p = (uint32_t)x[i - 1]; break;
+                    case 2: p = 2 * (uint32_t)x[i - 1] - (uint32_t)x[i - 2]; break;
+                    case 3: p = 3 * (uint32_t)x[i - 1] - 3 * (uint32_t)x[i - 2] + (uint32_t)x[i - 3]; break;
+                    default: break;
+                }
+                x[i] = (int32_t)(p + (uint32_t)e);
+            }
+            return true;
+        }
+
+        /**
+         * Writes the stream header.
+         */
+        inline void encodeHeader(std::vector<uint8_t> &out, uint32_t sampleRate, uint8_t channels) {
+            out.reserve(out.size() + HeaderSize);
+            for (char c : {'S', 'P', 'L', 'C'}) out.push_back((uint8_t)c);
+            out.push_back(Version);
+            out.push_back(channels);
+            out.push_back(0);
+            out.push_back(0);
+            for (int i = 0; i < 4; ++i) out.push_back((uint8_t)(sampleRate >> (8 * i)));
+            for (int i = 0; i < 4; ++i) out.push_back((uint8_t)((uint32_t)BlockFrames >> (8 * i)));
+        }
+
+        /**
+         * Encodes one block of interleaved samples (at most BlockFrames frames) and appends it to out.
+         */
+        class Encoder {
+        public:
+            void encodeBlock(const int16_t *interleaved, size_t frames, unsigned channels, std::vector<uint8_t> &out) {
+                m_channels.resize(channels);
+                for (unsigned c = 0; c < channels; ++c) {
+                    m_channels[c].resize(frames);
+                    for (size_t i = 0; i < frames; ++i) m_channels[c][i] = interleaved[i * channels + c];
+                }
+                if (channels == 2) { //side channel, zero for the duplicated mono mix
+                    for (size_t i = 0; i < frames; ++i) m_channels[1][i] -= m_channels[0][i];
+                }
+                BitWriter bw(out);
+                bw.put((uint32_t)frames, 16);
+                for (unsigned c = 0; c < channels; ++c) encodeChannel(bw, m_channels[c].data(), frames, m_residuals);
+                bw.align();
+            }
+
+        private:
+            std::vector<std::vector<int32_t>> m_channels;
+            std::vector<uint32_t> m_residuals;
+        };
+
+        /**
+         * Decodes a complete stream (header and blocks) back to interleaved S16.
+         *
+         * @return false if the stream is malformed or truncated within a block
+         */
+        inline bool decode(const uint8_t *data, size_t size, std::vector<int16_t> &out, uint32_t *sampleRate = nullptr,
+                           unsigned *channelCount = nullptr) {
+            if (size < HeaderSize || std::memcmp(data, "SPLC", 4) != 0 || data[4] != Version) return false;
+            unsigned channels = data[5];
+            if (channels == 0) return false;
+            if (sampleRate) *sampleRate = data[8] | data[9] << 8 | data[10] << 16 | (uint32_t)data[11] << 24;
+            if (channelCount) *channelCount = channels;
+
+            BitReader br(data + HeaderSize, size - HeaderSize);
+            std::vector<std::vector<int32_t>> x(channels);
+            out.clear();
+            while (!br.exhausted()) {
+                size_t frames = br.get(16);
+                if (frames == 0) break;
+                if (frames > BlockFrames) return false;
+                for (unsigned c = 0; c < channels; ++c) {
+                    x[c].resize(frames);
+                    if (!decodeChannel(br, x[c].data(), frames)) return false;
+                }
+                if (br.overrun()) return false;
+                if (channels == 2) {
+                    for (size_t i = 0; i < frames; ++i) x[1][i] += x[0][i];
+                }
+                size_t base = out.size();
+                out.resize(base + frames * channels);
+                for (size_t i = 0; i < frames; ++i) {
+                    for (unsigned c = 0; c < channels; ++c) out[base + i * channels + c] = (int16_t)x[c][i];
+                }
+                br.align();
+            }
+            return true;
+        }
+    }
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "losslessCodec.h"
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace io {
+
+    /**
+     * Compressed output file (see audio::lossless).
+     * The caller only copies PCM into block buffers; prediction, Rice coding and the file writes run on a
+     * dedicated writer thread, so compression never stalls the mixer.
+     */
+    class LosslessFileWriter {
+    public:
+        static const size_t MaxQueuedBlocks = 16;
+
+        LosslessFileWriter() : m_fd(-1), m_channels(0), m_stopping(false), m_error(0) {}
+        ~LosslessFileWriter() { close(); }
+
+        bool open(const std::string &path, uint32_t sampleRate, uint8_t channels) {
+            m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (m_fd < 0) {
+                m_error = errno;
+                return false;
+            }
+            m_channels = channels;
+            m_stopping = false;
+            m_error = 0;
+            m_current.clear();
+            m_current.reserve(audio::lossless::BlockFrames * channels);
+
+            std::vector<uint8_t> header;
+            audio::lossless::encodeHeader(header, sampleRate, channels);
+            writeAll(header);
+            m_thread = std::thread(&LosslessFileWriter::run, this);
+            return m_error == 0;
+        }
+
+        /**
+         * Appends interleaved S16 data. Full blocks are handed over to the writer thread.
+         */
+        void write(const char *data, size_t len) {
+            const int16_t *samples = (const int16_t*)data;
+            size_t n = len / sizeof(int16_t);
+            const size_t blockSamples = audio::lossless::BlockFrames * m_channels;
+            while (n > 0) {
+                size_t take = std::min(n, blockSamples - m_current.size());
+                m_current.insert(m_current.end(), samples, samples + take);
+                samples += take;
+                n -= take;
+                if (m_current.size() == blockSamples) submit();
+            }
+        }
+
+        /**
+         * Encodes the last partial block, waits for the writer thread and closes the file.
+         *
+         * @return false if any write failed
+         */
+        bool close() {
+            if (m_fd < 0) return true;
+            if (!m_current.empty()) submit();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            m_blockQueued.notify_all();
+            m_thread.join();
+            if (::close(m_fd) != 0 && !m_error) m_error = errno;
+            m_fd = -1;
+            return m_error == 0;
+        }
+
+    private:
+        void submit() {
+            std::vector<int16_t> next;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_blockDone.wait(lock, [&]{ return m_queue.size() < MaxQueuedBlocks; });
+                m_queue.push_back(std::move(m_current));
+                if (!m_spare.empty()) {
+                    next = std::move(m_spare.back());
+                    m_spare.pop_back();
+                }
+            }
+            m_blockQueued.notify_one();
+            m_current = std::move(next);
+            m_current.clear();
+            m_current.reserve(audio::lossless::BlockFrames * m_channels);
+        }
+
+        void run() {
+            audio::lossless::Encoder encoder;
+            std::vector<uint8_t> out;
+            while (true) {
+                std::vector<int16_t> block;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_blockQueued.wait(lock, [&]{ return m_stopping || !m_queue.empty(); });
+                    if (m_queue.empty()) return;
+                    block = std::move(m_queue.front());
+                    m_queue.pop_front();
+                }
+                out.clear();
+                encoder.encodeBlock(block.data(), block.size() / m_channels, m_channels, out);
+                writeAll(out);
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_spare.push_back(std::move(block)); //recycle the PCM buffer
+                }
+                m_blockDone.notify_one();
+            }
+        }
+
+        void writeAll(const std::vector<uint8_t> &data) {
+            const uint8_t *p = data.data();
+            size_t len = data.size();
+            while (len > 0 && !m_error) {
+                ssize_t n = ::write(m_fd, p, len);
+                if (n < 0) {
+                    if (errno != EINTR) m_error = errno;
+                    continue;
+                }
+                if (n == 0) { //no progress, retrying would spin
+                    m_error = EIO;
+                    break;
+                }
+                p += n;
+                len -= n;
+            }
+        }
+
+        int m_fd;
+        unsigned m_channels;
+        std::vector<int16_t> m_current;
+        std::thread m_thread;
+        std::mutex m_mutex;
+        std::condition_variable m_blockQueued;
+        std::condition_variable m_blockDone;
+        std::deque<std::vector<int16_t>> m_queue;
+        std::vector<std::vector<int16_t>> m_spare;
+        bool m_stopping;
+        int m_error; //only written by the writer thread until it is joined
+    };
+}
@@ -12,16 +12,25 @@ int main() {
     char playerFile[] = "audio1_s16le_mono_48k.raw";
 
     Player pl;
-    pl.open(networkFile, playerFile);
+    std::shared_future<void> ready = pl.open(networkFile, playerFile);
     pl.setMixingLevel(-0.4);
 
     pl.play();
+    try {
+        ready.get();
+    } catch (const std::runtime_error &e) {
+        std::cerr<<e.what()<<std::endl;
+        return 1;
+    }
     std::this_thread::sleep_for(std::chrono::seconds(3));
 
     pl.pause();
     std::this_thread::sleep_for(std::chrono::seconds(10));
 
     pl.play();
+    while (!pl.isFinished()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
     pl.close();
 
     return 0;
@@ -0,0 +1,336 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace metrics {
+
+    /*
+     * Counters and histograms are sharded: every thread updates its own cache line (threads are spread over
+     * Shards slots round robin) with relaxed atomics, and only a scrape sums the shards up. Updating one is a
+     * single uncontended atomic add, cheap enough for the mixer's hot path.
+     */
+    const size_t Shards = 8;
+
+    /**
+     * @return shard of the calling thread
+     */
+    inline size_t shard() {
+        static std::atomic<size_t> next(0);
+        thread_local size_t index = next.fetch_add(1, std::memory_order_relaxed) % Shards;
+        return index;
+    }
+
+    /**
+     * Monotonically increasing count, e.g. of samples or bytes.
+     */
+    class Counter {
+    public:
+        Counter() {
+            for (Slot &slot : m_slots) slot.value.store(0, std::memory_order_relaxed);
+        }
+
+        void add(uint64_t n = 1) {
+            m_slots[shard()].value.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        uint64_t value() const {
+            uint64_t sum = 0;
+            for (const Slot &slot : m_slots) sum += slot.value.load(std::memory_order_relaxed);
+            return sum;
+        }
+
+    private:
+        struct alignas(64) Slot {
+            std::atomic<uint64_t> value;
+        };
+        Slot m_slots[Shards];
+    };
+
+    /**
+     * Value that goes up and down, e.g. a buffer fill. Last write wins.
+     */
+    class Gauge {
+    public:
+        Gauge() : m_value(0) {}
+
+        void set(double value) {
+            m_value.store(value, std::memory_order_relaxed);
+        }
+
+        double value() const {
+            return m_value.load(std::memory_order_relaxed);
+        }
+
+    private:
+        alignas(64) std::atomic<double> m_value;
+    };
+
+    /**
+     * Distribution of observed values over fixed buckets, e.g. latencies in seconds.
+     */
+    class Histogram {
+    public:
+        /**
+         * @param bounds upper bounds of the buckets in increasing order, +Inf is implied
+         */
+        explicit Histogram(const std::vector<double> &bounds) : m_bounds(bounds) {
+            for (Shard &s : m_shards) {
+                s.buckets.reset(new std::atomic<uint64_t>[bounds.size() + 1]);
+                for (size_t i = 0; i <= bounds.size(); ++i) s.buckets[i].store(0, std::memory_order_relaxed);
+                s.sum.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        void observe(double value) {
+            size_t bucket = 0;
+            while (bucket < m_bounds.size() && value > m_bounds[bucket]) bucket++;
+            Shard &s = m_shards[shard()];
+            s.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+            s.sum.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        const std::vector<double> &bounds() const {
+            return m_bounds;
+        }
+
+        /**
+         * @return non-cumulative count per bucket, the last one is +Inf
+         */
+        std::vector<uint64_t> counts() const {
+            std::vector<uint64_t> counts(m_bounds.size() + 1, 0);
+            for (const Shard &s : m_shards) {
+                for (size_t i = 0; i < counts.size(); ++i) counts[i] += s.buckets[i].load(std::memory_order_relaxed);
+            }
+            return counts;
+        }
+
+        double sum() const {
+            double sum = 0;
+            for (const Shard &s : m_shards) sum += s.sum.load(std::memory_order_relaxed);
+            return sum;
+        }
+
+        /**
+         * @return count bounds from start, each factor times the previous one
+         */
+        static std::vector<double> exponentialBounds(double start, double factor, size_t count) {
+            std::vector<double> bounds;
+            for (size_t i = 0; i < count; ++i, start *= factor) bounds.push_back(start);
+            return bounds;
+        }
+
+    private:
+        struct alignas(64) Shard {
+            std::unique_ptr<std::atomic<uint64_t>[]> buckets;
+            std::atomic<double> sum;
+        };
+        std::vector<double> m_bounds;
+        Shard m_shards[Shards];
+    };
+
+    /**
+     * Named metrics, rendered in the Prometheus text exposition format. Metrics are registered up front
+     * and live as long as the registry, so the references handed out can be kept and updated without
+     * any lookup.
+     */
+    class Registry {
+    public:
+        Counter &counter(const std::string &name, const std::string &help) {
+            std::unique_ptr<Entry> entry(new Entry(name, help, "counter"));
+            entry->counter.reset(new Counter());
+            return *add(std::move(entry)).counter;
+        }
+
+        Gauge &gauge(const std::string &name, const std::string &help) {
+            std::unique_ptr<Entry> entry(new Entry(name, help, "gauge"));
+            entry->gauge.reset(new Gauge());
+            return *add(std::move(entry)).gauge;
+        }
+
+        Histogram &histogram(const std::string &name, const std::string &help, const std::vector<double> &bounds) {
+            std::unique_ptr<Entry> entry(new Entry(name, help, "histogram"));
+            entry->histogram.reset(new Histogram(bounds));
+            return *add(std::move(entry)).histogram;
+        }
+
+        /**
+         * @return all metrics in the Prometheus text format (version 0.0.4)
+         */
+        std::string render() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::string out;
+            for (const std::unique_ptr<Entry> &e : m_entries) {
+                out += "# HELP " + e->name + " " + e->help + "\n";
+                out += "# TYPE " + e->name + " " + e->type + "\n";
+                if (e->counter) {
+                    out += e->name + " " + std::to_string(e->counter->value()) + "\n";
+                } else if (e->gauge) {
+                    out += e->name + " " + number(e->gauge->value()) + "\n";
+                } else {
+                    std::vector<uint64_t> counts = e->histogram->counts();
+                    uint64_t cumulative = 0;
+                    for (size_t i = 0; i < counts.size(); ++i) {
+                        cumulative += counts[i];
+                        std::string le = i < e->histogram->bounds().size() ? number(e->histogram->bounds()[i]) : "+Inf";
+                        out += e->name + "_bucket{le=\"" + le + "\"} " + std::to_string(cumulative) + "\n";
+                    }
+                    out += e->name + "_sum " + number(e->histogram->sum()) + "\n";
+                    out += e->name + "_count " + std::to_string(cumulative) + "\n";
+                }
+            }
+            return out;
+        }
+
+    private:
+        struct Entry {
+            std::string name;
+            std::string help;
+            const char *type;
+            std::unique_ptr<Counter> counter;
+            std::unique_ptr<Gauge> gauge;
+            std::unique_ptr<Histogram> histogram;
+
+            Entry(const std::string &name, const std::string &help, const char *type)
+                    : name(name), help(help), type(type) {}
+        };
+
+        /**
+         * Publishes a complete entry, so render() never sees one without its metric.
+         */
+        Entry &add(std::unique_ptr<Entry> entry) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_entries.push_back(std::move(entry));
+            return *m_entries.back();
+        }
+
+        static std::string number(double value) {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+            return buffer;
+        }
+
+        mutable std::mutex m_mutex;
+        std::vector<std::unique_ptr<Entry>> m_entries;
+    };
+
+    /**
+     * Serves a registry on a Unix domain socket, from a thread of its own so scrapes never touch the
+     * threads that update the metrics. Every connection gets the current metrics and is closed. A client
+     * that sends an HTTP request (e.g. curl --unix-socket) gets an HTTP response, anything else (e.g.
+     * socat, nc -U) the plain text.
+     */
+    class Exporter {
+    public:
+        Exporter() : m_listen(-1) {
+            m_wake[0] = m_wake[1] = -1;
+        }
+        ~Exporter() { stop(); }
+
+        /**
+         * Starts serving. A stale socket file at the path is replaced.
+         *
+         * @return false if the socket can't be set up, errno tells why
+         */
+        bool start(const std::string &path, const Registry &registry) {
+            stop();
+            sockaddr_un address;
+            std::memset(&address, 0, sizeof(address));
+            address.sun_family = AF_UNIX;
+            if (path.size() >= sizeof(address.sun_path)) {
+                errno = ENAMETOOLONG;
+                return false;
+            }
+            std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+            ::unlink(path.c_str());
+            m_listen = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (m_listen < 0 || ::bind(m_listen, (const sockaddr*)&address, sizeof(address)) != 0 ||
+                ::listen(m_listen, 8) != 0 || ::pipe2(m_wake, O_CLOEXEC) != 0) {
+                int error = errno;
+                stop();
+                errno = error;
+                return false;
+            }
+            m_path = path;
+            m_thread = std::thread(&Exporter::serve, this, &registry);
+            return true;
+        }
+
+        void stop() {
+            if (m_thread.joinable()) {
+                char byte = 0;
+                while (::write(m_wake[1], &byte, 1) < 0 && errno == EINTR) {}
+                m_thread.join();
+            }
+            for (int *fd : {&m_listen, &m_wake[0], &m_wake[1]}) {
+                if (*fd >= 0) ::close(*fd);
+                *fd = -1;
+            }
+            if (!m_path.empty()) ::unlink(m_path.c_str());
+            m_path.clear();
+        }
+
+    private:
+        void serve(const Registry *registry) {
+            while (true) {
+                pollfd fds[2] = {{m_listen, POLLIN, 0}, {m_wake[0], POLLIN, 0}};
+                if (::poll(fds, 2, -1) < 0) {
+                    if (errno == EINTR) continue;
+                    return;
+                }
+                if (fds[1].revents) return;
+                int client = ::accept4(m_listen, nullptr, nullptr, SOCK_CLOEXEC);
+                if (client < 0) continue;
+                respond(client, *registry);
+                ::close(client);
+            }
+        }
+
+        static void respond(int client, const Registry &registry) {
+            //give the client a moment to send its request, plain readers send nothing
+            char request[1024];
+            ssize_t n = 0;
+            pollfd fd = {client, POLLIN, 0};
+            if (::poll(&fd, 1, 100) > 0) n = ::recv(client, request, sizeof(request), 0);
+            bool http = n >= 4 && std::memcmp(request, "GET ", 4) == 0;
+
+            std::string body = registry.render();
+            std::string response;
+            if (http) {
+                response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                           std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+            }
+            response += body;
+
+            const char *p = response.data();
+            size_t left = response.size();
+            while (left > 0) {
+                ssize_t sent = ::send(client, p, left, MSG_NOSIGNAL);
+                if (sent < 0 && errno == EINTR) continue;
+                if (sent <= 0) return;
+                p += sent;
+                left -= sent;
+            }
+        }
+
+        int m_listen;
+        int m_wake[2]; //self pipe to stop the server thread
+        std::string m_path;
+        std::thread m_thread;
+    };
+}
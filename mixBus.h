@@ -0,0 +1,867 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "limiter.h"
+
+namespace audio {
+
+    /**
+     * Peak and RMS of a signal over some interval, relative to S16 full scale (1 is 32768).
+     */
+    struct Level {
+        float peak;
+        float rms;
+    };
+
+    /**
+     * Accumulates the peak and the mean square of a signal. The mix kernels feed it from the vectors they
+     * already have in registers, so metering needs no pass over the samples of its own: every lane keeps a
+     * peak and a float sum of squares, which count() folds into a double every FoldSamples so long
+     * intervals stay accurate.
+     */
+    class LevelMeter {
+    public:
+        static const size_t Lanes = 8;
+        static const size_t FoldSamples = 4096;
+
+        LevelMeter() { reset(); }
+
+        void reset() {
+            std::fill(m_peak, m_peak + Lanes, 0.0f);
+            std::fill(m_squares, m_squares + Lanes, 0.0f);
+            m_sumSquares = 0;
+            m_samples = 0;
+            m_unfolded = 0;
+        }
+
+        /**
+         * Accounts for metered samples, including silence that was never passed to a kernel.
+         */
+        void count(size_t samples) {
+            m_samples += samples;
+            m_unfolded += samples;
+            if (m_unfolded >= FoldSamples) fold();
+        }
+
+        uint64_t samples() const { return m_samples; }
+
+        Level level() const {
+            float peak = 0;
+            double sumSquares = m_sumSquares;
+            for (size_t k = 0; k < Lanes; ++k) {
+                peak = std::max(peak, m_peak[k]);
+                sumSquares += m_squares[k];
+            }
+            double rms = m_samples > 0 ? std::sqrt(sumSquares / (double)m_samples) : 0.0;
+            return {peak / 32768.0f, (float)(rms / 32768.0)};
+        }
+
+        //per lane accumulators, updated by the kernels
+        float *peakLanes() { return m_peak; }
+        float *squareLanes() { return m_squares; }
+
+    private:
+        void fold() {
+            for (size_t k = 0; k < Lanes; ++k) {
+                m_sumSquares += m_squares[k];
+                m_squares[k] = 0.0f;
+            }
+            m_unfolded = 0;
+        }
+
+        alignas(32) float m_peak[Lanes];
+        alignas(32) float m_squares[Lanes];
+        double m_sumSquares;
+        uint64_t m_samples;
+        size_t m_unfolded;
+    };
+
+    /**
+     * Scalar metering of sample i, for the tails of the kernels.
+     */
+    inline void meterSample(LevelMeter &meter, size_t i, float v) {
+        float *peak = meter.peakLanes() + (i & (LevelMeter::Lanes - 1));
+        *peak = std::max(*peak, std::fabs(v));
+        meter.squareLanes()[i & (LevelMeter::Lanes - 1)] += v * v;
+    }
+
+#if defined(__AVX2__) && defined(__FMA__) //the kernels use fused multiply-add
+    /**
+     * A LevelMeter's lanes held in registers while a kernel runs.
+     */
+    class MeterLanes {
+    public:
+        explicit MeterLanes(LevelMeter &meter)
+                : m_meter(meter), m_peak(_mm256_loadu_ps(meter.peakLanes())),
+                  m_squares(_mm256_loadu_ps(meter.squareLanes())) {}
+
+        void add(__m256 v) {
+            m_peak = _mm256_max_ps(m_peak, _mm256_andnot_ps(_mm256_set1_ps(-0.0f), v));
+            m_squares = _mm256_fmadd_ps(v, v, m_squares);
+        }
+
+        /**
+         * Writes the lanes back to the meter.
+         */
+        void store() {
+            _mm256_storeu_ps(m_meter.peakLanes(), m_peak);
+            _mm256_storeu_ps(m_meter.squareLanes(), m_squares);
+        }
+
+    private:
+        LevelMeter &m_meter;
+        __m256 m_peak;
+        __m256 m_squares;
+    };
+#endif
+
+    /**
+     * Converts a S16 source into the float bus, overwriting it.
+     * Used for the first source of a chunk so the bus never needs a separate clear pass.
+     *
+     * @param bus destination bus (n samples)
+     * @param src S16 source samples
+     * @param n number of samples
+     * @param gain linear gain applied to every sample
+     * @param meter metered with the gained samples
+     */
+    inline void convertS16(float *bus, const int16_t *src, size_t n, float gain, LevelMeter &meter) {
+        size_t i = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+        const __m256 g = _mm256_set1_ps(gain);
+        MeterLanes lanes(meter);
+        for (; i + 8 <= n; i += 8) {
+            __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+            __m256 v = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(s)), g);
+            _mm256_storeu_ps(bus + i, v);
+            lanes.add(v);
+        }
+        lanes.store();
+#endif
+        for (; i < n; ++i) {
+            bus[i] = gain * (float)src[i];
+            meterSample(meter, i, bus[i]);
+        }
+    }
+
+    /**
+     * Adds a gained S16 source onto the float bus.
+     *
+     * @param bus bus to accumulate into (n samples)
+     * @param src S16 source samples
+     * @param n number of samples
+     * @param gain linear gain applied to every sample
+     * @param meter metered with the gained samples
+     */
+    inline void accumulateS16(float *bus, const int16_t *src, size_t n, float gain, LevelMeter &meter) {
+        size_t i = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+        const __m256 g = _mm256_set1_ps(gain);
+        MeterLanes lanes(meter);
+        for (; i + 8 <= n; i += 8) {
+            __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+            __m256 f = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(s));
+            _mm256_storeu_ps(bus + i, _mm256_fmadd_ps(f, g, _mm256_loadu_ps(bus + i)));
+            lanes.add(_mm256_mul_ps(f, g)); //metered apart, the fused sum stays as it was
+        }
+        lanes.store();
+#endif
+        for (; i < n; ++i) {
+            float v = gain * (float)src[i];
+            bus[i] += v;
+            meterSample(meter, i, v);
+        }
+    }
+
+    /*
+     * Soft clip curve: linear up to SoftClipKnee, then a quadratic that runs into full scale with zero slope
+     * at SoftClipKnee + 2 * SoftClipRange and stays there. The slope is continuous, so overs are rounded off
+     * instead of squared off. With u the position within the bend, 0 to 1, that is
+     * |y| = min(|x|, SoftClipKnee + 2 * SoftClipRange) - SoftClipRange * u^2.
+     * The range is a power of two, so the scaling is exact and the curve lands on full scale exactly.
+     */
+    const float SoftClipRange = 8192.0f;
+    const float SoftClipKnee = 32767.0f - SoftClipRange; //0.75 of full scale
+
+    inline float softClip(float x) {
+        float a = std::fabs(x);
+        float u = std::min(std::max(a - SoftClipKnee, 0.0f) * (1.0f / (2 * SoftClipRange)), 1.0f);
+        float y = std::min(a, SoftClipKnee + 2 * SoftClipRange) - SoftClipRange * u * u;
+        return std::copysign(y, x);
+    }
+
+#if defined(__AVX2__) && defined(__FMA__)
+    /**
+     * Branch-free softClip() of 8 samples.
+     */
+    inline __m256 softClip(__m256 x) {
+        const __m256 sign = _mm256_set1_ps(-0.0f);
+        __m256 a = _mm256_andnot_ps(sign, x);
+        __m256 u = _mm256_max_ps(_mm256_sub_ps(a, _mm256_set1_ps(SoftClipKnee)), _mm256_setzero_ps());
+        u = _mm256_min_ps(_mm256_mul_ps(u, _mm256_set1_ps(1.0f / (2 * SoftClipRange))), _mm256_set1_ps(1.0f));
+        __m256 y = _mm256_fnmadd_ps(_mm256_set1_ps(SoftClipRange), _mm256_mul_ps(u, u),
+                                    _mm256_min_ps(a, _mm256_set1_ps(SoftClipKnee + 2 * SoftClipRange)));
+        return _mm256_or_ps(y, _mm256_and_ps(sign, x));
+    }
+#endif
+
+    enum class DitherMode {
+        None,  //round to nearest, the rounding error follows the signal
+        Tpdf,  //triangular dither of up to ±1 LSB, a flat noise floor free of distortion
+        Shaped //TPDF with first-order error feedback, moves the noise from low frequencies towards Nyquist
+    };
+
+    /*
+     * Noise shaping works on samples in fixed point with ShapeBits fractional bits, so the error feedback
+     * is a few integer operations per sample. 1/256 LSB is far below the dither, and the fractions fit the
+     * 16-bit lanes of the vector path.
+     */
+    const int ShapeBits = 8;
+
+    /**
+     * State of the output dither: one xorshift32 generator per vector lane, and the quantization error
+     * fed back by noise shaping. A fixed seed keeps the output reproducible.
+     */
+    class Dither {
+    public:
+        static const size_t Lanes = 8;
+
+        Dither() { reset(); }
+
+        void reset() {
+            uint32_t x = 0x9e3779b9u;
+            for (uint32_t &s : m_state) {
+                x = x * 1664525u + 1013904223u;
+                s = x | 1; //xorshift must never be zero
+            }
+            m_error = 0;
+        }
+
+        uint32_t *state() { return m_state; }
+        int32_t &error() { return m_error; }
+
+    private:
+        alignas(32) uint32_t m_state[Lanes];
+        int32_t m_error; //fixed point, see ShapeBits
+    };
+
+    /**
+     * Advances one xorshift32 generator. The two 16-bit halves of the result serve as two uniform random
+     * values, their difference is triangular (TPDF) dither of up to ±1 LSB.
+     */
+    inline uint32_t xorshift(uint32_t &state) {
+        uint32_t x = state;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        state = x;
+        return x;
+    }
+
+    /**
+     * @return TPDF dither value in (-1, 1) LSB
+     */
+    inline float tpdf(uint32_t &state) {
+        uint32_t x = xorshift(state);
+        return ((float)(x & 0xffff) - (float)(x >> 16)) * (1.0f / 65536);
+    }
+
+    /**
+     * @return TPDF dither value in fixed point, see ShapeBits: the difference of two bytes of the result. Every
+     *         result serves two samples, the first one advances the generator and the second one takes the
+     *         upper two bytes of the same result.
+     */
+    inline int32_t tpdfFixed(uint32_t &state, bool second) {
+        uint32_t x = second ? state >> 16 : xorshift(state);
+        return ((int32_t)(x & 0xff) - (int32_t)(x >> 8 & 0xff)) * (1 << (ShapeBits - 8));
+    }
+
+#if defined(__AVX2__) && defined(__FMA__)
+    /**
+     * xorshift() of 8 generators at once.
+     */
+    inline __m256i xorshift(__m256i &state) {
+        __m256i x = state;
+        x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+        x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+        x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+        state = x;
+        return x;
+    }
+
+    inline __m256 tpdf(__m256i &state) {
+        __m256i x = xorshift(state);
+        __m256 low = _mm256_cvtepi32_ps(_mm256_and_si256(x, _mm256_set1_epi32(0xffff)));
+        __m256 high = _mm256_cvtepi32_ps(_mm256_srli_epi32(x, 16));
+        return _mm256_mul_ps(_mm256_sub_ps(low, high), _mm256_set1_ps(1.0f / 65536));
+    }
+
+    /**
+     * tpdfFixed() of 8 generators at once, for 16 samples in 16-bit lanes: sample k takes byte pair k % 2 of
+     * generator k / 2.
+     */
+    inline __m256i tpdfFixed(__m256i &state) {
+        __m256i x = xorshift(state);
+        return _mm256_maddubs_epi16(x, _mm256_set1_epi16(0xff01)); //low byte * 1 + high byte * -1
+    }
+#endif
+
+    /**
+     * Quantizes one sample with first-order noise shaping: the error the last sample made is subtracted
+     * before rounding, which filters the total error with (1 - z^-1). The error is taken before saturation,
+     * so it stays within ±1.5 LSB and overs can't make the loop run away.
+     *
+     * Callers pass the sums that don't depend on the last sample, so the serial chain from one sample to
+     * the next is just a subtraction, an and and another subtraction.
+     *
+     * @param w sample plus dither plus half an LSB, in fixed point
+     * @param c dither plus half an LSB, in fixed point
+     * @param error error of the last sample in fixed point, updated
+     * @return quantized sample, may exceed the int16 range by 1
+     */
+    inline int32_t shape(int32_t w, int32_t c, int32_t &error) {
+        int32_t a = w - error; //rounds to nearest when the fraction is cut off
+        error = c - (a & ((1 << ShapeBits) - 1));
+        return a >> ShapeBits;
+    }
+
+#if defined(__AVX2__) && defined(__FMA__)
+    /**
+     * @return prefix sums x_0 + ... + x_k of the 16-bit lanes, wrapping around
+     */
+    inline __m256i prefixSum16(__m256i x) {
+        x = _mm256_add_epi16(x, _mm256_slli_si256(x, 2)); //within the 128-bit halves
+        x = _mm256_add_epi16(x, _mm256_slli_si256(x, 4));
+        x = _mm256_add_epi16(x, _mm256_slli_si256(x, 8));
+        __m256i last = _mm256_shuffle_epi8(x, _mm256_set1_epi16(0x0f0e));
+        return _mm256_add_epi16(x, _mm256_permute2x128_si256(last, last, 0x08)); //carried into the high half
+    }
+
+    /**
+     * shape() of 16 consecutive samples at once, in 16-bit lanes, with the same results.
+     *
+     * Split into integer parts X_k and fractions f_k, the sum of the quantized samples up to k is the sum of
+     * the X_j plus the sum g_k = f_0 + ... + f_k + d_k - error rounded down to whole LSBs. So every quantized
+     * sample is X_k plus the difference of neighbouring g_k rounded down, out of one prefix sum, and the
+     * serial chain is one per 16 samples instead of one per sample. The differences are -3 to 3 LSB, which
+     * 16-bit lanes hold even when the sums wrap.
+     *
+     * To save an addition, the half LSB that makes the rounding go to nearest is kept in the error instead
+     * of being added to the dither.
+     *
+     * @param f fractions of the samples in fixed point
+     * @param d dither in fixed point
+     * @param error error of the last sample minus half an LSB in every lane, in fixed point, updated
+     * @return quantized samples minus their integer parts
+     */
+    inline __m256i shape(__m256i f, __m256i d, __m256i &error) {
+        __m256i q = _mm256_sub_epi16(prefixSum16(f), error);
+        __m256i s = _mm256_and_si256(_mm256_add_epi16(q, d), _mm256_set1_epi16(-(1 << ShapeBits)));
+
+        //the sums up to the sample before each, from the lanes moved up by one; 0 before the first sample
+        __m256i last = _mm256_alignr_epi8(s, _mm256_permute2x128_si256(s, s, 0x08), 14);
+
+        //dither minus the fraction cut off, of the last sample
+        __m256i e = _mm256_sub_epi16(s, q);
+        e = _mm256_permute2x128_si256(e, e, 0x11);
+        error = _mm256_shuffle_epi8(e, _mm256_set1_epi16(0x0f0e));
+        return _mm256_srai_epi16(_mm256_sub_epi16(s, last), ShapeBits);
+    }
+
+    inline __m128i prefixSum16(__m128i x) {
+        x = _mm_add_epi16(x, _mm_slli_si128(x, 2));
+        x = _mm_add_epi16(x, _mm_slli_si128(x, 4));
+        return _mm_add_epi16(x, _mm_slli_si128(x, 8));
+    }
+
+    /**
+     * shape() of 8 consecutive samples, for the end of a chunk.
+     */
+    inline __m128i shape(__m128i f, __m128i d, __m128i &error) {
+        __m128i q = _mm_sub_epi16(prefixSum16(f), error);
+        __m128i s = _mm_and_si128(_mm_add_epi16(q, d), _mm_set1_epi16(-(1 << ShapeBits)));
+        error = _mm_shuffle_epi8(_mm_sub_epi16(s, q), _mm_set1_epi16(0x0f0e));
+        return _mm_srai_epi16(_mm_sub_epi16(s, _mm_slli_si128(s, 2)), ShapeBits);
+    }
+#endif
+
+    /**
+     * Converts the float bus to interleaved stereo S16LE, saturating at the int16 range.
+     * Both channels carry the same (mono) bus signal.
+     *
+     * Dither is fused into the conversion: the random numbers come from a vector of xorshift generators and
+     * cost a handful of integer operations per 8 samples. Noise shaping feeds every sample's error into the
+     * next one, a serial dependency, which the vector path resolves 16 samples at a time, see shape().
+     *
+     * @tparam SoftClip round overs off with softClip() before saturating
+     * @tparam Mode dither added before rounding to int16
+     * @param dst destination buffer (2 * n samples)
+     * @param bus source bus (n samples)
+     * @param n number of bus samples
+     * @param meter metered with the bus before it saturates, a peak above full scale means clipping
+     * @param dither dither state, unused with DitherMode::None
+     */
+    template <bool SoftClip, DitherMode Mode>
+    inline void storeS16Stereo(int16_t *dst, const float *bus, size_t n, LevelMeter &meter, Dither &dither) {
+        size_t i = 0;
+        uint32_t *state = dither.state();
+        int32_t error = dither.error();
+#if defined(__AVX2__) && defined(__FMA__)
+        __m256i errors = _mm256_set1_epi16((int16_t)(error - (1 << (ShapeBits - 1)))); //see shape()
+        const __m256 hi = _mm256_set1_ps(32767.0f);
+        const __m256 lo = _mm256_set1_ps(-32768.0f);
+        MeterLanes lanes(meter);
+        __m256i random = _mm256_load_si256((const __m256i*)state);
+
+        //meters 8 samples and brings them into the int16 range
+        auto prepare = [&](__m256 b) {
+            lanes.add(b);
+            if (SoftClip) b = softClip(b);
+            if (Mode == DitherMode::Tpdf) b = _mm256_add_ps(b, tpdf(random));
+            return _mm256_min_ps(_mm256_max_ps(b, lo), hi); //still the hard guarantee against wraparound
+        };
+
+        if (Mode == DitherMode::Shaped) {
+            const __m256 scale = _mm256_set1_ps(1 << ShapeBits);
+            auto fixed = [&](__m256 b) { return _mm256_cvtps_epi32(_mm256_mul_ps(prepare(b), scale)); };
+            //16 samples in 16-bit lanes: the integer parts are bytes 1 and 2 of the clamped samples, the fractions
+            //byte 0. Combining two vectors works within the 128-bit halves, which leaves the samples in the order
+            //0-3, 8-11, 4-7, 12-15: the integer parts stay like that, since unpacking into L/R restores the order,
+            //and the fractions are put in order for the prefix sums.
+            const __m256i split = _mm256_setr_epi8(1, 2, 5, 6, 9, 10, 13, 14, 0, -1, 4, -1, 8, -1, 12, -1,
+                                                   1, 2, 5, 6, 9, 10, 13, 14, 0, -1, 4, -1, 8, -1, 12, -1);
+            for (; i + 16 <= n; i += 16) {
+                __m256i x0 = _mm256_shuffle_epi8(fixed(_mm256_loadu_ps(bus + i)), split);
+                __m256i x1 = _mm256_shuffle_epi8(fixed(_mm256_loadu_ps(bus + i + 8)), split);
+                __m256i f = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(x0, x1), 0xd8);
+                __m256i y = _mm256_permute4x64_epi64(shape(f, tpdfFixed(random), errors), 0xd8);
+                y = _mm256_adds_epi16(_mm256_unpacklo_epi64(x0, x1), y);
+                _mm256_storeu_si256((__m256i*)(dst + 2 * i), _mm256_unpacklo_epi16(y, y));
+                _mm256_storeu_si256((__m256i*)(dst + 2 * i + 16), _mm256_unpackhi_epi16(y, y));
+            }
+            if (i + 8 <= n) {
+                //the last 8 take the dither of the first 8 of a pair, so only generators 0 to 3 advance
+                __m256i advanced = random;
+                __m128i d = _mm256_castsi256_si128(tpdfFixed(advanced));
+                random = _mm256_blend_epi32(random, advanced, 0x0f);
+                __m256i x = _mm256_shuffle_epi8(fixed(_mm256_loadu_ps(bus + i)), split);
+                __m128i low = _mm256_castsi256_si128(x);
+                __m128i high = _mm256_extracti128_si256(x, 1);
+                __m128i e = _mm256_castsi256_si128(errors);
+                __m128i y = _mm_adds_epi16(_mm_unpacklo_epi64(low, high), shape(_mm_unpackhi_epi64(low, high), d, e));
+                errors = _mm256_broadcastsi128_si256(e);
+                _mm_storeu_si128((__m128i*)(dst + 2 * i), _mm_unpacklo_epi16(y, y));
+                _mm_storeu_si128((__m128i*)(dst + 2 * i + 8), _mm_unpackhi_epi16(y, y));
+                i += 8;
+            }
+        } else {
+            for (; i + 8 <= n; i += 8) {
+                __m256i v = _mm256_cvtps_epi32(prepare(_mm256_loadu_ps(bus + i)));
+                // saturating pack of the two 128-bit halves, then duplicate every sample into L/R
+                __m128i s = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+                _mm_storeu_si128((__m128i*)(dst + 2 * i), _mm_unpacklo_epi16(s, s));
+                _mm_storeu_si128((__m128i*)(dst + 2 * i + 8), _mm_unpackhi_epi16(s, s));
+            }
+        }
+        lanes.store();
+        if (Mode != DitherMode::None) _mm256_store_si256((__m256i*)state, random);
+        error = (int16_t)_mm256_cvtsi256_si32(errors) + (1 << (ShapeBits - 1));
+#endif
+        for (; i < n; ++i) {
+            float f = bus[i];
+            meterSample(meter, i, f);
+            if (SoftClip) f = softClip(f);
+            if (Mode == DitherMode::Tpdf) f += tpdf(state[i % Dither::Lanes]);
+            f = f < -32768.0f ? -32768.0f : f;
+            f = f > 32767.0f ? 32767.0f : f;
+            int16_t s;
+            if (Mode == DitherMode::Shaped) {
+                int32_t x = (int32_t)std::lrint(f * (float)(1 << ShapeBits));
+                int32_t d = tpdfFixed(state[i % 16 / 2], i % 2 == 1) + (1 << (ShapeBits - 1));
+                s = (int16_t)std::min(std::max(shape(x + d, d, error), -32768), 32767);
+            } else {
+                s = (int16_t)std::lrint(f);
+            }
+            dst[2 * i] = s;
+            dst[2 * i + 1] = s;
+        }
+        if (Mode == DitherMode::Shaped) dither.error() = error;
+    }
+
+    /**
+     * Applies a gain that moves along the per-sample recurrence g = target + d, d <- d * mul + add.
+     * Linear ramps use mul = 1, exponential ramps use add = 0; both share the same vector kernel.
+     *
+     * @tparam Accumulate add onto the bus (true) or overwrite it (false)
+     * @param bus bus (n samples)
+     * @param src S16 source samples
+     * @param n number of samples
+     * @param target gain the ramp converges to
+     * @param d distance from the target at the first sample
+     * @param mul per-sample multiplicative step of the distance
+     * @param add per-sample additive step of the distance
+     * @param meter metered with the gained samples
+     * @return distance from the target after the last sample
+     */
+    template <bool Accumulate>
+    inline float rampS16(float *bus, const int16_t *src, size_t n, float target, float d, float mul, float add,
+                         LevelMeter &meter) {
+        size_t i = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+        if (n >= 8) {
+            float lanes[8];
+            float mul8 = 1.0f, add8 = 0.0f;
+            for (int k = 0; k < 8; ++k) {
+                lanes[k] = d;
+                d = d * mul + add;
+                add8 = add8 * mul + add;
+                mul8 *= mul;
+            }
+            const __m256 t = _mm256_set1_ps(target);
+            const __m256 m8 = _mm256_set1_ps(mul8);
+            const __m256 a8 = _mm256_set1_ps(add8);
+            __m256 dv = _mm256_loadu_ps(lanes);
+            MeterLanes meterLanes(meter);
+            for (; i + 8 <= n; i += 8) {
+                __m256 g = _mm256_add_ps(t, dv);
+                __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+                __m256 f = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(s));
+                __m256 v = _mm256_mul_ps(f, g);
+                __m256 r = Accumulate ? _mm256_fmadd_ps(f, g, _mm256_loadu_ps(bus + i)) : v;
+                _mm256_storeu_ps(bus + i, r);
+                meterLanes.add(v);
+                dv = _mm256_fmadd_ps(dv, m8, a8);
+            }
+            _mm256_storeu_ps(lanes, dv);
+            meterLanes.store();
+            d = lanes[0];
+        }
+#endif
+        for (; i < n; ++i) {
+            float g = target + d;
+            float v = g * (float)src[i];
+            bus[i] = Accumulate ? bus[i] + v : v;
+            meterSample(meter, i, v);
+            d = d * mul + add;
+        }
+        return d;
+    }
+
+    enum class RampShape {
+        Linear,     //constant slope, reaches the target exactly after the ramp duration
+        Exponential //one-pole approach, within -60 dB of the target after the ramp duration
+    };
+
+    /**
+     * Smoothed gain of a single source.
+     * While a ramp is active the vectorized ramp kernel is used; once it completes the gain snaps to
+     * the target and the constant-gain fast path takes over again.
+     */
+    class GainRamp {
+    public:
+        GainRamp() : m_target(0), m_d(0), m_mul(1), m_add(0), m_remaining(0) {}
+
+        /**
+         * Jumps to a gain without ramping.
+         */
+        void reset(float gain) {
+            m_target = gain;
+            m_d = 0;
+            m_remaining = 0;
+        }
+
+        /**
+         * Starts a ramp from the current gain towards a new target.
+         *
+         * @param target new gain
+         * @param length ramp duration in samples, 0 jumps immediately
+         * @param shape ramp curve
+         */
+        void setTarget(float target, size_t length, RampShape shape) {
+            float from = current();
+            if (length == 0 || from == target) {
+                reset(target);
+                return;
+            }
+            m_target = target;
+            m_d = from - target;
+            if (shape == RampShape::Linear) {
+                m_mul = 1.0f;
+                m_add = -m_d / (float)length;
+            } else {
+                m_mul = (float)std::pow(1e-3, 1.0 / (double)length);
+                m_add = 0.0f;
+            }
+            m_remaining = length;
+        }
+
+        /**
+         * Applies the gain to a source while mixing it into the bus.
+         *
+         * @tparam Accumulate add onto the bus (true) or overwrite it (false)
+         */
+        template <bool Accumulate>
+        void apply(float *bus, const int16_t *src, size_t n, LevelMeter &meter) {
+            size_t done = 0;
+            if (m_remaining > 0) {
+                done = std::min(n, m_remaining);
+                m_d = rampS16<Accumulate>(bus, src, done, m_target, m_d, m_mul, m_add, meter);
+                m_remaining -= done;
+                if (m_remaining == 0) {
+                    m_d = 0; //snap, so the fast path uses the exact target
+                }
+            }
+            if (done < n) {
+                if (Accumulate) {
+                    accumulateS16(bus + done, src + done, n - done, m_target, meter);
+                } else {
+                    convertS16(bus + done, src + done, n - done, m_target, meter);
+                }
+            }
+        }
+
+        /**
+         * Advances the ramp as if n samples of silence had been mixed.
+         */
+        void skip(size_t n) {
+            if (m_remaining == 0) return;
+            size_t done = std::min(n, m_remaining);
+            for (size_t i = 0; i < done; ++i) {
+                m_d = m_d * m_mul + m_add;
+            }
+            m_remaining -= done;
+            if (m_remaining == 0) m_d = 0;
+        }
+
+        float current() const { return m_target + m_d; }
+        float target() const { return m_target; }
+        bool ramping() const { return m_remaining > 0; }
+
+    private:
+        float m_target;
+        float m_d;
+        float m_mul;
+        float m_add;
+        size_t m_remaining;
+    };
+
+    /**
+     * Internal float32 mixing bus.
+     * Every source is converted in once (one pass per source), gains and sums stay at full precision,
+     * and a single saturating pass produces the S16LE stereo output. Each of these passes also meters
+     * what it touches, per source and for the master.
+     *
+     * An optional master limiter works in place on the bus: the samples its lookahead holds back stay in
+     * front of the next chunk, which is mixed right behind them. So the chunks walk along the buffer, and
+     * only when they reach its end are the held samples copied back to the start.
+     */
+    class MixBus {
+    public:
+        MixBus() : m_used(0), m_fresh(true), m_max(0), m_limiting(false), m_start(0), m_lead(0), m_drained(0),
+                   m_ditherMode(DitherMode::None) {}
+
+        /**
+         * @param maxSamples largest chunk (mono samples) that will ever be mixed
+         */
+        void resize(size_t maxSamples) {
+            m_max = maxSamples;
+            m_bus.assign(WalkChunks * lineSize(), 0.0f);
+            m_start = 0;
+        }
+
+        /**
+         * @return largest chunk (mono samples) render() can produce
+         */
+        size_t capacity() const { return m_max + Limiter::DrainSamples; }
+
+        /**
+         * Adds the bus line to a list of (address, size) ranges, e.g. to lock it into memory.
+         */
+        void memoryRanges(std::vector<std::pair<const void*, size_t>> &ranges) const {
+            ranges.emplace_back(m_bus.data(), m_bus.size() * sizeof(float));
+        }
+
+        /**
+         * Enables or disables the master limiter, see Limiter::configure(). Resets the bus.
+         */
+        void setLimiter(bool enabled, float ceiling, size_t releaseSamples) {
+            m_limiting = enabled;
+            m_limiter.configure(ceiling, releaseSamples);
+            reset();
+        }
+
+        /**
+         * Sets the dither render() adds when it quantizes the bus to S16.
+         */
+        void setDither(DitherMode mode) {
+            m_ditherMode = mode;
+            m_dither.reset();
+        }
+
+        /**
+         * Drops what the limiter holds back, e.g. after a seek.
+         */
+        void reset() {
+            m_limiter.reset();
+            m_lead = 0;
+            m_start = 0;
+            begin();
+        }
+
+        /**
+         * Starts a new chunk; the next added source overwrites the bus.
+         */
+        void begin() {
+            if (m_start + lineSize() > m_bus.size()) { //back to the start with what the limiter held back
+                std::copy_n(m_bus.begin() + m_start, m_lead, m_bus.begin());
+                m_start = 0;
+            }
+            m_used = 0;
+            m_drained = 0;
+            m_fresh = true;
+        }
+
+        /**
+         * Starts a new chunk holding what the limiter still holds back, at the end of the stream.
+         *
+         * @return false if there is nothing left
+         */
+        bool drain() {
+            begin();
+            if (m_lead == 0) return false;
+            m_drained = m_limiter.drain(m_bus.data() + m_start);
+            m_lead = 0;
+            return true;
+        }
+
+        /**
+         * Adds a source to the current chunk.
+         * Sources of different lengths are allowed; missing samples count as silence.
+         *
+         * @param src S16 source samples
+         * @param n number of samples (must not exceed the size given to resize())
+         * @param gain linear gain
+         * @param meter level meter of this source
+         */
+        void add(const int16_t *src, size_t n, float gain, LevelMeter &meter) {
+            float *bus = m_bus.data() + m_start + m_lead;
+            meter.count(n);
+            if (m_fresh) {
+                convertS16(bus, src, n, gain, meter);
+                m_used = n;
+                m_fresh = false;
+                return;
+            }
+            if (n > m_used) {
+                std::fill(bus + m_used, bus + n, 0.0f);
+            }
+            accumulateS16(bus, src, n, gain, meter);
+            m_used = std::max(m_used, n);
+        }
+
+        /**
+         * Adds a source to the current chunk using a (possibly ramping) gain.
+         * The ramp always advances by a full chunk, even when the source delivered fewer samples.
+         *
+         * @param src S16 source samples
+         * @param n number of samples (must not exceed the size given to resize())
+         * @param gain smoothed gain of this source
+         * @param chunk nominal chunk length in samples
+         * @param meter level meter of this source, the missing samples count as silence
+         */
+        void add(const int16_t *src, size_t n, GainRamp &gain, size_t chunk, LevelMeter &meter) {
+            float *bus = m_bus.data() + m_start + m_lead;
+            meter.count(std::max(n, chunk));
+            if (m_fresh) {
+                gain.apply<false>(bus, src, n, meter);
+                m_used = n;
+                m_fresh = false;
+            } else {
+                if (n > m_used) {
+                    std::fill(bus + m_used, bus + n, 0.0f);
+                }
+                gain.apply<true>(bus, src, n, meter);
+                m_used = std::max(m_used, n);
+            }
+            if (chunk > n) gain.skip(chunk - n);
+        }
+
+        /**
+         * Runs the current chunk through the limiter, if enabled, and writes what comes out as interleaved
+         * stereo S16LE. While the limiter's lookahead fills that is less than was mixed.
+         *
+         * @param dst destination buffer, must hold 2 * capacity() samples
+         * @param meter level meter of the master
+         * @param softClip round overs off instead of clipping them hard
+         * @return number of samples (not frames) written
+         */
+        size_t render(int16_t *dst, LevelMeter &meter, bool softClip = false) {
+            const float *line = m_bus.data() + m_start;
+            size_t n = m_used;
+            if (m_drained > 0) {
+                n = m_drained;
+            } else if (m_limiting) {
+                n = m_limiter.process(m_bus.data() + m_start, m_used);
+                m_lead = m_limiter.held();
+                m_start += n; //the held samples start the next line
+            }
+            meter.count(n);
+            if (softClip) {
+                store<true>(dst, line, n, meter);
+            } else {
+                store<false>(dst, line, n, meter);
+            }
+            return 2 * n;
+        }
+
+        /**
+         * @return samples mixed into the current chunk
+         */
+        size_t size() const { return m_used; }
+
+    private:
+        static const size_t WalkChunks = 8; //lines that fit into the buffer before it wraps
+
+        /**
+         * @return largest line: held back samples, a chunk and the silence draining the limiter
+         */
+        size_t lineSize() const { return m_max + 2 * Limiter::DrainSamples; }
+
+        template <bool SoftClip>
+        void store(int16_t *dst, const float *line, size_t n, LevelMeter &meter) {
+            switch (m_ditherMode) {
+                case DitherMode::None:
+                    storeS16Stereo<SoftClip, DitherMode::None>(dst, line, n, meter, m_dither);
+                    break;
+                case DitherMode::Tpdf:
+                    storeS16Stereo<SoftClip, DitherMode::Tpdf>(dst, line, n, meter, m_dither);
+                    break;
+                case DitherMode::Shaped:
+                    storeS16Stereo<SoftClip, DitherMode::Shaped>(dst, line, n, meter, m_dither);
+                    break;
+            }
+        }
+
+        std::vector<float> m_bus;
+        size_t m_used;
+        bool m_fresh;
+        size_t m_max;
+        Limiter m_limiter;
+        bool m_limiting;
+        size_t m_start;   //start of the current line
+        size_t m_lead;    //samples held back by the limiter, at the start of the line
+        size_t m_drained; //samples drain() put at the start of the line
+        DitherMode m_ditherMode;
+        Dither m_dither;
+    };
+}
@@ -7,6 +7,15 @@
 #include <fstream>
 #include <thread>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <cstdio>
+#include <atomic>
+
+#include "async.h"
+#include "streamCodec.h"
+#include "impairment.h"
 
 namespace net {
 
@@ -26,6 +35,14 @@ namespace net {
         std::chrono::high_resolution_clock::time_point m_start;
     };
 
+    /**
+     * One point of a bandwidth profile
+     */
+    struct ProfilePoint {
+        int64_t ms;           //time since the start of the profile
+        double bytesPerSecond;
+    };
+
     class NetworkReader {
     public:
         /**
@@ -36,20 +53,36 @@ namespace net {
          * @note You are not supposed to modify this file unless you find a bug! ;-)
          *
          * @param seed optional PRNG seed to reproduce transfer speed profile curves
+         * @param loadNow load the stream data right away, otherwise load() has to be called before reading
          */
-        NetworkReader(int64_t seed = -1) : m_gen(m_rd()), m_sawIndex(0) {
+        NetworkReader(int64_t seed = -1, bool loadNow = true) : m_gen(m_rd()), m_seed(seed), m_traceLoaded(false),
+                                              m_saw(std::make_shared<const std::vector<int16_t>>()), m_sawIndex(0),
+                                              m_encoding(audio::StreamEncoding::Pcm16),
+                                              m_representations(std::make_shared<Representations>()),
+                                              m_live(false), m_clockSkew(0), m_virtualTime(false),
+                                              m_virtualNow(std::make_shared<std::atomic<int64_t>>(0)) {
             if (seed >= 0) {
                 m_gen.seed(seed);
             }
             m_maxTime = std::chrono::seconds(100);
             initProfileCurve(m_maxTime);
-            initWaveform();
+            if (loadNow && !load()) exit(1);
+        }
+
+        /**
+         * Loads the stream data, for a reader constructed without it, e.g. to do it on another thread.
+         * length() is 0 before. Loading twice does nothing.
+         *
+         * @return false if the stream data could not be read
+         */
+        bool load() {
+            return !m_saw->empty() || initWaveform();
         }
 
         /**
          * Reads a chunk of data from a simulated network.
          * Chunksize is limited to 327768 bytes.
-         * The sample format being read is 48kHz, S16LE, mono.
+         * The sample format being read is 48kHz, S16LE, mono, or its encoded form after setEncoding().
          *
          * @note This function will block until all requested bytes or the maximum available bytes have been read.
          *
@@ -58,101 +91,462 @@ namespace net {
          * @return number of bytes actually read
          */
         size_t read(char *buf, size_t maxBytes) {
+            for (auto d = untilReadable(); d.count() > 0; d = untilReadable()) wait(d);
+            std::chrono::microseconds duration(0);
+            std::chrono::microseconds started = now();
+            size_t n = transfer(buf, maxBytes, duration);
+            if (m_virtualTime) advanceTo(started + duration);
+            else wait(duration);
+            return n;
+        }
+
+        /**
+         * Same as read(), but as a coroutine: instead of sleeping for the transfer it suspends on the
+         * executor's timer, so many streams can share a few threads. In virtual time it never suspends.
+         */
+        async::Task<size_t> readAsync(async::Executor &executor, char *buf, size_t maxBytes) {
+            for (auto d = untilReadable(); d.count() > 0; d = untilReadable()) co_await waitAsync(executor, d);
+            std::chrono::microseconds duration(0);
+            std::chrono::microseconds started = now();
+            size_t n = transfer(buf, maxBytes, duration);
+            if (m_virtualTime) advanceTo(started + duration);
+            else co_await waitAsync(executor, duration);
+            co_return n;
+        }
+
+        /**
+         * @return total stream length in samples, like a Content-Length header would tell
+         */
+        size_t length() const {
+            return m_saw->size();
+        }
+
+        /**
+         * Repositions the stream, like a ranged request would.
+         * Subsequent reads start at the given sample; positions past the end read as EOS.
+         * Encoded streams can only be entered at the start of a decode unit (an ADPCM block), so the
+         * position is rounded down to it.
+         *
+         * @param sample stream position in samples
+         * @return stream position the next read actually starts at
+         */
+        size_t seek(size_t sample) {
+            size_t unit = audio::codec::unitSamples(m_encoding);
+            m_sawIndex = std::min(sample, m_saw->size()) / unit * unit;
+            return m_sawIndex;
+        }
+
+        /**
+         * Serves the stream in a compressed wire format, the bandwidth profile then applies to the encoded bytes.
+         * read() returns whole decode units only, so the destination buffer must hold at least one of them.
+         * Switching between encodings mid-stream is possible; the position is rounded down like on seek().
+         *
+         * @param encoding wire format, Pcm16 (default) serves the raw samples
+         */
+        void setEncoding(audio::StreamEncoding encoding) {
+            m_encoding = encoding;
+            if (encoding != audio::StreamEncoding::Pcm16) {
+                std::lock_guard<std::mutex> lock(m_representations->mutex);
+                std::shared_ptr<const std::vector<uint8_t>> &encoded = m_representations->encoded[(int)encoding];
+                if (!encoded) { //once per representation, for all connections
+                    std::vector<uint8_t> bytes;
+                    audio::codec::encode(encoding, m_saw->data(), m_saw->size(), bytes);
+                    encoded = std::make_shared<const std::vector<uint8_t>>(std::move(bytes));
+                }
+                m_encoded = encoded;
+            }
+            seek(m_sawIndex);
+        }
+
+        audio::StreamEncoding encoding() const {
+            return m_encoding;
+        }
+
+        /**
+         * Turns the stream into a live one: samples only become readable once the remote side produced them,
+         * at 48kHz on a remote clock that is off by the given amount. Reads at the live edge block until
+         * more data is produced. Used to exercise clock drift compensation.
+         *
+         * @param clockSkew remote clock offset in ppm, positive if it runs fast
+         */
+        void setLive(double clockSkew) {
+            m_live = true;
+            m_clockSkew = clockSkew;
+        }
+
+        /**
+         * Replaces the random profile by a recorded bandwidth trace, replayed in a loop.
+         * Two formats are understood:
+         *  - CSV as written by dumpProfile(): "millisecond, bytesPerSecond" lines, non-numeric lines are skipped
+         *  - binary: "NRTR", uint32 version (1), uint32 point count, then per point uint32 millisecond and
+         *    uint32 bytes per second, all little endian
+         * Timestamps must increase, the trace may be of any length. One period lasts until the last point
+         * plus the interval before it.
+         *
+         * @note Not synchronized with read(), load the trace before the stream is consumed.
+         *
+         * @return false if the file can't be read or holds no usable trace, the current profile is kept then
+         */
+        bool loadTrace(const std::string &filename) {
+            std::ifstream in(filename, std::ios::binary);
+            if (!in) return false;
+            std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+            std::vector<ProfilePoint> points;
+            if (data.size() >= 12 && data.compare(0, 4, "NRTR") == 0) {
+                if (get32(data, 4) != 1) return false;
+                size_t count = get32(data, 8);
+                if (data.size() < 12 + count * 8) return false;
+                for (size_t i = 0; i < count; ++i) {
+                    points.push_back({(int64_t)get32(data, 12 + i * 8), (double)get32(data, 16 + i * 8)});
+                }
+            } else {
+                std::istringstream lines(data);
+                std::string line;
+                while (std::getline(lines, line)) {
+                    long long ms;
+                    double bps;
+                    if (std::sscanf(line.c_str(), " %lld , %lf", &ms, &bps) == 2) points.push_back({ms, bps});
+                }
+            }
+
+            bool usable = !points.empty() && points.front().ms >= 0;
+            double peak = 0;
+            for (size_t i = 0; i < points.size(); ++i) {
+                if (i > 0 && points[i].ms <= points[i - 1].ms) usable = false;
+                peak = std::max(peak, points[i].bytesPerSecond);
+            }
+            if (!usable || peak <= 0) return false;
+
+            int64_t last = points.back().ms;
+            int64_t step = points.size() > 1 ? last - points[points.size() - 2].ms : 1000;
+            m_profile = std::move(points);
+            m_maxTime = std::chrono::milliseconds(last + step);
+            m_traceLoaded = true;
+            return true;
+        }
+
+        /**
+         * Records the current profile in the compact binary trace format, see loadTrace().
+         */
+        bool saveTrace(const std::string &filename) const {
+            std::string data("NRTR");
+            put32(data, 1);
+            put32(data, (uint32_t)m_profile.size());
+            for (const ProfilePoint &p : m_profile) {
+                put32(data, (uint32_t)p.ms);
+                put32(data, (uint32_t)std::min(p.bytesPerSecond, 4294967295.0));
+            }
+            std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+            out.write(data.data(), data.size());
+            return (bool)out;
+        }
+
+        /**
+         * Writes the profile as CSV, sampled every dt (loadable with loadTrace()).
+         */
+        void dumpProfile(const std::string& filename, std::chrono::milliseconds dt) {
+            std::ofstream out(filename, std::ios::trunc);
+            std::chrono::milliseconds t{0};
+            int32_t val = 0;
+            out << "millisecond, bytesPerSecond\n";
+            while(t < m_maxTime) {
+                val = getProfileValueAt(t);
+                out << t.count() << ',' << val << '\n';
+                t += dt;
+            }
+            out.flush();
+        }
+
+        /**
+         * Adds latency, burst stalls and hiccups to every read, see ImpairmentConfig.
+         */
+        void setImpairment(const ImpairmentConfig &config) {
+            m_impairment.configure(config);
+        }
+
+        /**
+         * Opens another connection to the same stream, e.g. for parallel ranged fetches.
+         * It serves the same data in the same encoding on the same clock, but has a bandwidth profile and
+         * impairments of its own: a random profile from a derived seed, or the same trace if one was loaded.
+         * The read position starts at 0. The samples and their encoded forms are shared, not copied, and so is
+         * the virtual clock (see setVirtualTime()).
+         *
+         * @param index connection number, > 0, used to derive the seeds
+         */
+        std::unique_ptr<NetworkReader> openConnection(unsigned index) const {
+            std::unique_ptr<NetworkReader> connection(new NetworkReader(m_seed >= 0 ? m_seed + index : -1, false));
+            connection->m_saw = m_saw; //immutable once loaded
+            if (m_traceLoaded) {
+                connection->m_profile = m_profile;
+                connection->m_maxTime = m_maxTime;
+                connection->m_traceLoaded = true;
+            }
+            connection->m_encoding = m_encoding;
+            connection->m_representations = m_representations;
+            connection->m_encoded = m_encoded;
+            connection->m_live = m_live;
+            connection->m_clockSkew = m_clockSkew;
+            connection->m_clock = m_clock;
+            connection->m_virtualTime = m_virtualTime;
+            connection->m_virtualNow = m_virtualNow; //one clock for all connections
+            ImpairmentConfig impairment = m_impairment.config();
+            impairment.seed += index;
+            connection->m_impairment.configure(impairment);
+            return connection;
+        }
+
+        /**
+         * Runs the simulator in virtual time: reads return immediately and advance a private clock by the
+         * time they would have taken, instead of sleeping. Together with fixed seeds every run sees exactly
+         * the same conditions, and strategies can be compared in a fraction of real time by a harness that
+         * schedules itself with now().
+         * Connections opened from this reader share its clock, their reads overlap like parallel transfers
+         * do instead of adding up.
+         */
+        void setVirtualTime(bool enabled) {
+            m_virtualTime = enabled;
+            m_virtualNow->store(0);
+        }
+
+        /**
+         * @return simulator time since construction (or since virtual time was enabled)
+         */
+        std::chrono::microseconds now() const {
+            return m_virtualTime ? std::chrono::microseconds(m_virtualNow->load()) : m_clock.elapsed<std::chrono::microseconds>();
+        }
+
+        /**
+         * Lets simulator time pass: sleeps in real time, jumps ahead in virtual time.
+         */
+        void wait(std::chrono::microseconds duration) {
+            if (duration.count() <= 0) return;
+            if (m_virtualTime) advanceTo(now() + duration);
+            else std::this_thread::sleep_for(duration);
+        }
+
+    private:
+        /**
+         * Moves the virtual clock to the given time unless another connection already moved it further.
+         * A read ends at its start plus its duration, so reads on several connections overlap in time.
+         */
+        void advanceTo(std::chrono::microseconds time) {
+            int64_t current = m_virtualNow->load();
+            while (current < time.count() && !m_virtualNow->compare_exchange_weak(current, time.count())) {}
+        }
+
+        /**
+         * Awaitable counterpart of wait().
+         */
+        async::SleepFor waitAsync(async::Executor &executor, std::chrono::microseconds duration) {
+            if (m_virtualTime) {
+                wait(duration);
+                duration = std::chrono::microseconds(0);
+            }
+            return async::sleepFor(executor, duration);
+        }
+
+        /**
+         * Takes the next chunk out of the stream, see read(), without waiting for it.
+         *
+         * @param duration set to the time the read takes on the simulated network
+         */
+        size_t transfer(char *buf, size_t maxBytes, std::chrono::microseconds &duration) {
             const size_t blockSize = 8192 * 4;
-            auto t = m_clock.elapsed<std::chrono::milliseconds>();
-            auto bps = getProfileValueAt(t);
 
-            size_t samplesRemaining = m_saw.size() - m_sawIndex;
+            if (m_encoding != audio::StreamEncoding::Pcm16) {
+                return transferEncoded(buf, std::min(maxBytes, blockSize), duration);
+            }
+
+            size_t samplesRemaining = readableEnd() - m_sawIndex;
             if (samplesRemaining == 0) { // EOS
                 return 0;
             }
 
             size_t maxReadSize = std::min(std::min(maxBytes, blockSize), samplesRemaining * sizeof(int16_t));
-            int64_t dt = (int64_t)(1000 * maxReadSize / bps);
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(dt));
+            duration = readTime(maxReadSize);
 
             auto nSamples = maxReadSize / sizeof(int16_t);
-            std::copy_n(m_saw.begin() + m_sawIndex, nSamples, (int16_t*)buf);
+            std::copy_n(m_saw->begin() + m_sawIndex, nSamples, (int16_t*)buf);
             m_sawIndex += nSamples;
             return nSamples * sizeof(int16_t);
         }
 
-    private:
+        /**
+         * @return time a read of the given size takes: the transfer at the profile's bandwidth plus impairments
+         */
+        std::chrono::microseconds readTime(size_t bytes) {
+            std::chrono::microseconds transfer = transferTime(bytes);
+            if (!m_impairment.enabled()) return transfer;
+            return transfer + m_impairment.delay(now(), transfer);
+        }
+
+        /**
+         * @return samples a live stream has produced so far
+         */
+        size_t liveEdge() const {
+            double produced = now().count() * 1e-6 * 48000 * (1 + m_clockSkew * 1e-6);
+            return std::min((size_t)produced, m_saw->size());
+        }
+
+        /**
+         * @return time until at least one decode unit beyond the current position is produced, 0 unless live
+         */
+        std::chrono::microseconds untilReadable() const {
+            if (!m_live) return std::chrono::microseconds(0);
+            size_t wanted = std::min(m_sawIndex + audio::codec::unitSamples(m_encoding), m_saw->size());
+            size_t edge = liveEdge();
+            if (edge >= wanted) return std::chrono::microseconds(0);
+            double rate = 48000 * (1 + m_clockSkew * 1e-6);
+            return std::chrono::microseconds((int64_t)(1e6 * (wanted - edge) / rate) + 1);
+        }
+
+        /**
+         * @return end of the readable range in samples, for live streams the live edge (whole decode units)
+         */
+        size_t readableEnd() const {
+            if (!m_live) return m_saw->size();
+            size_t unit = audio::codec::unitSamples(m_encoding);
+            size_t edge = liveEdge();
+            return edge == m_saw->size() ? edge : edge / unit * unit;
+        }
+
+        size_t transferEncoded(char *buf, size_t maxBytes, std::chrono::microseconds &duration) {
+            if (m_sawIndex >= m_saw->size()) { // EOS
+                return 0;
+            }
+
+            size_t unitBytes = audio::codec::unitBytes(m_encoding);
+            size_t unitSamples = audio::codec::unitSamples(m_encoding);
+            size_t offset = m_sawIndex / unitSamples * unitBytes;
+            const std::vector<uint8_t> &encoded = *m_encoded;
+            size_t units = std::min(maxBytes, encoded.size() - offset) / unitBytes;
+            size_t end = readableEnd();
+            if (end < m_saw->size()) units = std::min(units, (end - m_sawIndex) / unitSamples);
+            size_t maxReadSize = units * unitBytes;
+
+            duration = readTime(maxReadSize);
+
+            std::copy_n(encoded.begin() + offset, maxReadSize, buf);
+            m_sawIndex = std::min(m_sawIndex + units * unitSamples, m_saw->size());
+            return maxReadSize;
+        }
+
         void initProfileCurve(std::chrono::milliseconds maxTime) {
             auto meanRate = 48000 * sizeof(int16_t); // 96kB/s -> 768kbps
             std::uniform_real_distribution<> dis(meanRate * 0.7, meanRate * 1.4);
             m_profile.resize(maxTime.count() / 1000);
-            std::generate_n(m_profile.begin(), maxTime.count() / 1000, [&]{ return dis(m_gen); });
+            for (size_t i = 0; i < m_profile.size(); ++i) m_profile[i] = {(int64_t)i * 1000, dis(m_gen)};
         }
 
-        void initWaveform() {
+        bool initWaveform() {
             std::ifstream is("audio2_s16le_mono_48k.raw", std::ios::binary);
             if (is) {
                 // get length of file:
                 is.seekg(0, is.end);
-                int length = is.tellg();
+                std::streamoff length = is.tellg();
                 is.seekg(0, is.beg);
 
-                m_saw.resize(length / sizeof(int16_t));
-                is.read ((char*)m_saw.data(),length);
+                std::vector<int16_t> samples(length / sizeof(int16_t));
+                is.read ((char*)samples.data(),length);
 
                 if (is.fail())
                     std::cout << "error: only " << is.gcount() << " could be read\n";
 
                 is.close();
+                m_saw = std::make_shared<const std::vector<int16_t>>(std::move(samples));
+                return true;
             } else {
                 std::cout << "NetworkReader: Couldn't open input file!\n";
-                exit(1);
+                return false;
             }
         }
 
-        void dumpProfile(const std::string& filename, std::chrono::milliseconds dt) {
-            std::ofstream out(filename, std::ios::trunc);
-            std::chrono::milliseconds t{0};
-            int32_t val = 0;
-            out << "millisecond, bytesPerSecond\n";
-            while(t < m_maxTime) {
-                val = getProfileValueAt(t);
-                out << t.count() << ',' << val << '\n';
-                t += dt;
-            }
-            out.flush();
-        }
         void dumpWaveform(const std::string& filename) {
             std::ofstream out(filename, std::ios::trunc);
             int64_t t = 0;
-            for(auto val : m_saw) {
+            for(auto val : *m_saw) {
                 out << t++ << ',' << val << '\n';
             }
             out.flush();
         }
 
-        double getProfileValueAt(std::chrono::milliseconds time) {
-            auto t = std::chrono::milliseconds(time.count() % m_maxTime.count());
-            auto sec = std::chrono::duration_cast<std::chrono::seconds>(t).count();
-            if (sec < 0) {
+        double getProfileValueAt(std::chrono::milliseconds time) const {
+            int64_t t = time.count() % m_maxTime.count();
+            if (t < 0) {
                 return 0;
             }
 
-            using FpSeconds = std::chrono::duration<double, std::chrono::seconds::period>;
-            auto dx = std::chrono::duration_cast<FpSeconds>(time).count() - sec;
-            return cosineInterpolate(m_profile[sec], m_profile[sec + 1], dx);
+            //segment holding t, the last one wraps around to the first point
+            auto next = std::upper_bound(m_profile.begin(), m_profile.end(), t,
+                                         [](int64_t ms, const ProfilePoint &p) { return ms < p.ms; });
+            if (next == m_profile.begin()) return m_profile.front().bytesPerSecond; //before the first point
+            const ProfilePoint &a = *(next - 1);
+            int64_t endMs = next == m_profile.end() ? m_maxTime.count() : next->ms;
+            const ProfilePoint &b = next == m_profile.end() ? m_profile.front() : *next;
+            double dx = (double)(t - a.ms) / (double)(endMs - a.ms);
+            return cosineInterpolate(a.bytesPerSecond, b.bytesPerSecond, dx);
         }
 
-        double cosineInterpolate(double y1, double y2, double mu) {
+        /**
+         * @return time it takes to transfer the given amount of bytes from now on, following the profile
+         *         in 1 ms steps (so a long read spans the rate changes of a fine grained trace)
+         */
+        std::chrono::milliseconds transferTime(size_t bytes) const {
+            int64_t start = std::chrono::duration_cast<std::chrono::milliseconds>(now()).count();
+            int64_t t = start;
+            double remaining = (double)bytes;
+            while (remaining > 0) {
+                double bps = getProfileValueAt(std::chrono::milliseconds(t));
+                double step = std::max(bps, 0.0) / 1000;
+                if (remaining <= step) break; //the last fraction of a millisecond is not slept
+                remaining -= step;
+                t++;
+            }
+            return std::chrono::milliseconds(t - start);
+        }
+
+        static uint32_t get32(const std::string &data, size_t pos) {
+            const unsigned char *p = (const unsigned char*)data.data() + pos;
+            return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+        }
+
+        static void put32(std::string &data, uint32_t v) {
+            for (int i = 0; i < 4; ++i) data.push_back((char)(v >> (8 * i)));
+        }
+
+        static double cosineInterpolate(double y1, double y2, double mu) {
             double mu2 = (1 - cos(mu * M_PI)) / 2;
             return (y1 * (1 - mu2) + y2 * mu2);
         }
 
         std::default_random_engine generator;
-        std::vector<double> m_profile;
+        std::vector<ProfilePoint> m_profile;
         std::chrono::milliseconds m_maxTime;
         StopWatch m_clock;
         std::random_device m_rd;
         std::mt19937 m_gen;
+        int64_t m_seed;
+        bool m_traceLoaded;
         int64_t m_samplingRate;
-        std::vector<int16_t> m_saw;
+        /**
+         * The stream per wire format, encoded on first use by any of the connections (Pcm16 stays empty)
+         */
+        struct Representations {
+            std::mutex mutex;
+            std::shared_ptr<const std::vector<uint8_t>> encoded[4];
+        };
+
+        std::shared_ptr<const std::vector<int16_t>> m_saw; //shared with the connections
         size_t m_sawIndex;
+        audio::StreamEncoding m_encoding;
+        std::shared_ptr<Representations> m_representations; //shared with the connections
+        std::shared_ptr<const std::vector<uint8_t>> m_encoded; //m_saw in m_encoding, unless Pcm16
+        bool m_live;
+        double m_clockSkew; //ppm
+        ImpairmentModel m_impairment;
+        bool m_virtualTime;
+        std::shared_ptr<std::atomic<int64_t>> m_virtualNow; //us, shared with the connections
     };
 }
\ No newline at end of file
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "networkReader.h"
+
+namespace net {
+
+    /**
+     * Fetches one stream over several connections at once, each reading a different range, and hands it
+     * out in stream order like a single NetworkReader would.
+     *
+     * The stream is cut into segments of about a quarter second, made of whole decode units so each one can
+     * be fetched on its own. An idle connection claims the next segment, seeks to it and reads it; read()
+     * returns segments strictly in order, so a segment that completes early waits for the ones before it.
+     * At most two segments per active connection are outstanding, which bounds the memory used and how far
+     * the fetch runs ahead of the consumer.
+     *
+     * The number of active connections follows the buffer level of the consumer and the measured throughput
+     * of a single connection: below CatchUpLevel (startup, after a seek or an underrun) enough connections
+     * are used for CatchUpRate times the real-time rate, above it for SteadyRate times. All of them are used
+     * until the first measurement.
+     *
+     * seek() and setEncoding() start over: outstanding segments are dropped and reads in flight discarded.
+     */
+    class ParallelFetcher {
+    public:
+        static const size_t MaxConnections = 8;
+        static const size_t SegmentSamples = 12000; //250 ms at 48kHz, rounded up to whole decode units
+        static const size_t ReadSize = 16 * 1024;
+        static constexpr double CatchUpLevel = 0.5;
+        static constexpr double CatchUpRate = 2.0;
+        static constexpr double SteadyRate = 1.25;
+
+        /**
+         * @param primary reader used as the first connection, further ones are opened from it
+         * @param sampleRate sample rate of the stream, to relate the throughput to the real-time rate
+         */
+        ParallelFetcher(NetworkReader &primary, int sampleRate)
+                : m_primary(primary), m_sampleRate(sampleRate), m_encoding(audio::StreamEncoding::Pcm16), m_next(0),
+                  m_consumed(0), m_generation(0), m_active(0), m_throughput(0), m_stopping(false) {}
+        ~ParallelFetcher() { stop(); }
+
+        /**
+         * Opens the additional connections and starts fetching from the start of the stream, in the
+         * encoding the primary reader is set to.
+         *
+         * @param connections maximum number of connections including the primary one, at most MaxConnections
+         * @param bufferLevel fill of the consumer's buffer from 0 (empty) to 1 (full), polled by read()
+         */
+        void start(size_t connections, std::function<double()> bufferLevel) {
+            stop();
+            connections = std::max<size_t>(1, std::min<size_t>(connections, size_t(MaxConnections)));
+            for (size_t i = 1; i < connections; ++i) m_connections.push_back(m_primary.openConnection((unsigned)i));
+
+            m_bufferLevel = bufferLevel;
+            m_encoding = m_primary.encoding();
+            m_segments.clear();
+            m_next = 0;
+            m_consumed = 0;
+            m_active = connections;
+            m_throughput = 0;
+            m_stopping = false;
+            for (size_t i = 0; i < connections; ++i) m_workers.emplace_back(&ParallelFetcher::work, this, i);
+        }
+
+        /**
+         * Stops all connections, a blocked read() returns 0.
+         */
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            m_work.notify_all();
+            m_data.notify_all();
+            for (std::thread &worker : m_workers) worker.join();
+            m_workers.clear();
+            m_connections.clear();
+        }
+
+        /**
+         * Returns the next bytes of the stream in order, see NetworkReader::read(). Blocks until the segment
+         * at the current position has data.
+         *
+         * @return number of bytes copied (whole decode units), 0 at EOS or after stop()
+         */
+        size_t read(char *buf, size_t maxBytes) {
+            double level = m_bufferLevel ? m_bufferLevel() : 0;
+            std::unique_lock<std::mutex> lock(m_mutex);
+            adapt(level);
+            size_t unitBytes = audio::codec::unitBytes(m_encoding);
+            while (!m_stopping) {
+                if (m_segments.empty()) {
+                    if (m_next >= length()) return 0; //EOS
+                } else {
+                    Segment &head = *m_segments.front();
+                    size_t take = std::min(maxBytes, head.filled - m_consumed) / unitBytes * unitBytes;
+                    if (take > 0) {
+                        std::copy_n(head.data.begin() + m_consumed, take, buf);
+                        m_consumed += take;
+                        if (head.complete && m_consumed == head.filled) popHead();
+                        return take;
+                    }
+                    if (head.complete) { //cut short by the end of the stream
+                        popHead();
+                        continue;
+                    }
+                }
+                m_data.wait(lock);
+            }
+            return 0;
+        }
+
+        /**
+         * Repositions the stream, see NetworkReader::seek().
+         *
+         * @return stream position the next read actually starts at
+         */
+        size_t seek(size_t sample) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return restart(sample);
+        }
+
+        /**
+         * Switches the wire format, see NetworkReader::setEncoding(). The stream continues from the start
+         * of the decode unit holding the next unread sample.
+         */
+        void setEncoding(audio::StreamEncoding encoding) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            size_t position = m_next;
+            if (!m_segments.empty()) {
+                position = m_segments.front()->start + m_consumed / audio::codec::unitBytes(m_encoding) *
+                                                      audio::codec::unitSamples(m_encoding);
+            }
+            m_encoding = encoding;
+            restart(position);
+        }
+
+        audio::StreamEncoding encoding() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_encoding;
+        }
+
+        /**
+         * @return total stream length in samples
+         */
+        size_t length() const {
+            return m_primary.length();
+        }
+
+        /**
+         * @return number of connections currently fetching
+         */
+        size_t activeConnections() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_active;
+        }
+
+    private:
+        struct Segment {
+            size_t start;           //stream position in samples
+            std::vector<char> data; //sized up front, only the worker fetching it writes past filled
+            size_t filled;          //bytes received
+            bool complete;
+        };
+
+        /**
+         * One connection: claims the next segment and reads it, until stopped.
+         */
+        void work(size_t index) {
+            NetworkReader &connection = index == 0 ? m_primary : *m_connections[index - 1];
+            while (true) {
+                std::shared_ptr<Segment> segment;
+                uint64_t generation;
+                audio::StreamEncoding encoding;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_work.wait(lock, [&]{
+                        return m_stopping || (index < m_active && m_next < length() && m_segments.size() < 2 * m_active);
+                    });
+                    if (m_stopping) return;
+                    encoding = m_encoding;
+                    size_t unitSamples = audio::codec::unitSamples(encoding);
+                    size_t segmentSamples = (SegmentSamples + unitSamples - 1) / unitSamples * unitSamples;
+                    size_t samples = std::min(segmentSamples, length() - m_next);
+                    segment = std::make_shared<Segment>();
+                    segment->start = m_next;
+                    segment->data.resize((samples + unitSamples - 1) / unitSamples * audio::codec::unitBytes(encoding));
+                    segment->filled = 0;
+                    segment->complete = false;
+                    m_segments.push_back(segment);
+                    m_next += samples;
+                    generation = m_generation;
+                }
+
+                if (connection.encoding() != encoding) connection.setEncoding(encoding);
+                connection.seek(segment->start);
+                size_t filled = 0;
+                while (filled < segment->data.size()) {
+                    auto started = connection.now();
+                    size_t n = connection.read(segment->data.data() + filled,
+                                               std::min(size_t(ReadSize), segment->data.size() - filled));
+                    auto elapsed = connection.now() - started;
+
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if (generation != m_generation || m_stopping) break; //dropped by a restart, segment is gone
+                    if (n == 0) break;
+                    filled += n;
+                    segment->filled = filled;
+                    if (elapsed.count() > 0) {
+                        double rate = 1e6 * n / elapsed.count();
+                        m_throughput = m_throughput > 0 ? 0.8 * m_throughput + 0.2 * rate : rate;
+                    }
+                    m_data.notify_all();
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    segment->complete = true;
+                }
+                m_data.notify_all();
+            }
+        }
+
+        /**
+         * Picks the number of active connections, see the class description. Called with the lock held.
+         */
+        void adapt(double bufferLevel) {
+            size_t active = m_connections.size() + 1;
+            if (m_throughput > 0) {
+                double realtime = (double)m_sampleRate * audio::codec::unitBytes(m_encoding) /
+                                  audio::codec::unitSamples(m_encoding);
+                double needed = realtime * (bufferLevel < CatchUpLevel ? double(CatchUpRate) : double(SteadyRate));
+                active = std::min(active, std::max<size_t>(1, (size_t)std::ceil(needed / m_throughput)));
+            }
+            if (active > m_active) m_work.notify_all();
+            m_active = active;
+        }
+
+        /**
+         * Drops all outstanding segments and continues at the given position. Called with the lock held.
+         */
+        size_t restart(size_t sample) {
+            size_t unit = audio::codec::unitSamples(m_encoding);
+            m_generation++;
+            m_segments.clear();
+            m_consumed = 0;
+            m_next = std::min(sample, length()) / unit * unit;
+            m_work.notify_all();
+            return m_next;
+        }
+
+        void popHead() {
+            m_segments.pop_front();
+            m_consumed = 0;
+            m_work.notify_all();
+        }
+
+        NetworkReader &m_primary;
+        std::vector<std::unique_ptr<NetworkReader>> m_connections; //beyond the primary one
+        std::vector<std::thread> m_workers;
+        std::function<double()> m_bufferLevel;
+        int m_sampleRate;
+        audio::StreamEncoding m_encoding;
+        std::deque<std::shared_ptr<Segment>> m_segments; //in stream order, fetched or in flight
+        size_t m_next;         //stream position of the next segment to claim
+        size_t m_consumed;     //bytes of the head segment already returned
+        uint64_t m_generation; //bumped by every restart
+        size_t m_active;       //connections allowed to claim segments
+        double m_throughput;   //bytes per second of a single connection, smoothed
+        bool m_stopping;
+        mutable std::mutex m_mutex;
+        std::condition_variable m_work;
+        std::condition_variable m_data;
+    };
+}
@@ -1,7 +1,52 @@
 #pragma once
 
 #include "networkReader.h"
+#include "parallelFetch.h"
+#include "mixBus.h"
+#include "sampleQueue.h"
+#include "uring.h"
+#include "directWriter.h"
+#include "wavWriter.h"
+#include "losslessWriter.h"
+#include "qualityController.h"
+#include "driftResampler.h"
+#include "threadPolicy.h"
+#include "tripleBuffer.h"
+#include "fileReader.h"
+#include "sinks.h"
+#include "metrics.h"
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <stdexcept>
 #define BUFFER_SIZE 4096
+#define SAMPLE_RATE 48000
+
+/**
+ * Sink the mix is written to
+ */
+enum class OutputMode {
+    Stream,   //std::ofstream, one write per chunk
+    Uring,    //io_uring with registered buffers, falls back to Stream if the kernel lacks io_uring
+    Direct,   //O_DIRECT sink written in aligned 4 KiB blocks, bypasses the page cache
+    Wav,      //self-describing WAV/RF64 file with preallocated extents
+    Lossless, //losslessly compressed file (see losslessCodec.h), encoded on a writer thread
+    Null,     //discarded, measures the pipeline without I/O
+    Pipe,     //raw S16LE stereo to stdout
+    Checksum  //only a digest of the output is kept (see outputChecksum())
+};
+
+/**
+ * Levels of one metering interval, relative to full scale (see Player::getLevels()).
+ * The master is measured before the output saturates, so a peak above 1 means the interval clipped.
+ */
+struct MixLevels {
+    audio::Level network; //after its gain
+    audio::Level player;  //after its gain
+    audio::Level master;
+    uint64_t position;    //frame the interval ended at, 0 until the first one was published
+};
 
 /**
  * Implement the player.
@@ -13,141 +58,334 @@ class Player {
 
 private:
 
-    //variables for mixing
-    double networkLevel;
-    double playerLevel;
+    //variables for mixing, set by the control thread and picked up by the mixer at chunk boundaries
+    struct MixParams {
+        double networkLevel;
+        double playerLevel;
+        std::chrono::milliseconds rampDuration;
+        audio::RampShape rampShape;
+    };
+    MixParams controlParams; //control thread only, the latest values set
+    audio::TripleBuffer<MixParams> mixParams; //wait-free hand-over to the mixer, never torn
+
+    //smoothed gains actually applied by the mixer, retargeted at chunk boundaries
+    audio::GainRamp networkGain;
+    audio::GainRamp playerGain;
+    bool gainsPrimed; //false until the first chunk was mixed
+
+    //level metering, accumulated by the mix kernels and published by the mixer every meterInterval
+    audio::LevelMeter networkMeter;
+    audio::LevelMeter playerMeter;
+    audio::LevelMeter masterMeter;
+    std::chrono::milliseconds meterInterval;
+    audio::TripleBuffer<MixLevels> levels; //wait-free hand-over to the control thread
+
+    //master bus protection, the output saturates at full scale in any case
+    bool limiterEnabled;
+    double limiterCeiling; //relative to full scale
+    std::chrono::milliseconds limiterRelease;
+    bool softClip;
+    audio::DitherMode dither;
 
     net::StopWatch stopWatch;
     net::NetworkReader nr;
+    net::ParallelFetcher fetcher; //ranged fetches over several connections, nr being the first one
 
     //output streams
-    std::ofstream sink;
+    OutputMode outputMode;
+    io::StreamFileWriter sink;
+    io::UringFileWriter uringSink;
+    io::DirectFileWriter directSink;
+    io::WavFileWriter wavSink;
+    io::LosslessFileWriter losslessSink;
+    io::NullWriter nullSink;
+    io::PipeWriter pipeSink;
+    io::ChecksumWriter checksumSink;
+    std::chrono::seconds expectedDuration; //0 means derive it from the sources
     std::ofstream stats;
 
     //buffers
     char *playerBuffer;
     char *networkBuffer;
-    char *mix;
+    int16_t *mix; //stereo S16LE output chunk
+    audio::MixBus bus; //float32 accumulation bus
 
     //requested bytes for buffers
     size_t playerBytes;
     size_t networkBytes;
 
     //represents number of samples currently being streamed
-    int writtenSamples;
+    uint64_t writtenSamples;
+
+    //file source, streamed with read-ahead in constant memory
+    io::StreamingFileReader fileSource;
+
+    //network prefetch, keeps filling up to its watermark even while paused
+    struct PrefetchState {
+        audio::StreamEncoding encoding;
+        net::QualityController quality;
+        std::vector<char> block; //holds at least one unit of every wire format
+        std::vector<int16_t> samples;
+        uint64_t generation;
+        uint64_t streamPosition; //stream position of the next decoded sample
+        uint64_t skip; //decoded samples in front of the position the queue continues at
+        bool eos;
+
+        explicit PrefetchState(audio::StreamEncoding e)
+                : encoding(e), quality(SAMPLE_RATE, e), block(BUFFER_SIZE),
+                  samples(audio::codec::maxDecodedSamples(e, BUFFER_SIZE)), generation(0), streamPosition(0),
+                  skip(0), eos(false) {}
+    };
+    audio::SampleQueue networkQueue;
+    uint64_t networkPosition; //stream position of the oldest queued network sample
+    std::chrono::milliseconds prefetchDepth;
+    std::thread prefetchThread;
+    bool prefetchCoroutine; //the prefetch runs on the executor given to openAsync() instead of prefetchThread
+    async::Event prefetchDone; //set when the prefetch, thread or coroutine, returned
+    size_t networkConnections; //more than one fetches the network stream through the fetcher
+    std::chrono::milliseconds underrunTime;
+    audio::StreamEncoding networkEncoding; //wire format requested from the network, decoded by the prefetch
+    std::atomic<uint64_t> networkBytesRead;
+    bool adaptiveQuality; //let the prefetch switch wire formats with the available bandwidth
+    std::mutex switchMutex;
+    std::vector<net::QualitySwitch> qualitySwitches; //decided by the prefetch, logged by the mixer
 
-    std::vector<int16_t> m_saw;
-    size_t m_sawIndex;
+    //clock drift compensation of the network source, runs on the mixer thread
+    bool driftCompensation;
+    std::chrono::milliseconds driftTarget; //network buffer depth to hold, 0 means half the prefetch depth
+    audio::DriftEstimator driftEstimator;
+    audio::DriftResampler driftResampler;
+    std::vector<int16_t> driftInput;
+
+    //background initialization started by open()
+    std::thread initThread;
+    std::promise<void> readyPromise;
+    std::shared_future<void> readyFuture;
+    async::Event readyEvent;
+
+    //mixer thread and output clock
+    std::thread mixerThread;
+    async::Event mixerDone; //set when the mixer thread returned
+    std::mutex stateMutex;
+    std::condition_variable stateChanged;
+    bool stopping;
+    bool realtime;
+    sys::ThreadPolicy mixerPolicy;
+    bool memoryLocking;
+    sys::MemoryLock memoryLock;
+    std::atomic<bool> finished;
+    std::atomic<uint64_t> position; //frames written to the sink
+    bool seekPending;
+    uint64_t seekTarget;
 
     //variables for pause method
     std::chrono::milliseconds timePaused;
-    int pausedSample;
+    uint64_t pausedSample;
     bool paused;
 
+    //operational metrics, see exportMetrics()
+    metrics::Registry metricRegistry;
+    metrics::Exporter metricExporter;
+    metrics::Counter &samplesMixed;
+    metrics::Counter &underruns;
+    metrics::Gauge &networkFill;
+    metrics::Histogram &readWait;
+    metrics::Histogram &writeLatency;
+    metrics::Counter &bytesOut;
+
 public:
-    Player() : m_sawIndex(0){}
-    virtual ~Player() {}
+    Player() : controlParams{0.5, 0.5, std::chrono::milliseconds(20), audio::RampShape::Linear},
+               mixParams(controlParams), gainsPrimed(false), meterInterval(100), levels(MixLevels()),
+               limiterEnabled(false), limiterCeiling(0.75), limiterRelease(100), softClip(false),
+               dither(audio::DitherMode::None), nr(-1, false),
+               fetcher(nr, SAMPLE_RATE), outputMode(OutputMode::Stream),
+               expectedDuration(0), playerBuffer(nullptr), networkBuffer(nullptr), mix(nullptr), writtenSamples(0),
+               networkPosition(0), prefetchDepth(500), prefetchCoroutine(false), networkConnections(1), underrunTime(0),
+               networkEncoding(audio::StreamEncoding::Pcm16),
+               networkBytesRead(0), adaptiveQuality(false), driftCompensation(false), driftTarget(0),
+               stopping(false), realtime(true), memoryLocking(false), finished(false),
+               position(0), seekPending(false), seekTarget(0), timePaused(0), pausedSample(0), paused(true),
+               samplesMixed(metricRegistry.counter("player_samples_mixed_total", "Samples mixed per source")),
+               underruns(metricRegistry.counter("player_underruns_total", "Chunks the mixer had to wait for network data")),
+               networkFill(metricRegistry.gauge("player_network_buffer_fill_samples", "Network samples buffered")),
+               readWait(metricRegistry.histogram("player_network_read_seconds", "Time spent per network read",
+                                                 metrics::Histogram::exponentialBounds(1e-4, 2, 16))),
+               writeLatency(metricRegistry.histogram("player_sink_write_seconds", "Time spent per sink write",
+                                                     metrics::Histogram::exponentialBounds(1e-6, 2, 20))),
+               bytesOut(metricRegistry.counter("player_output_bytes_total", "Bytes written to the sink")) {}
+    virtual ~Player() { close(); }
 
     /**
      * Open the player and prepare it so it can start playing whenever play() is called.
+     * Returns right away: the sources are initialized concurrently in the background (the network stream is
+     * loaded and encoded while the file source and the sink are opened) and the network prefetch starts as
+     * soon as its side is ready. Control calls made before readiness (play(), seek(), levels) are queued and
+     * take effect when the mixer starts. A player that is still open is closed first.
      *
      * @param networkUrl URL to the network stream
      * @param filename filename used as input for the filesource
+     * @param executor runs the network prefetch as a coroutine instead of a thread, see openAsync()
+     * @return becomes ready once the player is fully initialized; holds a std::runtime_error if a source
+     *         couldn't be opened, the player is closed again then
      * @warning args are not used
      */
-    void open(char *networkUrl, char *filename) {
+    std::shared_future<void> open(char *networkUrl, char *filename, async::Executor *executor = nullptr) {
 
-        char sinkFile[] = "audio_output.raw";
-        char statsFile[] = "realtime_stats.txt";
-
-        sink.open(sinkFile, std::ios::binary | std::ios::trunc);
-        stats.open(statsFile, std::ios::trunc);
+        close(); //waits for an open() still in progress, a std::thread must not be replaced while joinable
+        resetControls();
+        prepareOpen();
+        initThread = std::thread(&Player::initialize, this, executor);
+        return readyFuture;
 
-        int16_t samples = 72; //good compromise ;-)
-
-        //Network Buffer for streaming
-        networkBytes = samples * sizeof(int16_t);
-        networkBuffer = new char[networkBytes];
+    }
 
-        //Player Buffer for streaming
-        playerBytes = samples * sizeof(int16_t);
-        playerBuffer = new char[playerBytes];
+    /**
+     * Blocks until the player is initialized.
+     */
+    void waitUntilReady() {
 
-        init(); //read the data from filename
+        if (readyFuture.valid()) readyFuture.wait();
 
-        setMixingLevel(0); //compromise for default value
     }
 
     /**
-     * Close the player
+     * Close the player. Blocks until the threads of the session returned, so it must not be called from a
+     * thread of the executor the session runs on, use closeAsync() there.
      */
     void close() {
 
-        sink.close(); //closing audio output stream
-        if(!sink) std::cerr<<"An error occurred when closing the audio output file."<<std::endl;
+        if (readyFuture.valid()) readyEvent.wait(); //an open() still in progress completes first
+        if (initThread.joinable()) initThread.join();
+        if (!mixerThread.joinable()) return; //not opened or already closed
 
-        stats.close(); //closing realtime stats file
-        if(!stats) std::cerr<<"An error occurred when closing the stats file."<<std::endl;
+        requestStop();
+        prefetchDone.wait();
+        if (prefetchThread.joinable()) prefetchThread.join();
+        release();
 
     }
 
     /**
-     * Start or resume playback from position where pause() was called
+     * Asynchronous API: the calls run on the given executor and complete without blocking the caller.
+     * openAsync() closes a session still open and completes once the player is initialized, see open().
+     * The initialization runs on the executor, the network side as a task of its own, and the network
+     * prefetch is a coroutine that suspends while the network transfers instead of sleeping. Waiting for
+     * the session suspends instead of blocking, so the executor's threads can be shared by many players.
+     * A session still keeps threads of its own for the blocking I/O: the mixer, which paces the real-time
+     * output, the read-ahead of the file source, the fetch workers with several network connections and
+     * the encoder of the lossless output. The executor has to outlive the player.
+     *
+     * The control state is reset before openAsync() returns, so control calls made right after it apply to
+     * the new session like with open(), even before the task ran. A session still open stops right away.
      */
-    void play() {
+    async::Task<void> openAsync(async::Executor &executor, char *networkUrl, char *filename) {
 
-        //what is actually read
-        size_t playerRead;
-        size_t networkRead;
+        resetControls();
+        return reopenAsync(executor);
 
-        paused = false;
+    }
 
-        networkRead = nr.read(&(*networkBuffer), networkBytes); //stream from network
-        playerRead = read(playerBuffer, playerBytes); //stream from player
-        mix = new char[2* (networkRead + playerRead)]; //mixing buffer -stereo
+    async::Task<void> playAsync(async::Executor &executor) {
 
-        //number of samples currently streaming
-        writtenSamples += (int16_t) ((playerRead/sizeof(int16_t)) + (networkRead/sizeof(int16_t)));
+        co_await async::resumeOn(executor);
+        play();
 
-        //mixing process -case for different byte read from each source
-        int pos = 0;
-        for (int i = 0; i < networkRead; ++i) {
-            auto bit = networkLevel * (double) networkBuffer[i];
-            mix[pos] = (char)bit; pos++; //copy the bit
-            mix[pos] = (char)bit; pos++; //make it stereo
-        }
-        pos = 0;
-        for (int i = 0; i < playerRead; ++i) {
-            auto bit = playerLevel * (double) playerBuffer[i];
-            mix[pos] += (char)bit; pos++; //compute weighted sum
-            mix[pos] += (char)bit; pos++; //make it stereo
-        }
+    }
 
-        //output stats
-        stats << stopWatch.elapsed<std::chrono::milliseconds>().count() << ", " << writtenSamples << std::endl;
-        stats.flush();
+    async::Task<void> pauseAsync(async::Executor &executor) {
 
-        //output stream
-        sink.write(mix, 2*(networkRead + playerRead));
-        sink.flush();
+        co_await async::resumeOn(executor);
+        pause();
+
+    }
+
+    async::Task<void> seekAsync(async::Executor &executor, uint64_t sampleOffset) {
 
-        //till all the data from sources have been streamed
-        if (playerRead == 0 && networkRead == 0) return;
+        co_await async::resumeOn(executor);
+        seek(sampleOffset);
+
+    }
+
+    /**
+     * Suspends until an open in progress, the prefetch and the mixer finished instead of blocking on them.
+     * The threads are only joined once they returned.
+     */
+    async::Task<void> closeAsync(async::Executor &executor) {
+
+        co_await async::resumeOn(executor);
+        if (readyFuture.valid()) co_await readyEvent.wait(executor);
+        if (initThread.joinable()) initThread.join(); //it returns right after setting readyEvent
+        if (!mixerThread.joinable()) co_return;
+
+        requestStop();
+        co_await prefetchDone.wait(executor);
+        if (prefetchThread.joinable()) prefetchThread.join(); //has returned
+        co_await mixerDone.wait(executor);
+        release(); //joins the mixer, which has returned
+
+    }
+
+    /**
+     * Start or resume playback from position where pause() was called
+     */
+    void play() {
 
-        if(!paused) play(); //resume
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            paused = false;
+        }
+        stateChanged.notify_all();
 
     }
 
     /**
      * Pause playback at the current position
+     * Only the output clock stops, the network prefetch keeps running up to its watermark.
      */
     void pause() {
 
+        std::lock_guard<std::mutex> lock(stateMutex);
         paused = true;
 
-        //pinpoint the time and number of samples when stream was paused
+        //pinpoint the time when stream was paused, the mixer records the sample it stopped at
         timePaused = stopWatch.elapsed<std::chrono::milliseconds>();
-        pausedSample = writtenSamples;
+
+    }
+
+    /**
+     * Moves playback of both sources to another position, paused or not.
+     * The seek is applied by the mixer at the next chunk boundary: the file source is repositioned in
+     * constant time, the network buffer is either skipped forward (target already buffered) or refilled
+     * from the new offset. Nothing is reopened.
+     *
+     * @param sampleOffset target position in frames
+     */
+    void seek(uint64_t sampleOffset) {
+
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            seekTarget = sampleOffset;
+            seekPending = true;
+        }
+        stateChanged.notify_all();
+
+    }
+
+    /**
+     * @return playback position in frames, identical before and after a pause/play cycle
+     */
+    uint64_t getPosition() const {
+
+        return position;
+
+    }
+
+    /**
+     * @return true once all data from both sources has been streamed (a later seek() may continue playback)
+     */
+    bool isFinished() const {
+
+        return finished;
 
     }
 
@@ -156,6 +394,8 @@ public:
      * -1 means only network source
      * 0 means 50% network source, 50% filesource
      * 1 means only filesource
+     * Never blocks, the mixer picks up the new levels at the next chunk boundary. Like the other control
+     * calls it is meant to be called from one thread at a time.
      * @param level mixing level with range [-1..1]
      */
     void setMixingLevel(double level) {
@@ -164,38 +404,966 @@ public:
         level = (level <= -1.0) ? -1.0 : level;
         level = (level >= 1.0) ? 1.0 : level;
 
-        //set mixing levels at their weighted sum
-        networkLevel = (1.0 - level) / 2;
-        playerLevel = (1.0 + level) / 2;
+        //set mixing levels at their weighted sum, the mixer ramps towards them
+        controlParams.networkLevel = (1.0 - level) / 2;
+        controlParams.playerLevel = (1.0 + level) / 2;
+        mixParams.publish(controlParams);
+
+    }
+
+    /**
+     * Sets how level changes are smoothed to avoid zipper noise.
+     * The new duration applies to level changes picked up after this call.
+     *
+     * @param duration ramp duration, 0 applies level changes instantly
+     * @param shape linear or exponential ramp
+     */
+    void setRampDuration(std::chrono::milliseconds duration, audio::RampShape shape = audio::RampShape::Linear) {
+
+        controlParams.rampDuration = duration;
+        controlParams.rampShape = shape;
+        mixParams.publish(controlParams);
+
+    }
+
+    /**
+     * Sets how much network data is buffered ahead of the output. Must be called before open().
+     *
+     * @param depth prefetch watermark, raised to the largest decoded network read (168 ms, an ADPCM read)
+     */
+    void setPrefetchDepth(std::chrono::milliseconds depth) {
+
+        prefetchDepth = std::max(depth, std::chrono::milliseconds(0));
+
+    }
+
+    /**
+     * Paces the output at the sample rate (default) or mixes as fast as the sources allow.
+     * Must be called before open().
+     */
+    void setRealtime(bool enabled) {
+
+        realtime = enabled;
+
+    }
+
+    /**
+     * Runs the mixer thread under a real-time scheduling policy, optionally pinned to a set of CPUs.
+     * Without the required privileges the thread keeps the default scheduling and a warning is printed.
+     * Must be called before open().
+     *
+     * @param policy SCHED_FIFO, SCHED_RR or the default policy
+     * @param priority real-time priority, clamped to the range of the policy
+     * @param cpus CPUs to pin the mixer thread to, empty for no pinning
+     */
+    void setRealtimeScheduling(sys::SchedPolicy policy, int priority, const std::vector<int> &cpus = std::vector<int>()) {
+
+        mixerPolicy.policy = policy;
+        mixerPolicy.priority = priority;
+        mixerPolicy.cpus = cpus;
+
+    }
+
+    /**
+     * Locks the process memory (or at least the mixing buffers, if the memlock limit does not allow more)
+     * and prefaults the buffers and the mixer stack on open(). The lock is shared with the other players
+     * of the process, closing this one keeps it in place for them. Must be called before open().
+     */
+    void setMemoryLocking(bool enabled) {
+
+        memoryLocking = enabled;
+
+    }
+
+    /**
+     * Selects the sink the mix is written to. Must be called before open().
+     */
+    void setOutputMode(OutputMode mode) {
+
+        outputMode = mode;
+
+    }
+
+    /**
+     * Selects the wire format of the network stream. Compressed formats cut the transferred bytes
+     * (G.711 by 2x, IMA ADPCM by ~4x) and are decoded on the prefetch thread. Must be called before open().
+     */
+    void setNetworkEncoding(audio::StreamEncoding encoding) {
+
+        networkEncoding = encoding;
+
+    }
+
+    /**
+     * Lets the network source switch between representations of the stream (PCM, mu-law, IMA ADPCM)
+     * with the measured bandwidth, starting from the one set by setNetworkEncoding(). Switches happen
+     * between two reads without gaps and are logged to the stats file. Must be called before open().
+     */
+    void setAdaptiveQuality(bool enabled) {
+
+        adaptiveQuality = enabled;
+
+    }
+
+    /**
+     * Compensates the clock drift of a live network source: the network buffer fill is tracked over time
+     * and the network stream is resampled by a tiny, continuously adjusted ratio so the buffer stays at the
+     * target depth indefinitely. Only meaningful for live sources, a source that can be read ahead at will
+     * never drifts. Must be called before open().
+     *
+     * @param enabled turn the compensation on or off
+     * @param target buffer depth to hold, 0 means half the prefetch depth
+     */
+    void setDriftCompensation(bool enabled, std::chrono::milliseconds target = std::chrono::milliseconds(0)) {
+
+        driftCompensation = enabled;
+        driftTarget = target;
+
+    }
+
+    /**
+     * Fetches the network stream over up to this many connections at once, each one reading a different
+     * range, reassembled in order by the prefetch (see net::ParallelFetcher). More connections are only used
+     * while they are needed: during startup and catch-up, or when a single one is too slow for real time.
+     * 1 (default) reads over a single connection. A live source gains nothing from it, it can't be read
+     * ahead of its live edge. Must be called before open().
+     */
+    void setNetworkConnections(size_t connections) {
+
+        networkConnections = std::max<size_t>(1, connections);
+
+    }
+
+    /**
+     * Makes the simulated network source live, produced in real time on a remote clock. Must be called
+     * before open().
+     *
+     * @param clockSkew remote clock offset in ppm, positive if it runs fast
+     */
+    void setLiveNetwork(double clockSkew) {
+
+        nr.setLive(clockSkew);
+
+    }
+
+    /**
+     * @return digest of the output written in Checksum mode, valid after close()
+     */
+    uint64_t outputChecksum() const {
+
+        return checksumSink.digest();
+
+    }
+
+    /**
+     * Replays a recorded bandwidth trace (CSV or binary, see net::NetworkReader::loadTrace()) on the
+     * simulated network instead of a random profile. Must be called before open().
+     *
+     * @return false if the trace could not be loaded
+     */
+    bool setNetworkTrace(const std::string &filename) {
+
+        bool loaded = nr.loadTrace(filename);
+        if (!loaded) std::cerr<<"Couldn't load network trace "<<filename<<std::endl;
+        return loaded;
+
+    }
+
+    /**
+     * Adds latency, burst stalls and periodic hiccups to the simulated network, see net::ImpairmentConfig.
+     * Must be called before open().
+     */
+    void setNetworkImpairment(const net::ImpairmentConfig &config) {
+
+        nr.setImpairment(config);
+
+    }
+
+    /**
+     * Serves the player's metrics (samples mixed, underruns, network buffer fill, network read time, sink
+     * write latency, bytes out) in the Prometheus text format on a Unix domain socket, until the player is
+     * destroyed. Scrapes are answered by a thread of their own, the mixer only updates atomic counters.
+     *
+     * @return false if the socket could not be set up
+     */
+    bool exportMetrics(const std::string &socketPath) {
+
+        bool started = metricExporter.start(socketPath, metricRegistry);
+        if (!started) std::cerr<<"Couldn't serve metrics on "<<socketPath<<": "<<std::strerror(errno)<<std::endl;
+        return started;
+
+    }
+
+    /**
+     * Enables a lookahead peak limiter on the master bus, so loud passages are turned down smoothly instead
+     * of clipping. It delays the output by audio::Limiter::Lookahead samples (1.3 ms), getPosition() counts
+     * what was written. Must be called before open().
+     *
+     * @param ceiling largest output level relative to full scale, the soft clip's knee by default
+     * @param release time the gain takes to recover after a peak
+     */
+    void setLimiter(bool enabled, double ceiling = 0.75,
+                    std::chrono::milliseconds release = std::chrono::milliseconds(100)) {
+
+        limiterEnabled = enabled;
+        limiterCeiling = std::min(std::max(ceiling, 0.01), 1.0);
+        limiterRelease = release;
+
+    }
+
+    /**
+     * Rounds off overs with a soft clip curve (see audio::softClip()) instead of clipping them hard. Acts
+     * on what a limiter let through or, without one, on all overs. Must be called before open().
+     */
+    void setSoftClip(bool enabled) {
+
+        softClip = enabled;
+
+    }
+
+    /**
+     * Dithers the final quantization of the float mix to S16LE, see audio::DitherMode. Without it the
+     * rounding error of quiet, faded or limited passages is distortion that follows the signal; with it,
+     * it is a steady noise floor at the last bit. Must be called before open().
+     */
+    void setDither(audio::DitherMode mode) {
+
+        dither = mode;
+
+    }
+
+    /**
+     * Sets how often the mixer publishes peak and RMS levels, see getLevels(). An interval shorter than
+     * a chunk publishes every chunk. Must be called before open().
+     */
+    void setMeterInterval(std::chrono::milliseconds interval) {
+
+        meterInterval = interval;
+
+    }
+
+    /**
+     * Levels of the last completed metering interval, per source and for the master. They are measured
+     * in the mixing pass itself and handed over wait-free, so polling never stalls the mixer. Must be
+     * called from a single thread (the control thread), like the other control functions.
+     */
+    MixLevels getLevels() {
+
+        levels.update();
+        return levels.current();
+
+    }
+
+    const metrics::Registry &getMetrics() const {
+
+        return metricRegistry;
+
+    }
+
+    /**
+     * Expected recording length, used by the WAV sink to preallocate the output file.
+     * By default the length of the longer source is used. Must be called before open().
+     */
+    void setExpectedDuration(std::chrono::seconds duration) {
+
+        expectedDuration = duration;
 
     }
 
 private:
 
-    void init () {
+    /**
+     * Resets what the control calls set for a new session. A mixer still running is told to stop, so it
+     * doesn't consume control calls meant for the next session.
+     */
+    void resetControls() {
 
-        std::ifstream is("audio1_s16le_mono_48k.raw", std::ios::binary);
-        if (is) {
+        setMixingLevel(0); //compromise for default value
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            stopping = true;
+            paused = true;
+            seekPending = false;
+            seekTarget = 0;
+            timePaused = std::chrono::milliseconds(0);
+        }
+        stateChanged.notify_all();
 
-            // get length of file:
-            is.seekg(0, is.end);
-            int length = is.tellg();
-            is.seekg(0, is.beg);
+    }
 
-            m_saw.resize(length / sizeof(int16_t));
-            is.read ((char*)m_saw.data(),length);
+    /**
+     * Resets the session state once the previous session is closed, the mixer picks it up once it runs.
+     */
+    void prepareOpen() {
 
-            if (is.fail()) std::cerr<<"error: only "<<is.gcount()<<" could be read"<<std::endl;
+        networkQueue.reset((size_t)(prefetchDepth.count() * SAMPLE_RATE / 1000), largestNetworkRead());
+        stopping = false;
+        finished = false;
+        gainsPrimed = false;
+        networkBytesRead = 0;
+        networkMeter.reset();
+        playerMeter.reset();
+        masterMeter.reset();
+        levels.publish(MixLevels()); //the mixer isn't running yet, so it's still ours to write
 
-            is.close();
+        //a reopened player starts over
+        position = 0;
+        writtenSamples = 0;
+        networkPosition = 0;
+        underrunTime = std::chrono::milliseconds(0);
+        pausedSample = 0;
+        {
+            std::lock_guard<std::mutex> lock(switchMutex);
+            qualitySwitches.clear();
         }
-        else {
-            std::cerr<<"Player reader: Couldn't open input file!"<<std::endl;
-            exit(1);
+
+        readyPromise = std::promise<void>();
+        readyFuture = readyPromise.get_future().share();
+        readyEvent.reset();
+
+    }
+
+    /**
+     * Background part of open(). The network side runs on a thread of its own and starts the prefetch as
+     * soon as the stream is loaded, meanwhile the file source, sink and buffers are set up here.
+     */
+    void initialize(async::Executor *executor) {
+
+        bool networkLoaded = false;
+        std::thread network([this, executor, &networkLoaded]{ networkLoaded = loadNetwork(executor); });
+
+        if (!init()) { //read the data from filename
+            network.join();
+            failOpen(networkLoaded, "Player reader: Couldn't open input file!");
+            return;
+        }
+
+        if (outputMode == OutputMode::Wav) network.join(); //preallocation needs the network stream length
+        prepareOutput();
+
+        if (network.joinable()) network.join();
+        if (!networkLoaded) {
+            release();
+            failOpen(false, "Player: Couldn't load the network stream!");
+            return;
+        }
+        startMixer();
+
+    }
+
+    /**
+     * Coroutine part of openAsync(), runs once the task is awaited.
+     */
+    async::Task<void> reopenAsync(async::Executor &executor) {
+
+        co_await closeAsync(executor); //also moves us over to the executor
+        prepareOpen();
+        co_await initializeAsync(executor);
+        readyFuture.get(); //rethrows a failed open
+
+    }
+
+    /**
+     * initialize() as a coroutine on the executor, the network side is spawned as a task of its own.
+     */
+    async::Task<void> initializeAsync(async::Executor &executor) {
+
+        bool networkLoaded = false;
+        async::Event networkDone; //awaited on every path, the task writes to networkLoaded
+        async::spawn(executor, loadNetworkAsync(executor, networkLoaded), &networkDone);
+
+        if (!init()) {
+            co_await networkDone.wait(executor);
+            co_await failOpenAsync(executor, networkLoaded, "Player reader: Couldn't open input file!");
+            co_return;
+        }
+
+        if (outputMode == OutputMode::Wav) co_await networkDone.wait(executor);
+        prepareOutput();
+
+        co_await networkDone.wait(executor);
+        if (!networkLoaded) {
+            release();
+            co_await failOpenAsync(executor, false, "Player: Couldn't load the network stream!");
+            co_return;
+        }
+        startMixer();
+
+    }
+
+    /**
+     * Network side of the initialization: loads the stream, rewinds it and starts the prefetch.
+     *
+     * @return false if the stream could not be loaded
+     */
+    bool loadNetwork(async::Executor *executor) {
+
+        if (!nr.load()) return false;
+        nr.setEncoding(networkEncoding);
+        nr.seek(0); //a reopened player starts over
+        startPrefetch(executor);
+        return true;
+
+    }
+
+    async::Task<void> loadNetworkAsync(async::Executor &executor, bool &loaded) {
+
+        loaded = loadNetwork(&executor);
+        co_return;
+
+    }
+
+    /**
+     * Opens the sink and the stats file, allocates the mixing buffers and locks them if requested.
+     */
+    void prepareOutput() {
+
+        openSink();
+
+        char statsFile[] = "realtime_stats.txt";
+        stats.open(statsFile, std::ios::trunc);
+
+        int16_t samples = 72; //good compromise ;-)
+
+        //Network Buffer for streaming
+        networkBytes = samples * sizeof(int16_t);
+        networkBuffer = new char[networkBytes];
+
+        //Player Buffer for streaming
+        playerBytes = samples * sizeof(int16_t);
+        playerBuffer = new char[playerBytes];
+
+        //Mixing bus and stereo output chunk, sized for the larger of the two sources
+        size_t busSamples = std::max(networkBytes, playerBytes) / sizeof(int16_t);
+        bus.resize(busSamples);
+        bus.setDither(dither);
+        bus.setLimiter(limiterEnabled, (float)(limiterCeiling * 32767), (size_t)(limiterRelease.count() * SAMPLE_RATE / 1000));
+        mix = new int16_t[2 * bus.capacity()];
+
+        //resampler input, at most one chunk at the maximum ratio plus the filter length
+        driftInput.resize(2 * networkBytes / sizeof(int16_t) + audio::DriftResampler::Taps);
+        driftResampler.reset();
+        auto target = driftTarget.count() > 0 ? driftTarget : prefetchDepth / 2;
+        driftEstimator.reset((double)target.count() * SAMPLE_RATE / 1000);
+
+        //keep everything the mixer touches resident, page faults are the worst tail latency offenders
+        if (memoryLocking) {
+            sys::prefault(mix, 2 * bus.capacity() * sizeof(int16_t));
+            sys::prefault(networkBuffer, networkBytes);
+            sys::prefault(playerBuffer, playerBytes);
+            std::vector<std::pair<const void*, size_t>> buffers = {{mix, 2 * bus.capacity() * sizeof(int16_t)},
+                                                                   {networkBuffer, networkBytes},
+                                                                   {playerBuffer, playerBytes},
+                                                                   {driftInput.data(), driftInput.size() * sizeof(int16_t)}};
+            bus.memoryRanges(buffers);
+            networkQueue.memoryRanges(buffers);
+            fileSource.memoryRanges(buffers);
+            std::string warnings;
+            memoryLock.lock(buffers, warnings);
+            if (!warnings.empty()) std::cerr<<"Player: "<<warnings<<std::flush;
+        }
+
+    }
+
+    /**
+     * Last step of a successful open: parks the mixer until play(), unless it was already called.
+     */
+    void startMixer() {
+
+        mixerDone.reset();
+        mixerThread = std::thread(&Player::mixer, this);
+        readyPromise.set_value();
+        readyEvent.set();
+
+    }
+
+    /**
+     * Ends a failed open(): stops the prefetch if it was started and hands the error to the ready future.
+     * Whatever else was set up has to be released by the caller.
+     */
+    void failOpen(bool prefetching, const char *error) {
+
+        if (prefetching) {
+            requestStop();
+            prefetchDone.wait();
+            if (prefetchThread.joinable()) prefetchThread.join();
+        }
+        readyPromise.set_exception(std::make_exception_ptr(std::runtime_error(error)));
+        readyEvent.set();
+
+    }
+
+    async::Task<void> failOpenAsync(async::Executor &executor, bool prefetching, const char *error) {
+
+        if (prefetching) {
+            requestStop();
+            co_await prefetchDone.wait(executor);
+            if (prefetchThread.joinable()) prefetchThread.join(); //has returned
+        }
+        readyPromise.set_exception(std::make_exception_ptr(std::runtime_error(error)));
+        readyEvent.set();
+
+    }
+
+    void openSink() {
+
+        char sinkFile[] = "audio_output.raw";
+        char wavFile[] = "audio_output.wav";
+        char losslessFile[] = "audio_output.splc";
+
+        if (outputMode == OutputMode::Uring && !io::Uring::supported()) {
+            std::cerr<<"io_uring is not available, falling back to stream I/O."<<std::endl;
+            outputMode = OutputMode::Stream;
+        }
+
+        switch (outputMode) {
+            case OutputMode::Uring: uringSink.open(sinkFile); break;
+            case OutputMode::Direct: directSink.open(sinkFile); break;
+            case OutputMode::Wav: {
+                //preallocate for the longer of both sources unless told otherwise, stereo S16LE
+                uint64_t frames = expectedDuration.count() > 0 ? (uint64_t)expectedDuration.count() * SAMPLE_RATE
+                                                               : std::max<uint64_t>(fileSource.length(), nr.length());
+                wavSink.open(wavFile, SAMPLE_RATE, 2, frames * 2 * sizeof(int16_t));
+                break;
+            }
+            case OutputMode::Lossless: losslessSink.open(losslessFile, SAMPLE_RATE, 2); break;
+            case OutputMode::Null: nullSink = io::NullWriter(); break;
+            case OutputMode::Pipe: pipeSink.open(); break;
+            case OutputMode::Checksum: checksumSink.reset(); break;
+            default: sink.open(sinkFile); break;
+        }
+
+    }
+
+    /**
+     * Starts filling the network queue, on a thread or as a coroutine on the executor.
+     */
+    void startPrefetch(async::Executor *executor) {
+
+        if (networkConnections > 1) {
+            const double watermark = (double)networkQueue.capacity();
+            fetcher.start(networkConnections, [this, watermark]{ return networkQueue.fill() / watermark; });
+        }
+        prefetchCoroutine = executor && networkConnections <= 1; //the parallel fetcher has threads of its own
+        prefetchDone.reset();
+        if (prefetchCoroutine) {
+            async::spawn(*executor, prefetchAsync(*executor), &prefetchDone);
+        } else {
+            prefetchThread = std::thread(&Player::prefetch, this);
+        }
+
+    }
+
+    /**
+     * First half of close(): tells the mixer and the prefetch to stop.
+     */
+    void requestStop() {
+
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            stopping = true;
+        }
+        stateChanged.notify_all();
+        networkQueue.close();
+        fetcher.stop(); //unblocks a prefetch waiting for a segment
+
+    }
+
+    /**
+     * Second half of close(), once the prefetch is done: joins the mixer, closes the outputs and frees the buffers.
+     */
+    void release() {
+
+        if (mixerThread.joinable()) mixerThread.join(); //not started if open() failed
+        memoryLock.unlock(); //other players may still hold the process wide lock
+
+        //closing audio output stream
+        bool sinkOk = true;
+        switch (outputMode) {
+            case OutputMode::Uring: sinkOk = uringSink.close(); break;
+            case OutputMode::Direct: sinkOk = directSink.close(); break; //writes the unaligned tail
+            case OutputMode::Wav: sinkOk = wavSink.close(); break; //patches the header sizes
+            case OutputMode::Lossless: sinkOk = losslessSink.close(); break;
+            case OutputMode::Null: sinkOk = nullSink.close(); break;
+            case OutputMode::Pipe: sinkOk = pipeSink.close(); break;
+            case OutputMode::Checksum:
+                sinkOk = checksumSink.close();
+                stats << "checksum, " << std::hex << checksumSink.digest() << std::dec << ", " << checksumSink.bytes() << std::endl;
+                break;
+            default: sinkOk = sink.close(); break;
+        }
+        if(!sinkOk) std::cerr<<"An error occurred when closing the audio output file."<<std::endl;
+
+        fileSource.close();
+
+        stats.close(); //closing realtime stats file
+        if(!stats) std::cerr<<"An error occurred when closing the stats file."<<std::endl;
+
+        delete[] networkBuffer; networkBuffer = nullptr;
+        delete[] playerBuffer; playerBuffer = nullptr;
+        delete[] mix; mix = nullptr;
+
+    }
+
+    /**
+     * Network prefetch thread: reads from a single connection or from all of them.
+     */
+    void prefetch() {
+
+        if (networkConnections > 1) prefetchFrom(fetcher);
+        else prefetchFrom(nr);
+        prefetchDone.set();
+
+    }
+
+    /**
+     * Reads ahead into the network queue until its watermark is reached, decoding compressed wire formats
+     * on the way. After the end of the stream it stays around, so a seek can refill the queue.
+     *
+     * @param source net::NetworkReader or net::ParallelFetcher
+     */
+    template <class Source>
+    void prefetchFrom(Source &source) {
+
+        PrefetchState state(source.encoding());
+        while (networkQueue.waitForSpace(state.samples.size(), state.generation, state.eos)) {
+            prefetchRestart(source, state);
+            auto started = std::chrono::steady_clock::now();
+            size_t networkRead = source.read(state.block.data(), state.block.size());
+            prefetchBlock(source, state, networkRead, std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - started));
+        }
+
+    }
+
+    /**
+     * Same as prefetchFrom(nr), as a coroutine on the executor: it suspends instead of blocking while the
+     * queue is full and while the network transfers.
+     */
+    async::Task<void> prefetchAsync(async::Executor &executor) {
+
+        PrefetchState state(nr.encoding());
+        while (true) {
+            co_await async::until(executor, [&](std::function<void()> wake) {
+                return networkQueue.waitForSpaceAsync(state.samples.size(), state.generation, state.eos, std::move(wake));
+            });
+            if (networkQueue.closed()) break;
+            prefetchRestart(nr, state);
+            auto started = std::chrono::steady_clock::now();
+            size_t networkRead = co_await nr.readAsync(executor, state.block.data(), state.block.size());
+            prefetchBlock(nr, state, networkRead, std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - started));
+        }
+
+    }
+
+    /**
+     * Repositions the source if the mixer restarted the network queue since the last read.
+     */
+    template <class Source>
+    void prefetchRestart(Source &source, PrefetchState &state) {
+
+        uint64_t from;
+        if (networkQueue.restarted(state.generation, from)) {
+            state.streamPosition = source.seek((size_t)from);
+            state.skip = from - state.streamPosition;
+            state.eos = false;
+        }
+
+    }
+
+    /**
+     * Decodes a block read from the source into the network queue and picks the wire format for the next one.
+     *
+     * @param networkRead bytes read into state.block, 0 at EOS
+     * @param elapsed time the read took
+     */
+    template <class Source>
+    void prefetchBlock(Source &source, PrefetchState &state, size_t networkRead, std::chrono::microseconds elapsed) {
+
+        if (networkRead == 0) { //EOS
+            networkQueue.finish(state.generation);
+            state.eos = true;
+            return;
+        }
+        networkBytesRead += networkRead;
+        readWait.observe(elapsed.count() * 1e-6);
+        state.quality.addSample(networkRead, elapsed);
+
+        //the last ADPCM block is padded, drop what lies past the end of the stream
+        size_t decoded = audio::codec::decode(state.encoding, (const uint8_t*)state.block.data(), networkRead,
+                                              state.samples.data());
+        decoded = (size_t)std::min<uint64_t>(decoded, source.length() - std::min<uint64_t>(state.streamPosition, source.length()));
+        state.streamPosition += decoded;
+        size_t skipped = (size_t)std::min<uint64_t>(state.skip, decoded);
+        state.skip -= skipped;
+        networkQueue.push(state.samples.data() + skipped, decoded - skipped, state.generation);
+
+        if (!adaptiveQuality) return;
+        const double watermark = (double)networkQueue.capacity();
+        audio::StreamEncoding next = state.quality.select(networkQueue.fill() / watermark);
+        if (next != state.encoding) {
+            //continue from the start of the unit holding the next sample and drop what was already queued
+            source.setEncoding(next);
+            uint64_t at = source.seek((size_t)state.streamPosition);
+            state.skip += state.streamPosition - at;
+            {
+                std::lock_guard<std::mutex> lock(switchMutex);
+                qualitySwitches.push_back({stopWatch.elapsed<std::chrono::milliseconds>(), state.streamPosition,
+                                           state.encoding, next, state.quality.estimate()});
+            }
+            state.streamPosition = at;
+            state.encoding = next;
+            state.samples.resize(audio::codec::maxDecodedSamples(state.encoding, state.block.size()));
+        }
+
+    }
+
+    /**
+     * Mixer thread: picks the mixing loop for the selected sink once, so every chunk is written by a direct call.
+     */
+    void mixer() {
+
+        std::string warnings;
+        sys::applyToCurrentThread(mixerPolicy, warnings);
+        if (!warnings.empty()) std::cerr<<"Player mixer: "<<warnings<<std::flush;
+
+        switch (outputMode) {
+            case OutputMode::Uring: mixLoop(uringSink); break;
+            case OutputMode::Direct: mixLoop(directSink); break;
+            case OutputMode::Wav: mixLoop(wavSink); break;
+            case OutputMode::Lossless: mixLoop(losslessSink); break;
+            case OutputMode::Null: mixLoop(nullSink); break;
+            case OutputMode::Pipe: mixLoop(pipeSink); break;
+            case OutputMode::Checksum: mixLoop(checksumSink); break;
+            default: mixLoop(sink); break;
+        }
+        mixerDone.set();
+
+    }
+
+    /**
+     * Produces one chunk per chunk period while playing, parks while paused or finished.
+     */
+    template <class Sink>
+    void mixLoop(Sink &out) {
+
+        using Clock = std::chrono::steady_clock;
+        const auto period = std::chrono::microseconds(1000000 * (networkBytes / sizeof(int16_t)) / SAMPLE_RATE);
+        Clock::time_point deadline;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(stateMutex);
+                if (stopping) return; //a seek pending by now belongs to the next session
+                if (seekPending) {
+                    seekPending = false;
+                    applySeek(seekTarget);
+                }
+                if (paused || finished) {
+                    pausedSample = position;
+                    stateChanged.wait(lock, [&]{ return (!paused && !finished) || stopping || seekPending; });
+                    deadline = Clock::now(); //restart the output clock, the first chunk goes out immediately
+                    continue; //re-evaluate, a seek may have woken us up
+                }
+            }
+
+            if (!mixChunk(out)) {
+                finished = true;
+                continue;
+            }
+
+            if (realtime) {
+                //a late chunk (e.g. after an underrun) re-anchors the clock instead of bursting to catch up
+                deadline = std::max(deadline + period, Clock::now());
+                std::this_thread::sleep_until(deadline);
+            }
         }
 
     }
 
+    /**
+     * Repositions both sources. Runs on the mixer thread between two chunks.
+     */
+    void applySeek(uint64_t target) {
+
+        fileSource.seek(target); //file source, read-ahead restarts at the new offset
+
+        //network source: skip within the buffered range if possible, refill from the new offset otherwise
+        uint64_t buffered = networkQueue.fill();
+        if (target >= networkPosition && target - networkPosition <= buffered) {
+            networkQueue.discard((size_t)(target - networkPosition));
+        } else {
+            networkQueue.restart(target);
+        }
+        networkPosition = target;
+        driftResampler.reset();
+        driftEstimator.settle();
+        bus.reset(); //what the limiter held back belongs to the old position
+
+        position = target;
+        pausedSample = target;
+        finished = false;
+
+    }
+
+    /**
+     * Mixes and writes a single chunk.
+     *
+     * @param out sink the chunk is written to
+     * @return false once both sources are exhausted
+     */
+    template <class Sink>
+    bool mixChunk(Sink &out) {
+
+        //what is actually read
+        size_t playerRead;
+        size_t networkRead;
+
+        //stream from network -wait for the prefetch to catch up instead of skipping samples
+        size_t networkSamples = networkBytes / sizeof(int16_t);
+        size_t networkInput = networkSamples;
+        double ratio = 1;
+        if (driftCompensation) {
+            ratio = driftEstimator.update((double)networkQueue.fill(), (double)networkSamples / SAMPLE_RATE);
+            networkInput = driftResampler.inputNeeded(networkSamples, ratio);
+        }
+        if (!networkQueue.waitForData(networkInput, std::chrono::milliseconds(0))) {
+            underruns.add();
+            net::StopWatch wait;
+            bool interrupted = false;
+            while (!networkQueue.waitForData(networkInput, std::chrono::milliseconds(100))) {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                interrupted = stopping || seekPending || paused;
+                if (interrupted) break;
+            }
+            underrunTime += wait.elapsed<std::chrono::milliseconds>();
+            if (interrupted) return true; //nothing read yet, the mix loop parks, seeks or stops first
+        }
+        if (driftCompensation) {
+            size_t popped = networkQueue.pop(driftInput.data(), std::min(networkInput, driftInput.size()));
+            networkPosition += popped;
+            driftResampler.push(driftInput.data(), popped);
+            if (networkQueue.drained()) driftResampler.finish(); //let the filter's lookahead out at the end
+            networkRead = driftResampler.process((int16_t*)networkBuffer, networkSamples, ratio) * sizeof(int16_t);
+        } else {
+            networkRead = networkQueue.pop((int16_t*)networkBuffer, networkSamples) * sizeof(int16_t);
+            networkPosition += networkRead / sizeof(int16_t);
+        }
+        playerRead = read(playerBuffer, playerBytes); //stream from player
+
+        size_t chunk = std::max(networkRead, playerRead) / sizeof(int16_t);
+        if (chunk == 0) {
+            //till all the data from sources have been streamed, and the limiter let out what it held back
+            if (!bus.drain()) return false;
+        } else {
+            //number of samples currently streaming
+            writtenSamples += (playerRead/sizeof(int16_t)) + (networkRead/sizeof(int16_t));
+
+            //mixing process -each source is converted into the float bus once, shorter sources count as silence
+            updateGains();
+            bus.begin();
+            bus.add((const int16_t*)networkBuffer, networkRead / sizeof(int16_t), networkGain, chunk, networkMeter);
+            bus.add((const int16_t*)playerBuffer, playerRead / sizeof(int16_t), playerGain, chunk, playerMeter);
+        }
+        size_t mixed = bus.render(mix, masterMeter, softClip); //single saturating pass back to S16LE -stereo
+
+        //output stats
+        stats << stopWatch.elapsed<std::chrono::milliseconds>().count() << ", " << writtenSamples
+              << ", " << underrunTime.count() << ", " << networkBytesRead << ", " << driftEstimator.drift() << std::endl;
+        logQualitySwitches();
+
+        //output stream
+        if (mixed > 0) { //nothing while the limiter's lookahead fills
+            auto writeStart = std::chrono::steady_clock::now();
+            out.write((const char*)mix, mixed * sizeof(int16_t));
+            writeLatency.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - writeStart).count());
+        }
+        bytesOut.add(mixed * sizeof(int16_t));
+        samplesMixed.add(chunk);
+        networkFill.set((double)networkQueue.fill());
+        position += mixed / 2;
+        if (masterMeter.samples() >= (uint64_t)(meterInterval.count() * SAMPLE_RATE / 1000)) publishLevels();
+
+        return true;
+
+    }
+
+    /**
+     * Hands the levels metered since the last call over to getLevels() and starts a new interval.
+     */
+    void publishLevels() {
+
+        levels.publish({networkMeter.level(), playerMeter.level(), masterMeter.level(), position});
+        networkMeter.reset();
+        playerMeter.reset();
+        masterMeter.reset();
+
+    }
+
+    /**
+     * Writes the quality switches decided by the prefetch since the last chunk to the stats file.
+     */
+    void logQualitySwitches() {
+
+        std::vector<net::QualitySwitch> switches;
+        {
+            std::lock_guard<std::mutex> lock(switchMutex);
+            switches.swap(qualitySwitches);
+        }
+        for (const net::QualitySwitch &s : switches) {
+            stats << s.time.count() << ", switch, " << audio::name(s.from) << " -> " << audio::name(s.to)
+                  << ", " << s.position << ", " << (int64_t)s.estimate << std::endl;
+        }
+
+    }
+
+    /**
+     * Picks up the latest mixing parameters and retargets the gain ramps when the level changed since the last chunk.
+     * Levels set before anything was played are applied instantly.
+     */
+    void updateGains() {
+
+        mixParams.update();
+        const MixParams &params = mixParams.current();
+
+        size_t rampSamples = (size_t)(params.rampDuration.count() * SAMPLE_RATE / 1000);
+        if (!gainsPrimed) rampSamples = 0;
+        gainsPrimed = true;
+
+        if ((float)params.networkLevel != networkGain.target()) {
+            networkGain.setTarget((float)params.networkLevel, rampSamples, params.rampShape);
+        }
+        if ((float)params.playerLevel != playerGain.target()) {
+            playerGain.setTarget((float)params.playerLevel, rampSamples, params.rampShape);
+        }
+
+    }
+
+    /**
+     * @return most samples a single network read decodes to, in any wire format the prefetch may switch to
+     */
+    static size_t largestNetworkRead() {
+
+        size_t largest = 0;
+        for (audio::StreamEncoding e : {audio::StreamEncoding::Pcm16, audio::StreamEncoding::MuLaw,
+                                        audio::StreamEncoding::ALaw, audio::StreamEncoding::ImaAdpcm}) {
+            largest = std::max(largest, audio::codec::maxDecodedSamples(e, BUFFER_SIZE));
+        }
+        return largest;
+
+    }
+
+    /**
+     * @return false if the input file can't be opened
+     */
+    bool init () {
+
+        //the Uring output mode reads the file through io_uring as well
+        return fileSource.open("audio1_s16le_mono_48k.raw", outputMode == OutputMode::Uring);
+
+    }
+
     /**
      * Stream from file -equivelant process of network stream
      * The sample format being read is 48kHz, S16LE, mono.
@@ -211,19 +1379,10 @@ private:
     size_t read (char* buf, size_t maxBytes) {
 
         const size_t blockSize = 8192 * 4;
-        size_t samplesRemaining = m_saw.size() - m_sawIndex;
-
-        if (samplesRemaining == 0) return 0; //EOS
+        size_t maxReadSize = std::min(maxBytes, blockSize);
 
-        size_t maxReadSize = std::min(std::min(maxBytes, blockSize), samplesRemaining * sizeof(int16_t));
-        auto nSamples = maxReadSize / sizeof(int16_t);
-        std::copy_n(m_saw.begin() + m_sawIndex, nSamples, (int16_t*)buf);
-        m_sawIndex += nSamples;
-
-        return nSamples * sizeof(int16_t);
+        return fileSource.read((int16_t*)buf, maxReadSize / sizeof(int16_t)) * sizeof(int16_t); //0 at EOS
 
     }
 
-
-
 };
\ No newline at end of file
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "streamCodec.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace net {
+
+    /**
+     * A quality switch decided by the QualityController, reported to the stats.
+     */
+    struct QualitySwitch {
+        std::chrono::milliseconds time; //player clock
+        uint64_t position;              //stream position (samples) the new representation starts at
+        audio::StreamEncoding from;
+        audio::StreamEncoding to;
+        double estimate;                //bandwidth estimate in bytes per second
+    };
+
+    /**
+     * Adaptive bitrate logic for the network source, in the spirit of DASH/HLS players.
+     *
+     * Throughput is measured per read and smoothed by a fast and a slow moving average, the lower of the
+     * two is the estimate (quick to drop, slow to recover). The representation is the best one whose byte
+     * rate fits the estimate with some headroom. Downswitches happen at once, and a nearly empty buffer
+     * forces one even if the estimate still looks fine. Upswitches go one step at a time, need a healthy
+     * buffer and wait for a minimum dwell time since the last switch.
+     */
+    class QualityController {
+    public:
+        static const size_t LadderSize = 3;
+
+        /**
+         * @param sampleRate samples per second of the stream
+         * @param start representation to start with
+         */
+        QualityController(uint32_t sampleRate, audio::StreamEncoding start)
+            : m_sampleRate(sampleRate), m_rung(rungOf(start)), m_fast(0), m_slow(0),
+              m_lastSwitch(Clock::now()) {}
+
+        /**
+         * Feeds a completed read into the bandwidth estimate.
+         */
+        void addSample(size_t bytes, std::chrono::microseconds elapsed) {
+            if (bytes == 0 || elapsed.count() <= 0) return;
+            double rate = 1e6 * bytes / elapsed.count();
+            m_fast = m_fast > 0 ? m_fast + 0.5 * (rate - m_fast) : rate;
+            m_slow = m_slow > 0 ? m_slow + 0.1 * (rate - m_slow) : rate;
+        }
+
+        /**
+         * @return bandwidth estimate in bytes per second, 0 until the first read completed
+         */
+        double estimate() const {
+            return std::min(m_fast, m_slow);
+        }
+
+        /**
+         * Picks the representation for the next read.
+         *
+         * @param bufferLevel fill of the network buffer relative to its watermark, 0..1
+         * @return representation to use, current() if nothing changes
+         */
+        audio::StreamEncoding select(double bufferLevel) {
+            if (estimate() <= 0) return current();
+
+            size_t fits = LadderSize - 1;
+            for (size_t i = 0; i < LadderSize; ++i) {
+                if (bytesPerSecond(ladder(i)) <= Headroom * estimate()) {
+                    fits = i;
+                    break;
+                }
+            }
+            if (bufferLevel < PanicLevel) fits = std::max(fits, std::min(m_rung + 1, LadderSize - 1));
+
+            auto now = Clock::now();
+            bool settled = now - m_lastSwitch >= std::chrono::seconds(MinDwellSeconds);
+            size_t rung = m_rung;
+            if (fits > m_rung) {
+                rung = fits;
+            } else if (fits < m_rung && bufferLevel >= UpswitchLevel && settled) {
+                rung = m_rung - 1;
+            }
+            if (rung != m_rung) {
+                m_rung = rung;
+                m_lastSwitch = now;
+            }
+            return current();
+        }
+
+        audio::StreamEncoding current() const {
+            return ladder(m_rung);
+        }
+
+        /**
+         * @return representations from best to most compact
+         */
+        static audio::StreamEncoding ladder(size_t rung) {
+            static const audio::StreamEncoding rungs[LadderSize] = {
+                audio::StreamEncoding::Pcm16, audio::StreamEncoding::MuLaw, audio::StreamEncoding::ImaAdpcm};
+            return rungs[std::min(rung, LadderSize - 1)];
+        }
+
+        double bytesPerSecond(audio::StreamEncoding e) const {
+            return (double)audio::codec::unitBytes(e) * m_sampleRate / audio::codec::unitSamples(e);
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        static constexpr double Headroom = 0.85;
+        static constexpr double PanicLevel = 0.25;
+        static constexpr double UpswitchLevel = 0.5;
+        static const int MinDwellSeconds = 3;
+
+        static size_t rungOf(audio::StreamEncoding e) {
+            for (size_t i = 0; i < LadderSize; ++i) {
+                if (ladder(i) == e) return i;
+            }
+            return LadderSize - 1; //A-law is not on the ladder, treat it like the most compact rung
+        }
+
+        uint32_t m_sampleRate;
+        size_t m_rung;
+        double m_fast;
+        double m_slow;
+        Clock::time_point m_lastSwitch;
+    };
+}
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace audio {
+
+    /**
+     * Bounded sample FIFO between a source prefetch thread (producer) and the mixer (consumer).
+     * The producer blocks once the queue is filled up to its watermark, the consumer never blocks
+     * unless it explicitly waits for data.
+     *
+     * To reposition the stream the consumer calls restart(). This starts a new generation: everything
+     * the producer pushes for an older generation is dropped, and the producer picks up the new start
+     * position through restarted().
+     */
+    class SampleQueue {
+    public:
+        SampleQueue() : m_head(0), m_fill(0), m_eos(false), m_closed(false), m_generation(0), m_origin(0),
+                        m_waitSize(0), m_waitGeneration(0), m_waitEos(false) {}
+
+        /**
+         * Empties the queue and sets its capacity.
+         *
+         * @param capacity watermark in samples up to which the producer fills the queue
+         * @param largestPush most samples the producer pushes at once, the capacity is raised to it
+         */
+        void reset(size_t capacity, size_t largestPush) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_ring.assign(std::max<size_t>(std::max(capacity, largestPush), 1), 0);
+            m_head = 0;
+            m_fill = 0;
+            m_eos = false;
+            m_closed = false;
+            m_generation = 0;
+            m_origin = 0;
+            m_spaceWaiter = nullptr;
+        }
+
+        /**
+         * Producer side: blocks until at least n samples can be pushed or the consumer restarted the stream.
+         *
+         * @param n number of samples the producer wants to push, at most the largest push given to reset()
+         * @param generation generation the producer is working on
+         * @param eos true if the producer reached the end of its generation and only waits for a restart
+         * @return false if the queue was closed while waiting
+         */
+        bool waitForSpace(size_t n, uint64_t generation, bool eos) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            n = std::min(n, m_ring.size());
+            m_spaceAvailable.wait(lock, [&]{ return spaceFor(n, generation, eos); });
+            return !m_closed;
+        }
+
+        /**
+         * Producer side: waitForSpace() for a producer running as a coroutine, which must not block.
+         * If the producer can't go on yet, wake is called once, from the consumer's thread, as soon as
+         * waitForSpace() would return.
+         *
+         * @return true if the producer can go on right away, wake is not called then
+         */
+        bool waitForSpaceAsync(size_t n, uint64_t generation, bool eos, std::function<void()> wake) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_waitSize = std::min(n, m_ring.size());
+            m_waitGeneration = generation;
+            m_waitEos = eos;
+            if (spaceFor(m_waitSize, generation, eos)) return true;
+            m_spaceWaiter = std::move(wake);
+            return false;
+        }
+
+        /**
+         * @return true once close() was called
+         */
+        bool closed() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_closed;
+        }
+
+        /**
+         * Producer side: checks for a restart requested by the consumer.
+         *
+         * @param generation generation the producer is working on, updated on restart
+         * @param from stream position (in samples) the producer has to continue from
+         * @return true if the stream was restarted since the given generation
+         */
+        bool restarted(uint64_t &generation, uint64_t &from) const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (generation == m_generation) return false;
+            generation = m_generation;
+            from = m_origin;
+            return true;
+        }
+
+        /**
+         * Producer side: appends samples, after waitForSpace() made room for them. Samples of an old
+         * generation are dropped, the consumer restarted the stream elsewhere.
+         *
+         * @return number of samples queued, n or 0 for an old generation
+         * @throws std::length_error if there is no room for n samples, nothing is queued then
+         */
+        size_t push(const int16_t *src, size_t n, uint64_t generation) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (generation != m_generation) return 0;
+                if (n > m_ring.size() - m_fill) throw std::length_error("SampleQueue: push exceeds the free space");
+                size_t tail = (m_head + m_fill) % m_ring.size();
+                size_t first = std::min(n, m_ring.size() - tail);
+                std::copy_n(src, first, m_ring.begin() + tail);
+                std::copy_n(src + first, n - first, m_ring.begin());
+                m_fill += n;
+            }
+            m_dataAvailable.notify_one();
+            return n;
+        }
+
+        /**
+         * Producer side: marks the end of the stream.
+         */
+        void finish(uint64_t generation) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (generation != m_generation) return;
+                m_eos = true;
+            }
+            m_dataAvailable.notify_all();
+        }
+
+        /**
+         * Consumer side: takes up to n samples without blocking.
+         *
+         * @return number of samples copied into dst
+         */
+        size_t pop(int16_t *dst, size_t n) {
+            std::function<void()> wake;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                n = std::min(n, m_fill);
+                size_t first = std::min(n, m_ring.size() - m_head);
+                std::copy_n(m_ring.begin() + m_head, first, dst);
+                std::copy_n(m_ring.begin(), n - first, dst + first);
+                m_head = (m_head + n) % m_ring.size();
+                m_fill -= n;
+                wake = takeSpaceWaiter();
+            }
+            m_spaceAvailable.notify_one();
+            if (wake) wake();
+            return n;
+        }
+
+        /**
+         * Consumer side: drops up to n queued samples, e.g. to skip forward within the buffered range.
+         *
+         * @return number of samples dropped
+         */
+        size_t discard(size_t n) {
+            std::function<void()> wake;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                n = std::min(n, m_fill);
+                m_head = (m_head + n) % m_ring.size();
+                m_fill -= n;
+                wake = takeSpaceWaiter();
+            }
+            m_spaceAvailable.notify_one();
+            if (wake) wake();
+            return n;
+        }
+
+        /**
+         * Consumer side: empties the queue and asks the producer to continue from another stream position.
+         *
+         * @param from stream position in samples
+         */
+        void restart(uint64_t from) {
+            std::function<void()> wake;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_head = 0;
+                m_fill = 0;
+                m_eos = false;
+                m_generation++;
+                m_origin = from;
+                wake = takeSpaceWaiter();
+            }
+            m_spaceAvailable.notify_all();
+            if (wake) wake();
+        }
+
+        /**
+         * Consumer side: blocks until n samples are queued, the stream ended or the timeout expired.
+         *
+         * @return true if n samples are available or no more samples will arrive
+         */
+        bool waitForData(size_t n, std::chrono::milliseconds timeout) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            return m_dataAvailable.wait_for(lock, timeout, [&]{ return m_closed || m_eos || m_fill >= n; });
+        }
+
+        /**
+         * Wakes up and releases both sides, e.g. on shutdown.
+         */
+        void close() {
+            std::function<void()> wake;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_closed = true;
+                wake = takeSpaceWaiter();
+            }
+            m_spaceAvailable.notify_all();
+            m_dataAvailable.notify_all();
+            if (wake) wake();
+        }
+
+        /**
+         * @return number of samples the queue holds when full
+         */
+        size_t capacity() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_ring.size();
+        }
+
+        /**
+         * Adds the ring to a list of (address, size) ranges, e.g. to lock it into memory.
+         */
+        void memoryRanges(std::vector<std::pair<const void*, size_t>> &ranges) const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ranges.emplace_back(m_ring.data(), m_ring.size() * sizeof(int16_t));
+        }
+
+        size_t fill() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_fill;
+        }
+
+        /**
+         * @return true once the producer finished (or the queue was closed) and everything was consumed
+         */
+        bool drained() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return (m_eos || m_closed) && m_fill == 0;
+        }
+
+    private:
+        bool spaceFor(size_t n, uint64_t generation, bool eos) const {
+            return m_closed || m_generation != generation || (!eos && m_ring.size() - m_fill >= n);
+        }
+
+        /**
+         * @return the waiting coroutine producer's wake up call if it can go on now, called with the lock held
+         */
+        std::function<void()> takeSpaceWaiter() {
+            std::function<void()> wake;
+            if (m_spaceWaiter && spaceFor(m_waitSize, m_waitGeneration, m_waitEos)) wake.swap(m_spaceWaiter);
+            return wake;
+        }
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_spaceAvailable;
+        std::condition_variable m_dataAvailable;
+        std::vector<int16_t> m_ring;
+        size_t m_head;
+        size_t m_fill;
+        bool m_eos;
+        bool m_closed;
+        uint64_t m_generation;
+        uint64_t m_origin;
+        std::function<void()> m_spaceWaiter; //coroutine producer waiting for space, see waitForSpaceAsync()
+        size_t m_waitSize;
+        uint64_t m_waitGeneration;
+        bool m_waitEos;
+    };
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace io {
+
+    /*
+     * Sinks are plain classes without a common base. Each one provides
+     *
+     *     void write(const char *data, size_t len);
+     *     bool close();                              //false if anything went wrong
+     *
+     * and is passed to the mixer loop as a template argument, so the per-chunk write is a direct,
+     * inlinable call. The file writers (UringFileWriter, DirectFileWriter, WavFileWriter, LosslessFileWriter)
+     * follow the same interface.
+     */
+
+    /**
+     * Raw S16LE file through std::ofstream, flushed after every chunk.
+     */
+    class StreamFileWriter {
+    public:
+        bool open(const std::string &path) {
+            m_out.open(path, std::ios::binary | std::ios::trunc);
+            return (bool)m_out;
+        }
+
+        void write(const char *data, size_t len) {
+            m_out.write(data, len);
+            m_out.flush();
+        }
+
+        bool close() {
+            if (!m_out.is_open()) return true;
+            m_out.close();
+            return (bool)m_out;
+        }
+
+    private:
+        std::ofstream m_out;
+    };
+
+    /**
+     * Discards everything, to measure the pipeline without any I/O.
+     */
+    class NullWriter {
+    public:
+        NullWriter() : m_bytes(0) {}
+
+        void write(const char *data, size_t len) {
+            (void)data;
+            m_bytes += len;
+        }
+
+        bool close() { return true; }
+
+        uint64_t bytes() const { return m_bytes; }
+
+    private:
+        uint64_t m_bytes;
+    };
+
+    /**
+     * Raw S16LE to a pipe or stdout, e.g. to feed `aplay -f S16_LE -c 2 -r 48000`.
+     * Written in 64 KiB blocks. A reader that goes away results in an error instead of SIGPIPE.
+     */
+    class PipeWriter {
+    public:
+        static const size_t BufferSize = 64 * 1024;
+
+        PipeWriter() : m_fd(-1), m_error(0) {}
+        ~PipeWriter() { close(); }
+
+        /**
+         * @param fd file descriptor to write to, it is not closed by close()
+         */
+        bool open(int fd = STDOUT_FILENO) {
+            m_fd = fd;
+            m_error = 0;
+            m_buffer.clear();
+            m_buffer.reserve(BufferSize);
+            struct sigaction current;
+            if (sigaction(SIGPIPE, nullptr, &current) == 0 && current.sa_handler == SIG_DFL) {
+                signal(SIGPIPE, SIG_IGN); //get EPIPE instead of being killed
+            }
+            return true;
+        }
+
+        void write(const char *data, size_t len) {
+            m_buffer.insert(m_buffer.end(), data, data + len);
+            if (m_buffer.size() >= BufferSize) flush();
+        }
+
+        bool close() {
+            if (m_fd < 0) return true;
+            flush();
+            m_fd = -1;
+            return m_error == 0;
+        }
+
+    private:
+        void flush() {
+            const char *p = m_buffer.data();
+            size_t len = m_buffer.size();
+            while (len > 0 && !m_error) {
+                ssize_t n = ::write(m_fd, p, len);
+                if (n < 0) {
+                    if (errno != EINTR) m_error = errno;
+                    continue;
+                }
+                if (n == 0) { //no progress, retrying would spin
+                    m_error = EIO;
+                    break;
+                }
+                p += n;
+                len -= n;
+            }
+            m_buffer.clear();
+        }
+
+        int m_fd;
+        std::vector<char> m_buffer;
+        int m_error;
+    };
+
+    /**
+     * Hashes the output instead of storing it, for bit-exact regression runs.
+     * FNV-1a style xor-multiply over 64 bit little endian words plus a fold of the high half, so every
+     * bit affects the whole state. The tail is zero padded and the length mixed in, so the digest only
+     * depends on the byte stream and not on how it was split into writes.
+     */
+    class ChecksumWriter {
+    public:
+        static const uint64_t Basis = 0xcbf29ce484222325ull;
+        static const uint64_t Prime = 0x100000001b3ull;
+
+        ChecksumWriter() : m_hash(Basis), m_pending(0), m_bytes(0) {}
+
+        void reset() {
+            m_hash = Basis;
+            m_pending = 0;
+            m_bytes = 0;
+        }
+
+        void write(const char *data, size_t len) {
+            m_bytes += len;
+            while (len > 0 && m_pending > 0) { //complete a word left over from the last write
+                m_word[m_pending++] = *data++;
+                len--;
+                if (m_pending == 8) {
+                    mix(m_word);
+                    m_pending = 0;
+                }
+            }
+            if (m_pending > 0) return; //everything went into the partial word
+            for (; len >= 8; len -= 8, data += 8) mix(data);
+            std::memcpy(m_word, data, len);
+            m_pending = len;
+        }
+
+        bool close() {
+            if (m_pending > 0) {
+                std::memset(m_word + m_pending, 0, 8 - m_pending);
+                mix(m_word);
+                m_pending = 0;
+            }
+            return true;
+        }
+
+        /**
+         * @return digest of everything written, valid after close()
+         */
+        uint64_t digest() const { return m_hash ^ m_bytes; }
+
+        uint64_t bytes() const { return m_bytes; }
+
+    private:
+        void mix(const char *p) {
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            m_hash = (m_hash ^ word) * Prime;
+            m_hash ^= m_hash >> 32;
+        }
+
+        uint64_t m_hash;
+        char m_word[8];
+        size_t m_pending;
+        uint64_t m_bytes;
+    };
+}
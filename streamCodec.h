@@ -0,0 +1,385 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace audio {
+
+    /**
+     * Wire formats of the network stream. All of them carry 48kHz mono.
+     */
+    enum class StreamEncoding {
+        Pcm16,   //S16LE, 2 bytes per sample
+        MuLaw,   //G.711 mu-law, 1 byte per sample
+        ALaw,    //G.711 A-law, 1 byte per sample
+        ImaAdpcm //IMA ADPCM in 256 byte blocks of 505 samples, ~4 bits per sample
+    };
+
+    inline const char *name(StreamEncoding e) {
+        switch (e) {
+            case StreamEncoding::Pcm16: return "pcm16";
+            case StreamEncoding::MuLaw: return "mulaw";
+            case StreamEncoding::ALaw: return "alaw";
+            case StreamEncoding::ImaAdpcm: return "adpcm";
+        }
+        return "unknown";
+    }
+
+    namespace codec {
+
+        static const size_t AdpcmBlockBytes = 256;
+        static const size_t AdpcmBlockSamples = 505; //header sample + 2 per payload byte
+
+        /**
+         * @return size in bytes of the smallest independently decodable unit
+         */
+        inline size_t unitBytes(StreamEncoding e) {
+            switch (e) {
+                case StreamEncoding::Pcm16: return 2;
+                case StreamEncoding::ImaAdpcm: return AdpcmBlockBytes;
+                default: return 1;
+            }
+        }
+
+        /**
+         * @return number of samples in the smallest independently decodable unit
+         */
+        inline size_t unitSamples(StreamEncoding e) {
+            return e == StreamEncoding::ImaAdpcm ? AdpcmBlockSamples : 1;
+        }
+
+        /**
+         * @return upper bound of decoded samples for the given amount of encoded bytes
+         */
+        inline size_t maxDecodedSamples(StreamEncoding e, size_t bytes) {
+            return bytes / unitBytes(e) * unitSamples(e);
+        }
+
+        // --- G.711 --------------------------------------------------------------------------------------------
+
+        inline uint8_t muLawEncode(int16_t sample) {
+            const int bias = 0x84, clip = 32635;
+            int pcm = sample;
+            int sign = (pcm >> 8) & 0x80;
+            if (sign) pcm = -pcm;
+            pcm = std::min(pcm, clip) + bias;
+            int exponent = 7;
+            for (int mask = 0x4000; !(pcm & mask) && exponent > 0; mask >>= 1) exponent--;
+            int mantissa = (pcm >> (exponent + 3)) & 0x0F;
+            return (uint8_t)~(sign | (exponent << 4) | mantissa);
+        }
+
+        inline int16_t muLawDecode(uint8_t byte) {
+            int u = ~byte & 0xFF;
+            int t = (((u & 0x0F) << 3) + 0x84) << ((u & 0x70) >> 4);
+            return (int16_t)((u & 0x80) ? (0x84 - t) : (t - 0x84));
+        }
+
+        inline uint8_t aLawEncode(int16_t sample) {
+            static const int segmentEnd[8] = {0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF};
+            int pcm = sample >> 3; //13 bit
+            int mask;
+            if (pcm >= 0) {
+                mask = 0xD5;
+            } else {
+                mask = 0x55;
+                pcm = -pcm - 1;
+            }
+            int segment = 0;
+            while (segment < 8 && pcm > segmentEnd[segment]) segment++;
+            if (segment >= 8) return (uint8_t)(0x7F ^ mask);
+            int value = segment << 4;
+            value |= segment < 2 ? (pcm >> 1) & 0x0F : (pcm >> segment) & 0x0F;
+            return (uint8_t)(value ^ mask);
+        }
+
+        inline int16_t aLawDecode(uint8_t byte) {
+            int a = byte ^ 0x55;
+            int segment = (a & 0x70) >> 4;
+            int t = ((a & 0x0F) << 4) + (segment ? 0x108 : 8);
+            t <<= segment ? segment - 1 : 0;
+            return (int16_t)((a & 0x80) ? t : -t);
+        }
+
+        /**
+         * Table driven G.711 decoder, the tables are built once on first use.
+         */
+        inline const int16_t *g711Table(StreamEncoding e) {
+            struct Tables {
+                int16_t mu[256];
+                int16_t a[256];
+                Tables() {
+                    for (int i = 0; i < 256; ++i) {
+                        mu[i] = muLawDecode((uint8_t)i);
+                        a[i] = aLawDecode((uint8_t)i);
+                    }
+                }
+            };
+            static const Tables tables;
+            return e == StreamEncoding::MuLaw ? tables.mu : tables.a;
+        }
+
+        /**
+         * Decodes G.711 bytes, 8 at a time with AVX2 (the expansion is plain integer arithmetic with variable
+         * shifts, no gathers), the tail through the lookup table.
+         */
+        inline void g711Decode(StreamEncoding e, const uint8_t *in, size_t n, int16_t *out) {
+            size_t i = 0;
+#if defined(__AVX2__)
+            const __m256i m0f = _mm256_set1_epi32(0x0F);
+            const __m256i m07 = _mm256_set1_epi32(0x07);
+            if (e == StreamEncoding::MuLaw) {
+                const __m256i bias = _mm256_set1_epi32(0x84);
+                const __m256i ff = _mm256_set1_epi32(0xFF);
+                for (; i + 8 <= n; i += 8) {
+                    __m256i u = _mm256_xor_si256(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(in + i))), ff);
+                    __m256i exponent = _mm256_and_si256(_mm256_srli_epi32(u, 4), m07);
+                    __m256i t = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(u, m0f), 3), bias);
+                    __m256i v = _mm256_sub_epi32(_mm256_sllv_epi32(t, exponent), bias);
+                    __m256i s = _mm256_srai_epi32(_mm256_slli_epi32(u, 24), 31); //-1 for negative samples
+                    v = _mm256_sub_epi32(_mm256_xor_si256(v, s), s);
+                    _mm_storeu_si128((__m128i*)(out + i),
+                                     _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+                }
+            } else {
+                const __m256i x55 = _mm256_set1_epi32(0x55);
+                const __m256i one = _mm256_set1_epi32(1);
+                const __m256i zero = _mm256_setzero_si256();
+                for (; i + 8 <= n; i += 8) {
+                    __m256i a = _mm256_xor_si256(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(in + i))), x55);
+                    __m256i segment = _mm256_and_si256(_mm256_srli_epi32(a, 4), m07);
+                    __m256i first = _mm256_cmpeq_epi32(segment, zero);
+                    //segment 0: (m << 4) + 8, otherwise ((m << 4) + 0x108) << (segment - 1)
+                    __m256i offset = _mm256_blendv_epi8(_mm256_set1_epi32(0x108), _mm256_set1_epi32(8), first);
+                    __m256i shift = _mm256_andnot_si256(first, _mm256_sub_epi32(segment, one));
+                    __m256i t = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(a, m0f), 4), offset);
+                    __m256i v = _mm256_sllv_epi32(t, shift);
+                    __m256i s = _mm256_xor_si256(_mm256_srai_epi32(_mm256_slli_epi32(a, 24), 31), _mm256_set1_epi32(-1));
+                    v = _mm256_sub_epi32(_mm256_xor_si256(v, s), s); //sign bit clear means negative
+                    _mm_storeu_si128((__m128i*)(out + i),
+                                     _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+                }
+            }
+#endif
+            const int16_t *table = g711Table(e);
+            for (; i < n; ++i) out[i] = table[in[i]];
+        }
+
+        // --- IMA ADPCM ----------------------------------------------------------------------------------------
+
+        static const int8_t AdpcmIndexTable[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+        //padded by one entry, so a 32-bit gather of the last one stays inside the table
+        static const int16_t AdpcmStepTable[90] = {
+            7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88,
+            97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+            724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660,
+            4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818,
+            18500, 20350, 22385, 24623, 27086, 29794, 32767, 0};
+
+        /**
+         * Decoder step shared by encoder and decoder so both track the same predictor.
+         */
+        inline void adpcmStep(int nibble, int &predictor, int &index) {
+            int step = AdpcmStepTable[index];
+            int diff = step >> 3;
+            if (nibble & 4) diff += step;
+            if (nibble & 2) diff += step >> 1;
+            if (nibble & 1) diff += step >> 2;
+            predictor += (nibble & 8) ? -diff : diff;
+            predictor = std::max(-32768, std::min(32767, predictor));
+            index = std::max(0, std::min(88, index + AdpcmIndexTable[nibble]));
+        }
+
+        inline int adpcmEncodeSample(int sample, int &predictor, int &index) {
+            int step = AdpcmStepTable[index];
+            int diff = sample - predictor;
+            int nibble = 0;
+            if (diff < 0) {
+                nibble = 8;
+                diff = -diff;
+            }
+            if (diff >= step) { nibble |= 4; diff -= step; }
+            step >>= 1;
+            if (diff >= step) { nibble |= 2; diff -= step; }
+            step >>= 1;
+            if (diff >= step) nibble |= 1;
+            adpcmStep(nibble, predictor, index);
+            return nibble;
+        }
+
+        /**
+         * Encodes mono S16 into IMA ADPCM blocks (WAV layout: int16 predictor, uint8 step index, pad byte,
+         * then two samples per byte, low nibble first). The last block is padded with its final sample.
+         */
+        inline void adpcmEncode(const int16_t *pcm, size_t n, std::vector<uint8_t> &out) {
+            int index = 0;
+            for (size_t start = 0; start < n; start += AdpcmBlockSamples) {
+                size_t count = std::min(AdpcmBlockSamples, n - start);
+                int predictor = pcm[start];
+                uint8_t block[AdpcmBlockBytes];
+                block[0] = (uint8_t)predictor;
+                block[1] = (uint8_t)(predictor >> 8);
+                block[2] = (uint8_t)index;
+                block[3] = 0;
+                for (size_t k = 1; k < AdpcmBlockSamples; k += 2) {
+                    int s0 = pcm[start + std::min(k, count - 1)];
+                    int s1 = pcm[start + std::min(k + 1, count - 1)];
+                    int lo = adpcmEncodeSample(s0, predictor, index);
+                    int hi = adpcmEncodeSample(s1, predictor, index);
+                    block[4 + (k - 1) / 2] = (uint8_t)(lo | (hi << 4));
+                }
+                out.insert(out.end(), block, block + AdpcmBlockBytes);
+            }
+        }
+
+#if defined(__AVX2__)
+        /**
+         * Decodes 8 IMA ADPCM blocks at once, one per 32-bit lane. The predictor recurrence is serial within a
+         * block, but the blocks are independent, so the lanes take the steps of adpcmStep() side by side. Each
+         * round reads 4 bytes per block and transposes the 8 resulting samples of every lane back into its block.
+         */
+        inline void adpcmDecode8(const uint8_t *in, int16_t *out) {
+            const __m256i blocks = _mm256_setr_epi32(0, 256, 512, 768, 1024, 1280, 1536, 1792);
+            const __m256i indexSteps = _mm256_setr_epi32(-1, -1, -1, -1, 2, 4, 6, 8); //AdpcmIndexTable, sign bit dropped
+            const __m256i one = _mm256_set1_epi32(1), two = _mm256_set1_epi32(2);
+            const __m256i four = _mm256_set1_epi32(4), eight = _mm256_set1_epi32(8);
+            const __m256i m0f = _mm256_set1_epi32(0x0F), low16 = _mm256_set1_epi32(0xFFFF);
+            const __m256i minSample = _mm256_set1_epi32(-32768), maxSample = _mm256_set1_epi32(32767);
+            const __m256i zero = _mm256_setzero_si256(), maxIndex = _mm256_set1_epi32(88);
+
+            __m256i header = _mm256_i32gather_epi32((const int*)in, blocks, 1);
+            __m256i predictor = _mm256_srai_epi32(_mm256_slli_epi32(header, 16), 16);
+            __m256i index = _mm256_min_epi32(_mm256_and_si256(_mm256_srli_epi32(header, 16), _mm256_set1_epi32(0xFF)), maxIndex);
+            alignas(32) int32_t first[8];
+            _mm256_store_si256((__m256i*)first, predictor);
+            for (size_t j = 0; j < 8; ++j) out[j * AdpcmBlockSamples] = (int16_t)first[j];
+
+            for (size_t k = 4; k < AdpcmBlockBytes; k += 4) {
+                __m256i nibbles = _mm256_i32gather_epi32((const int*)(in + k), blocks, 1);
+                __m256i r[8];
+                for (size_t s = 0; s < 8; ++s) {
+                    __m256i n = _mm256_and_si256(nibbles, m0f);
+                    nibbles = _mm256_srli_epi32(nibbles, 4);
+                    __m256i step = _mm256_and_si256(_mm256_i32gather_epi32((const int*)AdpcmStepTable, index, 2), low16);
+                    __m256i diff = _mm256_srli_epi32(step, 3);
+                    diff = _mm256_add_epi32(diff, _mm256_and_si256(step, _mm256_cmpeq_epi32(_mm256_and_si256(n, four), four)));
+                    diff = _mm256_add_epi32(diff, _mm256_and_si256(_mm256_srli_epi32(step, 1), _mm256_cmpeq_epi32(_mm256_and_si256(n, two), two)));
+                    diff = _mm256_add_epi32(diff, _mm256_and_si256(_mm256_srli_epi32(step, 2), _mm256_cmpeq_epi32(_mm256_and_si256(n, one), one)));
+                    __m256i sign = _mm256_cmpeq_epi32(_mm256_and_si256(n, eight), eight);
+                    predictor = _mm256_add_epi32(predictor, _mm256_sub_epi32(_mm256_xor_si256(diff, sign), sign));
+                    predictor = _mm256_min_epi32(_mm256_max_epi32(predictor, minSample), maxSample);
+                    index = _mm256_add_epi32(index, _mm256_permutevar8x32_epi32(indexSteps, n)); //uses the low 3 bits
+                    index = _mm256_min_epi32(_mm256_max_epi32(index, zero), maxIndex);
+                    r[s] = predictor;
+                }
+
+                //8x8 transpose: r[s] holds sample s of every block, c[j] all samples of block j
+                __m256i t[8], u[8], c[8];
+                for (size_t i = 0; i < 8; i += 2) {
+                    t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+                    t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+                }
+                for (size_t i = 0; i < 8; i += 4) {
+                    u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+                    u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+                    u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+                    u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+                }
+                for (size_t i = 0; i < 4; ++i) {
+                    c[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+                    c[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+                }
+                for (size_t j = 0; j < 8; ++j) {
+                    _mm_storeu_si128((__m128i*)(out + j * AdpcmBlockSamples + 1 + 2 * (k - 4)),
+                                     _mm_packs_epi32(_mm256_castsi256_si128(c[j]), _mm256_extracti128_si256(c[j], 1)));
+                }
+            }
+        }
+#endif
+
+        /**
+         * Decodes whole IMA ADPCM blocks. Every block carries its own predictor state, with AVX2 8 of them are
+         * decoded at once (see adpcmDecode8()), the rest one by one.
+         *
+         * @return number of samples written
+         */
+        inline size_t adpcmDecode(const uint8_t *in, size_t bytes, int16_t *out) {
+            size_t written = 0;
+            size_t b = 0;
+#if defined(__AVX2__)
+            for (; b + 8 * AdpcmBlockBytes <= bytes; b += 8 * AdpcmBlockBytes) {
+                adpcmDecode8(in + b, out + written);
+                written += 8 * AdpcmBlockSamples;
+            }
+#endif
+            for (; b + AdpcmBlockBytes <= bytes; b += AdpcmBlockBytes) {
+                const uint8_t *block = in + b;
+                int predictor = (int16_t)(block[0] | block[1] << 8);
+                int index = std::min<int>(block[2], 88);
+                out[written++] = (int16_t)predictor;
+                for (size_t k = 4; k < AdpcmBlockBytes; ++k) {
+                    adpcmStep(block[k] & 0x0F, predictor, index);
+                    out[written++] = (int16_t)predictor;
+                    adpcmStep(block[k] >> 4, predictor, index);
+                    out[written++] = (int16_t)predictor;
+                }
+            }
+            return written;
+        }
+
+        // --- dispatch -----------------------------------------------------------------------------------------
+
+        /**
+         * Encodes a mono S16 stream into the given wire format.
+         */
+        inline void encode(StreamEncoding e, const int16_t *pcm, size_t n, std::vector<uint8_t> &out) {
+            out.clear();
+            switch (e) {
+                case StreamEncoding::Pcm16:
+                    out.resize(n * sizeof(int16_t));
+                    std::memcpy(out.data(), pcm, out.size());
+                    break;
+                case StreamEncoding::MuLaw:
+                    out.resize(n);
+                    for (size_t i = 0; i < n; ++i) out[i] = muLawEncode(pcm[i]);
+                    break;
+                case StreamEncoding::ALaw:
+                    out.resize(n);
+                    for (size_t i = 0; i < n; ++i) out[i] = aLawEncode(pcm[i]);
+                    break;
+                case StreamEncoding::ImaAdpcm:
+                    adpcmEncode(pcm, n, out);
+                    break;
+            }
+        }
+
+        /**
+         * Decodes whole units of a wire format into mono S16.
+         *
+         * @param out destination, must hold maxDecodedSamples(e, bytes) samples
+         * @return number of samples written
+         */
+        inline size_t decode(StreamEncoding e, const uint8_t *in, size_t bytes, int16_t *out) {
+            switch (e) {
+                case StreamEncoding::Pcm16:
+                    std::memcpy(out, in, bytes / sizeof(int16_t) * sizeof(int16_t));
+                    return bytes / sizeof(int16_t);
+                case StreamEncoding::MuLaw:
+                case StreamEncoding::ALaw:
+                    g711Decode(e, in, bytes, out);
+                    return bytes;
+                case StreamEncoding::ImaAdpcm:
+                    return adpcmDecode(in, bytes, out);
+            }
+            return 0;
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#include "../directWriter.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+    std::vector<char> pattern(size_t n) {
+        std::vector<char> data(n);
+        for (size_t i = 0; i < n; ++i) data[i] = (char)(i * 131 + (i >> 12));
+        return data;
+    }
+
+    std::vector<char> readFile(const std::string &path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+}
+
+class DirectWriter : public ::testing::TestWithParam<const char *> {};
+
+//the tail is padded to a block for the write and trimmed again, so every length comes back exactly
+TEST_P(DirectWriter, WritesExactLength) {
+    for (size_t n : {size_t(0), size_t(1), size_t(4095), size_t(4096), size_t(4097),
+                     io::DirectFileWriter::BufferSize + 123, 3 * io::DirectFileWriter::BufferSize}) {
+        std::string path = std::string(GetParam()) + "/directWriterTest." + std::to_string(getpid());
+        std::vector<char> data = pattern(n);
+        io::DirectFileWriter writer;
+        ASSERT_TRUE(writer.open(path)) << path;
+        for (size_t i = 0; i < n; i += 1000) writer.write(data.data() + i, std::min<size_t>(1000, n - i));
+        EXPECT_TRUE(writer.close());
+        EXPECT_EQ(readFile(path), data) << n << " bytes in " << GetParam();
+        std::remove(path.c_str());
+    }
+}
+
+TEST(DirectWriter, ReportsOpenError) {
+    io::DirectFileWriter writer;
+    EXPECT_FALSE(writer.open("/nonexistent/directWriterTest"));
+    EXPECT_TRUE(writer.close());
+}
+
+//tmpfs rejects O_DIRECT, the build directory usually takes it
+INSTANTIATE_TEST_SUITE_P(Filesystems, DirectWriter, ::testing::Values("/dev/shm", "."),
+                         [](const ::testing::TestParamInfo<const char *> &info) { return info.index ? "WorkingDir" : "Tmpfs"; });
@@ -0,0 +1,69 @@
+#include "../driftResampler.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <vector>
+
+namespace {
+
+    const size_t Chunk = 72;      //the mixer's chunk
+    const size_t Read = 2048;     //a network read
+    const double Rate = 48000;
+}
+
+//the last Taps / 2 samples only come out once the end of the input is known
+TEST(DriftResampler, FinishFlushesTail) {
+    for (double ratio : {1.0, 1.0015, 0.9985}) {
+        audio::DriftResampler resampler;
+        std::vector<int16_t> in(10000, 1000), out(Chunk);
+        size_t pushed = 0, produced = 0;
+        int16_t last = 0;
+        while (true) {
+            size_t need = std::min(resampler.inputNeeded(Chunk, ratio), in.size() - pushed);
+            resampler.push(in.data() + pushed, need);
+            pushed += need;
+            if (pushed == in.size()) resampler.finish();
+            size_t n = resampler.process(out.data(), Chunk, ratio);
+            if (n == 0) break;
+            if (produced < 5000) last = out[n - 1];
+            produced += n;
+        }
+        EXPECT_NEAR((double)produced, in.size() / ratio, 1.0) << ratio;
+        EXPECT_NEAR(last, 1000, 1) << ratio; //unity DC gain
+    }
+}
+
+/**
+ * A live source on a remote clock fills the buffer in whole reads at its own rate while the mixer takes what
+ * the resampler needs at the local rate. The fill has to stay around the target for as long as it runs.
+ */
+TEST(DriftEstimator, HoldsFillAtTarget) {
+    for (double skew : {-500.0, 0.0, 300.0}) {
+        const double target = 12000; //250 ms
+        audio::DriftEstimator estimator;
+        estimator.reset(target);
+        audio::DriftResampler resampler;
+        std::vector<int16_t> input(Read * 4), output(Chunk);
+
+        double fill = target, produced = 0; //remote samples produced, but not yet delivered as a whole read
+        const double dt = Chunk / Rate;
+        double worst = 0;
+        const size_t chunks = (size_t)(900 / dt); //15 minutes
+        for (size_t c = 0; c < chunks; ++c) {
+            produced += Chunk * (1 + skew * 1e-6);
+            while (produced >= Read) {
+                fill += Read;
+                produced -= Read;
+            }
+            double ratio = estimator.update(fill, dt);
+            size_t need = std::min(resampler.inputNeeded(Chunk, ratio), (size_t)fill);
+            resampler.push(input.data(), need);
+            fill -= need;
+            ASSERT_EQ(resampler.process(output.data(), Chunk, ratio), Chunk) << "underrun at " << skew << " ppm";
+            if (c * dt > 300) worst = std::max(worst, std::fabs(fill - target)); //settled after 5 minutes
+        }
+        EXPECT_LT(worst, (double)Read) << skew << " ppm"; //uncompensated, 300 ppm drift 13000 samples away
+        EXPECT_NEAR(estimator.drift(), skew, 20) << skew << " ppm";
+    }
+}
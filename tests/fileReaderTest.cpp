@@ -0,0 +1,86 @@
+#include "../fileReader.h"
+#include "../uring.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+
+    /**
+     * Temporary S16 file with a ramp that differs from sample to sample, deleted with the object.
+     */
+    struct TempFile {
+        std::string path;
+        std::vector<int16_t> samples;
+
+        explicit TempFile(size_t n) : samples(n) {
+            char name[] = "/tmp/fileReaderTest.XXXXXX";
+            int fd = mkstemp(name);
+            path = name;
+            for (size_t i = 0; i < n; ++i) samples[i] = (int16_t)(i * 7919);
+            FILE *out = fdopen(fd, "wb");
+            std::fwrite(samples.data(), sizeof(int16_t), n, out);
+            std::fclose(out);
+        }
+        ~TempFile() { std::remove(path.c_str()); }
+    };
+
+    std::vector<int16_t> readAll(io::StreamingFileReader &reader, size_t block) {
+        std::vector<int16_t> out, buffer(block);
+        size_t n;
+        while ((n = reader.read(buffer.data(), block)) > 0) out.insert(out.end(), buffer.begin(), buffer.begin() + n);
+        return out;
+    }
+
+    //larger than the ring of read-ahead buffers, and not a multiple of a buffer
+    const size_t FileSamples = io::StreamingFileReader::BufferCount * io::StreamingFileReader::BufferSize + 12345;
+}
+
+class FileReader : public ::testing::TestWithParam<bool> {};
+
+TEST_P(FileReader, ReadsWholeFile) {
+    TempFile file(FileSamples);
+    io::StreamingFileReader reader;
+    ASSERT_TRUE(reader.open(file.path, GetParam()));
+    EXPECT_EQ(reader.length(), FileSamples);
+    EXPECT_EQ(readAll(reader, 8192), file.samples);
+    EXPECT_EQ(reader.error(), 0);
+}
+
+TEST_P(FileReader, SeeksToSample) {
+    TempFile file(FileSamples);
+    io::StreamingFileReader reader;
+    ASSERT_TRUE(reader.open(file.path, GetParam()));
+    std::vector<int16_t> head(1000);
+    ASSERT_EQ(reader.read(head.data(), head.size()), head.size());
+
+    const size_t target = 1234567;
+    reader.seek(target);
+    EXPECT_EQ(readAll(reader, 72), std::vector<int16_t>(file.samples.begin() + target, file.samples.end()));
+
+    reader.seek(FileSamples + 10); //past the end reads as end of file
+    EXPECT_EQ(reader.read(head.data(), head.size()), 0u);
+}
+
+INSTANTIATE_TEST_SUITE_P(PreadAndUring, FileReader, ::testing::Bool(),
+                         [](const ::testing::TestParamInfo<bool> &info) { return info.param ? "Uring" : "Pread"; });
+
+TEST(Uring, ReadReportsBytes) {
+    std::shared_ptr<io::Uring> ring = io::Uring::forThisThread();
+    if (!ring) GTEST_SKIP() << "no io_uring in this kernel";
+    TempFile file(100000);
+    FILE *in = std::fopen(file.path.c_str(), "rb");
+    std::vector<int16_t> out(file.samples.size() + 100, 0);
+    io::UringOwner owner;
+    ring->read(&owner, fileno(in), out.data(), out.size() * sizeof(int16_t), 0); //asks for more than there is
+    ring->wait(&owner);
+    std::fclose(in);
+    EXPECT_EQ(owner.error, 0);
+    EXPECT_EQ(owner.bytes, file.samples.size() * sizeof(int16_t));
+    out.resize(file.samples.size());
+    EXPECT_EQ(out, file.samples);
+}
@@ -0,0 +1,111 @@
+#include "../impairment.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+namespace {
+
+    const microseconds Transfer(5000);
+
+    /**
+     * Delays of reads issued back to back, each when the last one finished.
+     */
+    std::vector<int64_t> delays(net::ImpairmentModel &model, size_t reads) {
+        std::vector<int64_t> out;
+        microseconds now(0);
+        for (size_t i = 0; i < reads; ++i) {
+            microseconds extra = model.delay(now, Transfer);
+            out.push_back(extra.count());
+            now += Transfer + extra;
+        }
+        return out;
+    }
+
+    net::ImpairmentConfig impaired(uint64_t seed) {
+        net::ImpairmentConfig config;
+        config.latencyMean = microseconds(20000);
+        config.latencyJitter = microseconds(8000);
+        config.stallEnterProbability = 0.02;
+        config.stallExitProbability = 0.25;
+        config.stallDuration = milliseconds(100);
+        config.hiccupPeriod = milliseconds(3000);
+        config.hiccupDuration = milliseconds(200);
+        config.seed = seed;
+        return config;
+    }
+}
+
+TEST(Impairment, OffByDefault) {
+    net::ImpairmentModel model;
+    EXPECT_FALSE(model.enabled());
+    for (int64_t d : delays(model, 100)) ASSERT_EQ(d, 0);
+}
+
+//a seed reproduces a run exactly, reconfiguring starts it over
+TEST(Impairment, DeterministicForSeed) {
+    net::ImpairmentModel a, b, other;
+    a.configure(impaired(7));
+    b.configure(impaired(7));
+    other.configure(impaired(8));
+    std::vector<int64_t> run = delays(a, 2000);
+    EXPECT_EQ(delays(b, 2000), run);
+    EXPECT_NE(delays(other, 2000), run);
+    a.configure(impaired(7));
+    EXPECT_EQ(delays(a, 2000), run);
+}
+
+TEST(Impairment, LatencyHasRequestedMoments) {
+    net::ImpairmentConfig config;
+    config.latencyMean = microseconds(20000);
+    config.latencyJitter = microseconds(8000);
+    net::ImpairmentModel model;
+    model.configure(config);
+    std::vector<int64_t> run = delays(model, 50000);
+    double sum = 0, squares = 0;
+    for (int64_t d : run) {
+        ASSERT_GT(d, 0);
+        sum += (double)d;
+        squares += (double)d * (double)d;
+    }
+    double mean = sum / (double)run.size();
+    EXPECT_NEAR(mean, 20000, 400);
+    EXPECT_NEAR(std::sqrt(squares / (double)run.size() - mean * mean), 8000, 400);
+}
+
+//stalls come in bursts: the bad state is entered rarely and left after 1 / exit reads on average
+TEST(Impairment, StallsComeInBursts) {
+    net::ImpairmentConfig config;
+    config.stallEnterProbability = 0.02;
+    config.stallExitProbability = 0.25;
+    config.stallDuration = milliseconds(100);
+    net::ImpairmentModel model;
+    model.configure(config);
+    std::vector<int64_t> run = delays(model, 200000);
+    size_t stalled = 0, bursts = 0;
+    for (size_t i = 0; i < run.size(); ++i) {
+        ASSERT_TRUE(run[i] == 0 || run[i] == 100000) << i;
+        if (run[i] == 0) continue;
+        stalled++;
+        if (i == 0 || run[i - 1] == 0) bursts++;
+    }
+    EXPECT_NEAR((double)stalled / (double)run.size(), 0.02 / (0.02 + 0.25), 0.01);
+    EXPECT_NEAR((double)stalled / (double)bursts, 1 / 0.25, 0.2);
+}
+
+//a read issued during a hiccup waits for its end, a read running into one is held up by all of it
+TEST(Impairment, HiccupsHoldReads) {
+    net::ImpairmentConfig config;
+    config.hiccupPeriod = milliseconds(3000);
+    config.hiccupDuration = milliseconds(200);
+    net::ImpairmentModel model;
+    model.configure(config);
+    EXPECT_EQ(model.delay(milliseconds(3050), Transfer), milliseconds(150));
+    EXPECT_EQ(model.delay(milliseconds(5998), Transfer), milliseconds(200));
+    EXPECT_EQ(model.delay(milliseconds(4000), Transfer), microseconds(0));
+}
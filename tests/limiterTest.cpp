@@ -0,0 +1,142 @@
+#include "../limiter.h"
+#include "../mixBus.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+    const float Ceiling = 16383.0f;
+    const float Limit = Ceiling * 1.000001f; //the gain ceiling / peak is rounded
+
+    /**
+     * Runs a signal through the limiter in chunks, keeping the held samples in front of the next chunk
+     * the way MixBus does, and drains it at the end.
+     */
+    std::vector<float> limit(audio::Limiter &limiter, const std::vector<float> &in, size_t chunk) {
+        std::vector<float> line, out;
+        for (size_t i = 0; i < in.size(); i += chunk) {
+            size_t n = std::min(chunk, in.size() - i);
+            line.insert(line.end(), in.begin() + i, in.begin() + i + n);
+            size_t exited = limiter.process(line.data(), n);
+            out.insert(out.end(), line.begin(), line.begin() + exited);
+            line.erase(line.begin(), line.begin() + exited);
+        }
+        line.resize(line.size() + audio::Limiter::DrainSamples);
+        size_t drained = limiter.drain(line.data());
+        out.insert(out.end(), line.begin(), line.begin() + drained);
+        return out;
+    }
+
+    std::vector<float> tone(size_t n, float amplitude) {
+        std::vector<float> x(n);
+        for (size_t i = 0; i < n; ++i) x[i] = amplitude * std::sin(0.05f * (float)i);
+        return x;
+    }
+
+    float peak(const std::vector<float> &x) {
+        float p = 0;
+        for (float v : x) p = std::max(p, std::fabs(v));
+        return p;
+    }
+
+    /**
+     * Mixes chunks of one source through a MixBus, and drains it unless told not to.
+     */
+    std::vector<int16_t> mixLimited(audio::MixBus &bus, const std::vector<int16_t> &src, size_t chunk, bool drain = true) {
+        audio::LevelMeter source, master;
+        std::vector<int16_t> out, mix(2 * bus.capacity());
+        for (size_t i = 0; i < src.size(); i += chunk) {
+            bus.begin();
+            bus.add(src.data() + i, std::min(chunk, src.size() - i), 1.0f, source);
+            size_t n = bus.render(mix.data(), master);
+            out.insert(out.end(), mix.begin(), mix.begin() + n);
+        }
+        while (drain && bus.drain()) {
+            size_t n = bus.render(mix.data(), master);
+            out.insert(out.end(), mix.begin(), mix.begin() + n);
+        }
+        return out;
+    }
+}
+
+TEST(Limiter, HoldsCeilingForPeakAtStart) {
+    for (size_t chunk : {1, 8, 64, 72, 128, 1000}) {
+        audio::Limiter limiter;
+        limiter.configure(Ceiling, 4800);
+        std::vector<float> in = tone(4800, 8000.0f);
+        in[0] = 40000.0f;
+        std::vector<float> out = limit(limiter, in, chunk);
+        ASSERT_EQ(out.size(), in.size()) << "chunk " << chunk;
+        EXPECT_LE(peak(out), Limit) << "chunk " << chunk;
+    }
+}
+
+TEST(Limiter, HoldsCeilingForPeakAfterReset) {
+    audio::Limiter limiter;
+    limiter.configure(Ceiling, 4800);
+    std::vector<float> in = tone(4800, 30000.0f);
+    std::vector<float> line(in.begin(), in.begin() + 1000);
+    limiter.process(line.data(), line.size()); //leaves the gain down, then a seek drops it
+    limiter.reset();
+
+    in[0] = -40000.0f;
+    EXPECT_LE(peak(limit(limiter, in, 72)), Limit);
+}
+
+TEST(Limiter, HoldsCeilingInTheMiddle) {
+    audio::Limiter limiter;
+    limiter.configure(Ceiling, 4800);
+    std::vector<float> in = tone(9600, 8000.0f);
+    in[3001] = 40000.0f;
+    in[3002] = -35000.0f;
+    std::vector<float> out = limit(limiter, in, 72);
+    EXPECT_LE(peak(out), Limit);
+    EXPECT_GT(peak(out), Ceiling * 0.99f); //limited, not squashed
+}
+
+TEST(Limiter, TransparentBelowCeiling) {
+    audio::Limiter limiter;
+    limiter.configure(Ceiling, 4800);
+    std::vector<float> in = tone(4800, 12000.0f);
+    EXPECT_EQ(limit(limiter, in, 72), in);
+}
+
+TEST(Limiter, OutputIndependentOfChunkSize) {
+    std::vector<float> in = tone(9600, 30000.0f);
+    audio::Limiter reference;
+    reference.configure(Ceiling, 4800);
+    std::vector<float> expected = limit(reference, in, 72);
+    for (size_t chunk : {1, 5, 61, 1000}) {
+        audio::Limiter limiter;
+        limiter.configure(Ceiling, 4800);
+        EXPECT_EQ(limit(limiter, in, chunk), expected) << "chunk " << chunk;
+    }
+}
+
+TEST(Limiter, MixBusHoldsCeilingAtStartAndAfterSeek) {
+    const size_t Chunk = 72;
+    audio::MixBus bus;
+    bus.resize(Chunk);
+    bus.setLimiter(true, 0.5f * 32767, 4800);
+
+    std::vector<int16_t> src(4800);
+    for (size_t i = 0; i < src.size(); ++i) src[i] = (int16_t)(8000 * std::sin(0.05 * (double)i));
+    src[0] = 32767;
+
+    for (bool seek : {false, true}) {
+        if (seek) { //stop halfway through a loud passage, as applySeek() does
+            std::vector<int16_t> loud(src.size() / 2, -30000);
+            mixLimited(bus, loud, Chunk, false);
+            bus.reset();
+        }
+        std::vector<int16_t> out = mixLimited(bus, src, Chunk);
+        ASSERT_EQ(out.size(), 2 * src.size());
+        int largest = 0;
+        for (int16_t s : out) largest = std::max(largest, std::abs((int)s));
+        EXPECT_LE(largest, 16384) << (seek ? "after seek" : "at start");
+    }
+}
@@ -0,0 +1,168 @@
+#include "../losslessCodec.h"
+#include "../losslessWriter.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+    /**
+     * Interleaved test signal of the given kind: random, sine, full scale square or silence.
+     */
+    std::vector<int16_t> signal(int kind, size_t frames, unsigned channels, std::mt19937 &gen) {
+        std::vector<int16_t> x(frames * channels);
+        std::uniform_int_distribution<int> any(-32768, 32767);
+        for (size_t i = 0; i < frames; ++i) {
+            for (unsigned c = 0; c < channels; ++c) {
+                int16_t &v = x[i * channels + c];
+                switch (kind) {
+                    case 0: v = (int16_t)any(gen); break;
+                    case 1: v = (int16_t)(12000 * std::sin(0.01 * (double)i * (c + 1))); break;
+                    case 2: v = (i / 7) & 1 ? 32767 : -32768; break;
+                    default: v = 0; break;
+                }
+            }
+        }
+        return x;
+    }
+
+    std::vector<uint8_t> encode(const std::vector<int16_t> &x, unsigned channels) {
+        std::vector<uint8_t> out;
+        audio::lossless::encodeHeader(out, 48000, (uint8_t)channels);
+        audio::lossless::Encoder encoder;
+        size_t frames = x.size() / channels;
+        for (size_t f = 0; f < frames; f += audio::lossless::BlockFrames) {
+            size_t n = std::min(audio::lossless::BlockFrames, frames - f);
+            encoder.encodeBlock(x.data() + f * channels, n, channels, out);
+        }
+        return out;
+    }
+}
+
+TEST(LosslessCodec, RoundTrip) {
+    std::mt19937 gen(7);
+    for (unsigned channels : {1u, 2u}) {
+        for (int block = 0; block < 200; ++block) {
+            int kind = block % 4;
+            size_t frames = 1 + gen() % (2 * audio::lossless::BlockFrames);
+            std::vector<int16_t> x = signal(kind, frames, channels, gen);
+            std::vector<uint8_t> encoded = encode(x, channels);
+
+            std::vector<int16_t> decoded;
+            uint32_t sampleRate = 0;
+            unsigned decodedChannels = 0;
+            ASSERT_TRUE(audio::lossless::decode(encoded.data(), encoded.size(), decoded, &sampleRate, &decodedChannels));
+            EXPECT_EQ(sampleRate, 48000u);
+            EXPECT_EQ(decodedChannels, channels);
+            ASSERT_EQ(decoded, x) << "kind " << kind << ", " << frames << " frames, " << channels << " channels";
+        }
+    }
+}
+
+TEST(LosslessCodec, RejectsTruncatedStream) {
+    std::mt19937 gen(11);
+    std::vector<int16_t> x = signal(1, audio::lossless::BlockFrames + 100, 2, gen);
+    std::vector<uint8_t> encoded = encode(x, 2);
+    std::vector<int16_t> decoded;
+
+    EXPECT_FALSE(audio::lossless::decode(encoded.data(), audio::lossless::HeaderSize - 1, decoded));
+    //a cut within the second block, a cut at a block boundary is a valid, shorter stream
+    for (size_t cut = 1; cut < 64; cut += 7) {
+        EXPECT_FALSE(audio::lossless::decode(encoded.data(), encoded.size() - cut, decoded)) << cut;
+    }
+}
+
+TEST(LosslessCodec, RejectsCorruptStream) {
+    std::mt19937 gen(13);
+    std::vector<int16_t> x = signal(0, 1000, 2, gen);
+    std::vector<uint8_t> encoded = encode(x, 2);
+    std::vector<int16_t> decoded;
+
+    std::vector<uint8_t> bad = encoded;
+    bad[0] = 'X'; //magic
+    EXPECT_FALSE(audio::lossless::decode(bad.data(), bad.size(), decoded));
+    bad = encoded;
+    bad[4] = audio::lossless::Version + 1;
+    EXPECT_FALSE(audio::lossless::decode(bad.data(), bad.size(), decoded));
+    bad = encoded;
+    bad[5] = 0; //channels
+    EXPECT_FALSE(audio::lossless::decode(bad.data(), bad.size(), decoded));
+    bad = encoded;
+    bad[audio::lossless::HeaderSize] = 0xFF; //frame count above BlockFrames
+    EXPECT_FALSE(audio::lossless::decode(bad.data(), bad.size(), decoded));
+    bad = encoded;
+    bad[audio::lossless::HeaderSize + 2] = 0xE0; //channel mode 7
+    EXPECT_FALSE(audio::lossless::decode(bad.data(), bad.size(), decoded));
+
+    //flipped bits can't always be detected, but the decoder must neither crash nor run past its input
+    for (int i = 0; i < 200; ++i) {
+        bad = encoded;
+        bad[audio::lossless::HeaderSize + gen() % (bad.size() - audio::lossless::HeaderSize)] ^= (uint8_t)(1 + gen() % 255);
+        if (audio::lossless::decode(bad.data(), bad.size(), decoded)) EXPECT_LE(decoded.size(), 2 * x.size());
+    }
+}
+
+TEST(LosslessWriter, FileDecodesToInput) {
+    std::mt19937 gen(17);
+    std::vector<int16_t> x = signal(1, 3 * audio::lossless::BlockFrames + 5, 2, gen);
+    std::string path = "/tmp/losslessWriterTest." + std::to_string(getpid()) + ".splc";
+    io::LosslessFileWriter writer;
+    ASSERT_TRUE(writer.open(path, 48000, 2));
+    for (size_t i = 0; i < x.size(); i += 144) {
+        writer.write((const char*)(x.data() + i), std::min<size_t>(144, x.size() - i) * sizeof(int16_t));
+    }
+    ASSERT_TRUE(writer.close());
+
+    std::ifstream in(path, std::ios::binary);
+    std::vector<uint8_t> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::vector<int16_t> decoded;
+    ASSERT_TRUE(audio::lossless::decode(file.data(), file.size(), decoded));
+    EXPECT_EQ(decoded, x);
+    std::remove(path.c_str());
+}
+
+TEST(LosslessWriter, ReportsWriteError) {
+    std::mt19937 gen(19);
+    std::vector<int16_t> x = signal(0, 2 * audio::lossless::BlockFrames, 2, gen);
+    io::LosslessFileWriter writer;
+    writer.open("/dev/full", 48000, 2); //already fails on the header
+    writer.write((const char*)x.data(), x.size() * sizeof(int16_t));
+    EXPECT_FALSE(writer.close());
+}
+
+//the file size limit cuts a block's write short and fails the rest, the writer must stop instead of retrying
+TEST(LosslessWriter, ReportsShortWrite) {
+    std::mt19937 gen(23);
+    std::vector<int16_t> x = signal(0, 4 * audio::lossless::BlockFrames, 2, gen); //noise, barely compresses
+    std::string path = "/tmp/losslessWriterTest." + std::to_string(getpid()) + ".short.splc";
+    pid_t pid = fork(); //the limit applies to the whole process
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+        std::signal(SIGXFSZ, SIG_IGN);
+        alarm(10); //a writer that keeps retrying is killed
+        rlimit limit = {4096, 4096};
+        if (setrlimit(RLIMIT_FSIZE, &limit) != 0) _exit(2);
+        io::LosslessFileWriter writer;
+        bool ok = writer.open(path, 48000, 2);
+        writer.write((const char*)x.data(), x.size() * sizeof(int16_t));
+        ok = writer.close() && ok;
+        _exit(ok ? 0 : 1);
+    }
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    std::remove(path.c_str());
+    ASSERT_TRUE(WIFEXITED(status)) << "the writer didn't stop";
+    EXPECT_EQ(WEXITSTATUS(status), 1);
+}
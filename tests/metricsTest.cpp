@@ -0,0 +1,93 @@
+#include "../metrics.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+    /**
+     * Connects to the exporter, optionally sends a request and reads until the exporter closes.
+     */
+    std::string scrape(const std::string &path, const std::string &request) {
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        path.copy(address.sun_path, sizeof(address.sun_path) - 1);
+        if (::connect(fd, (const sockaddr*)&address, sizeof(address)) != 0) {
+            ::close(fd);
+            return "";
+        }
+        if (!request.empty()) ::send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+        std::string response;
+        char buffer[4096];
+        ssize_t n;
+        while ((n = ::recv(fd, buffer, sizeof(buffer), 0)) > 0) response.append(buffer, n);
+        ::close(fd);
+        return response;
+    }
+}
+
+//every thread adds to its own shard, nothing gets lost in the sum
+TEST(Metrics, CounterSumsShards) {
+    metrics::Counter counter;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 2 * (int)metrics::Shards; ++t) {
+        threads.emplace_back([&counter] {
+            for (int i = 0; i < 100000; ++i) counter.add();
+        });
+    }
+    for (auto &thread : threads) thread.join();
+    EXPECT_EQ(counter.value(), 2 * metrics::Shards * 100000);
+}
+
+TEST(Metrics, RendersPrometheusText) {
+    metrics::Registry registry;
+    registry.counter("player_samples_total", "Samples mixed").add(42);
+    registry.gauge("player_fill", "Network buffer fill").set(0.25);
+    metrics::Histogram &latency = registry.histogram("player_latency_seconds", "Write latency", {0.001, 0.01});
+    latency.observe(0.0005);
+    latency.observe(0.001); //bounds are inclusive
+    latency.observe(0.005);
+    latency.observe(1);
+
+    EXPECT_EQ(registry.render(),
+              "# HELP player_samples_total Samples mixed\n"
+              "# TYPE player_samples_total counter\n"
+              "player_samples_total 42\n"
+              "# HELP player_fill Network buffer fill\n"
+              "# TYPE player_fill gauge\n"
+              "player_fill 0.25\n"
+              "# HELP player_latency_seconds Write latency\n"
+              "# TYPE player_latency_seconds histogram\n"
+              "player_latency_seconds_bucket{le=\"0.001\"} 2\n"
+              "player_latency_seconds_bucket{le=\"0.01\"} 3\n"
+              "player_latency_seconds_bucket{le=\"+Inf\"} 4\n"
+              "player_latency_seconds_sum 1.0065\n"
+              "player_latency_seconds_count 4\n");
+}
+
+//plain readers get the text, HTTP clients a response around it
+TEST(Metrics, ExporterServesSocket) {
+    metrics::Registry registry;
+    registry.counter("player_underruns_total", "Underruns").add(3);
+    std::string path = "/tmp/metricsTest." + std::to_string(getpid()) + ".sock";
+    metrics::Exporter exporter;
+    ASSERT_TRUE(exporter.start(path, registry));
+
+    std::string body = registry.render();
+    EXPECT_EQ(scrape(path, ""), body);
+    std::string http = scrape(path, "GET /metrics HTTP/1.0\r\n\r\n");
+    EXPECT_EQ(http.compare(0, 17, "HTTP/1.0 200 OK\r\n"), 0) << http;
+    EXPECT_NE(http.find("Content-Length: " + std::to_string(body.size()) + "\r\n"), std::string::npos);
+    EXPECT_EQ(http.substr(http.size() - body.size()), body);
+
+    exporter.stop();
+    EXPECT_NE(access(path.c_str(), F_OK), 0); //the socket file is removed
+}
@@ -0,0 +1,275 @@
+#include "../mixBus.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+    /**
+     * Covers the whole int16 range in a scrambled order.
+     */
+    std::vector<int16_t> sweep(size_t n) {
+        std::vector<int16_t> x(n);
+        for (size_t i = 0; i < n; ++i) x[i] = (int16_t)((i * 7919) % 65536 - 32768);
+        return x;
+    }
+
+    int16_t saturate(double v) {
+        return (int16_t)std::lrint(std::max(-32768.0, std::min(32767.0, v)));
+    }
+}
+
+//the sum of the sources saturates at the int16 range instead of wrapping, a shorter source counts as silence
+TEST(MixBus, SumSaturates) {
+    const size_t n = 77; //vector body and scalar tail
+    audio::MixBus bus;
+    bus.resize(80);
+    audio::LevelMeter network, player, master;
+    std::vector<int16_t> a = sweep(n), b(50, 30000), mix(2 * bus.capacity());
+
+    bus.begin();
+    bus.add(a.data(), n, 1.0f, network);
+    bus.add(b.data(), b.size(), 0.75f, player);
+    ASSERT_EQ(bus.render(mix.data(), master), 2 * n);
+    for (size_t i = 0; i < n; ++i) {
+        int16_t expected = saturate(a[i] + (i < b.size() ? 0.75 * b[i] : 0.0)); //exact in float as well
+        ASSERT_EQ(mix[2 * i], expected) << i;
+        ASSERT_EQ(mix[2 * i + 1], expected) << i;
+    }
+}
+
+//a chunk starts over, the next source overwrites what the last chunk mixed
+TEST(MixBus, ChunkStartsSilent) {
+    audio::MixBus bus;
+    bus.resize(75);
+    audio::LevelMeter meter, master;
+    std::vector<int16_t> loud(75, 20000), quiet(75, 100), mix(2 * bus.capacity());
+    bus.begin();
+    bus.add(loud.data(), loud.size(), 1.0f, meter);
+    bus.render(mix.data(), master);
+
+    bus.begin();
+    bus.add(quiet.data(), quiet.size(), 0.5f, meter);
+    ASSERT_EQ(bus.render(mix.data(), master), 2 * quiet.size());
+    for (size_t i = 0; i < 2 * quiet.size(); ++i) ASSERT_EQ(mix[i], 50) << i;
+}
+
+namespace {
+
+    /**
+     * Applies a ramp to a constant source in chunks and returns the gain of every sample.
+     */
+    std::vector<float> rampGains(audio::GainRamp &gain, size_t n, size_t chunk) {
+        std::vector<int16_t> src(chunk, 10000);
+        std::vector<float> bus(chunk), gains;
+        audio::LevelMeter meter;
+        for (size_t i = 0; i < n; i += chunk) {
+            size_t m = std::min(chunk, n - i);
+            gain.apply<false>(bus.data(), src.data(), m, meter);
+            for (size_t k = 0; k < m; ++k) gains.push_back(bus[k] / 10000);
+        }
+        return gains;
+    }
+}
+
+//a linear ramp starts at the old gain, moves in equal steps and lands on the target exactly
+TEST(GainRamp, LinearReachesTarget) {
+    for (size_t chunk : {1, 13, 72, 1000}) {
+        audio::GainRamp gain;
+        gain.reset(0.25f);
+        gain.setTarget(0.75f, 960, audio::RampShape::Linear);
+        std::vector<float> gains = rampGains(gain, 2000, chunk);
+        EXPECT_FLOAT_EQ(gains[0], 0.25f) << "chunk " << chunk;
+        for (size_t i = 0; i < 960; ++i) {
+            ASSERT_NEAR(gains[i], 0.25 + 0.5 * i / 960, 1e-4) << "chunk " << chunk << " sample " << i;
+        }
+        for (size_t i = 960; i < gains.size(); ++i) ASSERT_EQ(gains[i], 0.75f) << "chunk " << chunk;
+        EXPECT_FALSE(gain.ramping());
+    }
+}
+
+TEST(GainRamp, ExponentialSettles) {
+    audio::GainRamp gain;
+    gain.reset(1.0f);
+    gain.setTarget(0.0f, 960, audio::RampShape::Exponential);
+    std::vector<float> gains = rampGains(gain, 961, 72);
+    for (size_t i = 1; i < 960; ++i) ASSERT_LT(gains[i], gains[i - 1]) << i;
+    EXPECT_NEAR(gains[959], 1e-3, 1e-4); //-60 dB after the ramp duration
+    EXPECT_EQ(gains[960], 0.0f);
+}
+
+//a source that delivered nothing still advances its ramp, so it stays in step with the others
+TEST(GainRamp, SkipAdvancesLikeApply) {
+    audio::GainRamp applied, skipped;
+    for (audio::GainRamp *gain : {&applied, &skipped}) {
+        gain->reset(0.0f);
+        gain->setTarget(1.0f, 480, audio::RampShape::Linear);
+    }
+    rampGains(applied, 200, 72);
+    skipped.skip(200);
+    EXPECT_NEAR(skipped.current(), applied.current(), 1e-5);
+    skipped.skip(1000);
+    EXPECT_FALSE(skipped.ramping());
+    EXPECT_EQ(skipped.current(), 1.0f);
+}
+
+//sources are metered after their gain, the master before it saturates, so a peak above 1 shows clipping
+TEST(LevelMeter, MetersSourcesAndMaster) {
+    const size_t chunk = 77;
+    audio::MixBus bus;
+    bus.resize(chunk);
+    audio::LevelMeter network, player, master;
+    std::vector<int16_t> a(chunk), b(chunk, 24000), mix(2 * bus.capacity());
+    double squares = 0, masterSquares = 0;
+    float masterPeak = 0;
+    for (size_t i = 0; i < chunk; ++i) {
+        a[i] = (int16_t)(20000 * std::sin(0.1 * (double)i));
+        squares += 0.5 * a[i] * 0.5 * a[i];
+        double m = 0.5 * a[i] + b[i];
+        masterSquares += m * m;
+        masterPeak = std::max(masterPeak, (float)std::fabs(m));
+    }
+    bus.begin();
+    bus.add(a.data(), chunk, 0.5f, network);
+    bus.add(b.data(), chunk, 1.0f, player);
+    bus.render(mix.data(), master);
+
+    EXPECT_NEAR(network.level().rms, std::sqrt(squares / chunk) / 32768, 1e-6);
+    EXPECT_NEAR(player.level().peak, 24000.0 / 32768, 1e-6);
+    EXPECT_NEAR(player.level().rms, 24000.0 / 32768, 1e-6);
+    EXPECT_NEAR(master.level().peak, masterPeak / 32768, 1e-6);
+    EXPECT_GT(master.level().peak, 1.0f); //clipped
+    EXPECT_NEAR(master.level().rms, std::sqrt(masterSquares / chunk) / 32768, 1e-6);
+}
+
+//the float lanes are folded into a double regularly, so long intervals stay accurate
+TEST(LevelMeter, AccurateOverLongIntervals) {
+    audio::MixBus bus;
+    bus.resize(72);
+    audio::LevelMeter meter, master;
+    std::vector<int16_t> src(72, 16384), mix(2 * bus.capacity());
+    for (int c = 0; c < 48000 * 60 / 72; ++c) { //a minute
+        bus.begin();
+        bus.add(src.data(), src.size(), 1.0f, meter);
+        bus.render(mix.data(), master);
+    }
+    EXPECT_EQ(meter.samples(), 48000u * 60);
+    EXPECT_NEAR(meter.level().rms, 0.5, 1e-5);
+    EXPECT_EQ(meter.level().peak, 0.5f);
+}
+
+//missing samples of a short chunk count as silence
+TEST(LevelMeter, ShortSourceCountsSilence) {
+    audio::MixBus bus;
+    bus.resize(72);
+    audio::GainRamp gain;
+    gain.reset(1.0f);
+    audio::LevelMeter meter, master;
+    std::vector<int16_t> src(36, 16384), mix(2 * bus.capacity());
+    bus.begin();
+    bus.add(src.data(), src.size(), gain, 72, meter);
+    bus.render(mix.data(), master);
+    EXPECT_EQ(meter.samples(), 72u);
+    EXPECT_NEAR(meter.level().rms, 0.5 * std::sqrt(0.5), 1e-6);
+}
+
+namespace {
+
+    /**
+     * Quantizes a float signal in chunks of 72, like the mixer does.
+     *
+     * @return left channel of the output
+     */
+    template <audio::DitherMode Mode>
+    std::vector<int16_t> quantize(const std::vector<float> &in, audio::Dither &dither) {
+        audio::LevelMeter meter;
+        std::vector<int16_t> stereo(2 * 72), out;
+        for (size_t i = 0; i < in.size(); i += 72) {
+            size_t n = std::min<size_t>(72, in.size() - i);
+            audio::storeS16Stereo<false, Mode>(stereo.data(), in.data() + i, n, meter, dither);
+            for (size_t k = 0; k < n; ++k) out.push_back(stereo[2 * k]);
+        }
+        return out;
+    }
+
+    /**
+     * @return mean, variance and lag one autocorrelation of the quantization error
+     */
+    std::vector<double> errorStats(const std::vector<float> &in, const std::vector<int16_t> &out) {
+        double sum = 0, squares = 0, lag = 0;
+        for (size_t i = 0; i < in.size(); ++i) {
+            double e = out[i] - in[i];
+            sum += e;
+            squares += e * e;
+            if (i > 0) lag += e * (out[i - 1] - in[i - 1]);
+        }
+        double n = (double)in.size();
+        double variance = squares / n - (sum / n) * (sum / n);
+        return {sum / n, variance, lag / n / variance};
+    }
+
+    std::vector<float> slowSine(size_t n, float amplitude) {
+        std::vector<float> x(n);
+        for (size_t i = 0; i < n; ++i) x[i] = amplitude * std::sin(0.001f * (float)i) + 0.37f;
+        return x;
+    }
+}
+
+//TPDF dither: unbiased, a flat error of 1/12 + 1/6 LSB^2, within 1.5 LSB of the signal
+TEST(Dither, TpdfErrorIsBoundedAndWhite) {
+    std::vector<float> in = slowSine(480000, 1000);
+    audio::Dither dither;
+    std::vector<int16_t> out = quantize<audio::DitherMode::Tpdf>(in, dither);
+    for (size_t i = 0; i < in.size(); ++i) ASSERT_LT(std::fabs(out[i] - in[i]), 1.5f) << i;
+    std::vector<double> stats = errorStats(in, out);
+    EXPECT_NEAR(stats[0], 0, 0.01);
+    EXPECT_NEAR(stats[1], 0.25, 0.01);
+    EXPECT_NEAR(stats[2], 0, 0.02);
+}
+
+//noise shaping filters the error with (1 - z^-1): its lag one autocorrelation goes to -1/2
+TEST(Dither, ShapedErrorMovesUp) {
+    std::vector<float> in = slowSine(480000, 1000);
+    audio::Dither dither;
+    std::vector<int16_t> out = quantize<audio::DitherMode::Shaped>(in, dither);
+    for (size_t i = 0; i < in.size(); ++i) ASSERT_LT(std::fabs(out[i] - in[i]), 3.0f) << i; //two errors of 1.5
+    std::vector<double> stats = errorStats(in, out);
+    EXPECT_NEAR(stats[0], 0, 0.01);
+    EXPECT_NEAR(stats[2], -0.5, 0.03);
+}
+
+//a signal below one LSB vanishes without dither, with dither it survives in the average
+TEST(Dither, KeepsSignalBelowOneLsb) {
+    std::vector<float> in(480000);
+    for (size_t i = 0; i < in.size(); ++i) in[i] = 0.4f * std::sin(0.01f * (float)i);
+    audio::Dither dither;
+    std::vector<int16_t> plain = quantize<audio::DitherMode::None>(in, dither);
+    std::vector<int16_t> dithered = quantize<audio::DitherMode::Tpdf>(in, dither);
+    double plainGain = 0, ditheredGain = 0, power = 0;
+    for (size_t i = 0; i < in.size(); ++i) {
+        plainGain += plain[i] * in[i];
+        ditheredGain += dithered[i] * in[i];
+        power += in[i] * in[i];
+    }
+    EXPECT_EQ(plainGain, 0);
+    EXPECT_NEAR(ditheredGain / power, 1, 0.02);
+}
+
+//reproducible from reset(), and full scale still saturates instead of wrapping
+TEST(Dither, ReproducibleAndSaturating) {
+    std::vector<float> in(1000, 32767.0f);
+    for (size_t i = 0; i < in.size(); i += 2) in[i] = -32768.0f;
+    for (bool shaped : {false, true}) {
+        audio::Dither dither;
+        std::vector<int16_t> first = shaped ? quantize<audio::DitherMode::Shaped>(in, dither)
+                                            : quantize<audio::DitherMode::Tpdf>(in, dither);
+        dither.reset();
+        std::vector<int16_t> second = shaped ? quantize<audio::DitherMode::Shaped>(in, dither)
+                                             : quantize<audio::DitherMode::Tpdf>(in, dither);
+        EXPECT_EQ(first, second);
+        for (size_t i = 0; i < in.size(); ++i) ASSERT_LE(std::fabs(first[i] - in[i]), 2.0f) << i;
+    }
+}
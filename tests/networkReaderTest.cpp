@@ -0,0 +1,147 @@
+#include "../networkReader.h"
+#include "../parallelFetch.h"
+#include "testSupport.h"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace {
+
+    std::vector<char> readAll(net::NetworkReader &reader) {
+        std::vector<char> out, buffer(16 * 1024);
+        size_t n;
+        while ((n = reader.read(buffer.data(), buffer.size())) > 0) out.insert(out.end(), buffer.begin(), buffer.begin() + n);
+        return out;
+    }
+
+    /**
+     * Reads the whole stream in virtual time.
+     *
+     * @return clock after every read
+     */
+    std::vector<int64_t> readTimes(net::NetworkReader &reader) {
+        reader.setVirtualTime(true);
+        std::vector<int64_t> times;
+        std::vector<char> buffer(16 * 1024);
+        while (reader.read(buffer.data(), buffer.size()) > 0) times.push_back(reader.now().count());
+        return times;
+    }
+
+    std::string readFile(const std::string &path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+}
+
+/**
+ * Runs each test in a scratch directory holding a generated network stream of two seconds.
+ */
+class NetworkReaderTest : public ::testing::Test {
+protected:
+    test::ScratchDirectory dir{"networkReaderTest"};
+
+    void SetUp() override {
+        ASSERT_TRUE(dir.enter());
+        ASSERT_TRUE(test::writeSource(test::NetworkFile, 2 * 48000, 440));
+    }
+
+    void TearDown() override {
+        dir.leave();
+    }
+};
+
+TEST_F(NetworkReaderTest, ConnectionServesSameStream) {
+    for (audio::StreamEncoding encoding : {audio::StreamEncoding::Pcm16, audio::StreamEncoding::ImaAdpcm}) {
+        net::NetworkReader primary(1, false);
+        ASSERT_TRUE(primary.load());
+        primary.setVirtualTime(true);
+        primary.setEncoding(encoding);
+        std::unique_ptr<net::NetworkReader> connection = primary.openConnection(1);
+        EXPECT_EQ(connection->length(), primary.length());
+        EXPECT_EQ(readAll(*connection), readAll(primary)) << audio::name(encoding);
+    }
+}
+
+TEST_F(NetworkReaderTest, ConnectionsShareVirtualClock) {
+    net::NetworkReader primary(1, false);
+    ASSERT_TRUE(primary.load());
+    primary.setVirtualTime(true);
+    std::unique_ptr<net::NetworkReader> connection = primary.openConnection(1);
+    std::vector<char> buffer(32 * 1024);
+
+    connection->read(buffer.data(), buffer.size());
+    auto first = primary.now();
+    EXPECT_GT(first.count(), 0);
+    EXPECT_EQ(connection->now(), first);
+
+    primary.read(buffer.data(), buffer.size()); //starts where the connection's read ended
+    EXPECT_GT(primary.now(), first);
+    EXPECT_EQ(connection->now(), primary.now());
+
+    primary.setVirtualTime(true);
+    EXPECT_EQ(connection->now().count(), 0);
+}
+
+//a saved trace loads back unchanged and replays the same way whatever the reader's seed
+TEST_F(NetworkReaderTest, TraceRoundTrip) {
+    net::NetworkReader recorded(1);
+    ASSERT_TRUE(recorded.saveTrace("recorded.trace"));
+
+    net::NetworkReader replay(2), again(3);
+    ASSERT_TRUE(replay.loadTrace("recorded.trace"));
+    ASSERT_TRUE(again.loadTrace("recorded.trace"));
+    ASSERT_TRUE(replay.saveTrace("replay.trace"));
+    EXPECT_EQ(readFile("replay.trace"), readFile("recorded.trace"));
+    std::vector<int64_t> times = readTimes(replay);
+    EXPECT_FALSE(times.empty());
+    EXPECT_EQ(readTimes(again), times);
+
+    recorded.dumpProfile("recorded.csv", std::chrono::milliseconds(10));
+    net::NetworkReader fromCsv(4);
+    EXPECT_TRUE(fromCsv.loadTrace("recorded.csv"));
+}
+
+TEST_F(NetworkReaderTest, RejectsUnusableTrace) {
+    net::NetworkReader reader(1);
+    EXPECT_FALSE(reader.loadTrace("missing.trace"));
+
+    std::ofstream("unordered.csv") << "millisecond, bytesPerSecond\n0,100000\n200,50000\n100,80000\n";
+    EXPECT_FALSE(reader.loadTrace("unordered.csv"));
+
+    std::ofstream("silent.csv") << "0,0\n100,0\n";
+    EXPECT_FALSE(reader.loadTrace("silent.csv"));
+
+    std::string truncated("NRTR\x01\0\0\0\x05\0\0\0", 12); //five points announced, none there
+    std::ofstream("truncated.trace", std::ios::binary) << truncated;
+    EXPECT_FALSE(reader.loadTrace("truncated.trace"));
+}
+
+class ParallelFetch : public NetworkReaderTest, public ::testing::WithParamInterface<size_t> {};
+
+TEST_P(ParallelFetch, SameBytesAsOneConnection) {
+    for (audio::StreamEncoding encoding : {audio::StreamEncoding::Pcm16, audio::StreamEncoding::ImaAdpcm}) {
+        net::NetworkReader reference(1, false);
+        ASSERT_TRUE(reference.load());
+        reference.setVirtualTime(true);
+        reference.setEncoding(encoding);
+        std::vector<char> expected = readAll(reference);
+
+        net::NetworkReader primary(1, false);
+        ASSERT_TRUE(primary.load());
+        primary.setVirtualTime(true);
+        primary.setEncoding(encoding);
+        net::ParallelFetcher fetcher(primary, 48000);
+        fetcher.start(GetParam(), []{ return 0.0; });
+        std::vector<char> fetched, buffer(4 * 1024);
+        size_t n;
+        while ((n = fetcher.read(buffer.data(), buffer.size())) > 0) fetched.insert(fetched.end(), buffer.begin(), buffer.begin() + n);
+        fetcher.stop();
+        EXPECT_EQ(fetched, expected) << audio::name(encoding) << " over " << GetParam() << " connections";
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Connections, ParallelFetch, ::testing::Values(1, 2, 4, 8));
@@ -0,0 +1,249 @@
+#include "../player.h"
+#include "testSupport.h"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+/**
+ * Runs each test in a scratch directory, the player reads and writes its files in the working directory.
+ */
+class PlayerOpen : public ::testing::Test {
+protected:
+    test::ScratchDirectory dir{"playerTest"};
+    char networkUrl[8] = "network";
+    char filename[5] = "file";
+
+    void SetUp() override {
+        ASSERT_TRUE(dir.enter());
+    }
+
+    void TearDown() override {
+        dir.leave();
+    }
+};
+
+TEST_F(PlayerOpen, OpenTwiceWithoutClose) {
+    ASSERT_TRUE(test::writeSource(test::NetworkFile, SAMPLE_RATE, 440));
+    ASSERT_TRUE(test::writeSource(test::PlayerFile, SAMPLE_RATE, 660));
+    Player player;
+    player.setOutputMode(OutputMode::Null);
+    player.open(networkUrl, filename);
+    std::shared_future<void> ready = player.open(networkUrl, filename); //closes the first session
+    EXPECT_NO_THROW(ready.get());
+    player.close();
+}
+
+TEST_F(PlayerOpen, MissingInputFileFailsReady) {
+    ASSERT_TRUE(test::writeSource(test::NetworkFile, SAMPLE_RATE, 440));
+    Player player;
+    player.setOutputMode(OutputMode::Null);
+    std::shared_future<void> ready = player.open(networkUrl, filename);
+    EXPECT_THROW(ready.get(), std::runtime_error);
+    player.close();
+}
+
+TEST_F(PlayerOpen, MissingNetworkStreamFailsReady) {
+    ASSERT_TRUE(test::writeSource(test::PlayerFile, SAMPLE_RATE, 660));
+    Player player;
+    player.setOutputMode(OutputMode::Null);
+    std::shared_future<void> ready = player.open(networkUrl, filename);
+    EXPECT_THROW(ready.get(), std::runtime_error);
+
+    ASSERT_TRUE(test::writeSource(test::NetworkFile, SAMPLE_RATE, 440)); //a failed open leaves the player reusable
+    ready = player.open(networkUrl, filename);
+    EXPECT_NO_THROW(ready.get());
+    player.close();
+}
+
+//pause stops the output clock only, resuming continues at the very same frame
+TEST_F(PlayerOpen, PauseKeepsPosition) {
+    ASSERT_TRUE(test::writeSource(test::NetworkFile, 4 * SAMPLE_RATE, 440));
+    ASSERT_TRUE(test::writeSource(test::PlayerFile, 4 * SAMPLE_RATE, 660));
+    Player player;
+    player.setOutputMode(OutputMode::Null);
+    player.open(networkUrl, filename).get();
+    player.play();
+    while (player.getPosition() < SAMPLE_RATE / 10) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    player.pause();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20)); //a chunk in flight may still complete
+    uint64_t paused = player.getPosition();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(player.getPosition(), paused);
+
+    player.play();
+    auto resumed = std::chrono::steady_clock::now();
+    while (player.getPosition() == paused) std::this_thread::sleep_for(std::chrono::microseconds(100));
+    EXPECT_LT(std::chrono::steady_clock::now() - resumed, std::chrono::milliseconds(50)); //the prefetch stayed warm
+    player.close();
+}
+
+//a pause while the mixer waits for network data parks it right away, the chunk isn't mixed once the data arrived
+TEST_F(PlayerOpen, PauseInterruptsUnderrun) {
+    ASSERT_TRUE(test::writeSource(test::NetworkFile, SAMPLE_RATE, 440));
+    ASSERT_TRUE(test::writeSource(test::PlayerFile, SAMPLE_RATE, 660));
+    Player player;
+    player.setOutputMode(OutputMode::Null);
+    net::ImpairmentConfig slow;
+    slow.latencyMean = std::chrono::milliseconds(300);
+    player.setNetworkImpairment(slow);
+    player.open(networkUrl, filename).get();
+    player.play();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50)); //the first network read is still in flight
+
+    player.pause();
+    std::this_thread::sleep_for(std::chrono::milliseconds(600));
+    EXPECT_EQ(player.getPosition(), 0u);
+    player.close();
+}
+
+//a watermark below one network read still passes every network sample through
+TEST_F(PlayerOpen, TinyPrefetchDepthLosesNothing) {
+    ASSERT_TRUE(test::writeSource(test::NetworkFile, SAMPLE_RATE / 2, 440));
+    ASSERT_TRUE(test::writeSource(test::PlayerFile, SAMPLE_RATE / 2, 660));
+    uint64_t digests[2];
+    for (int depth : {0, 500}) {
+        Player player;
+        player.setOutputMode(OutputMode::Checksum);
+        player.setRealtime(false);
+        player.setPrefetchDepth(std::chrono::milliseconds(depth));
+        player.open(networkUrl, filename).get();
+        player.play();
+        while (!player.isFinished()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        player.close();
+        digests[depth ? 1 : 0] = player.outputChecksum();
+    }
+    EXPECT_EQ(digests[0], digests[1]);
+}
+
+//a reopened player starts both sources over and doesn't carry the counters of the previous session along
+TEST_F(PlayerOpen, ReopenPlaysFromStart) {
+    ASSERT_TRUE(test::writeSource(test::NetworkFile, SAMPLE_RATE / 2, 440));
+    ASSERT_TRUE(test::writeSource(test::PlayerFile, SAMPLE_RATE / 2, 660));
+    Player player;
+    player.setOutputMode(OutputMode::Checksum);
+    player.setRealtime(false);
+    uint64_t digests[2], positions[2];
+    float networkPeaks[2];
+    for (int session = 0; session < 2; ++session) {
+        player.open(networkUrl, filename).get();
+        player.play();
+        while (!player.isFinished()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        positions[session] = player.getPosition();
+        networkPeaks[session] = player.getLevels().network.peak;
+        player.close();
+        digests[session] = player.outputChecksum();
+    }
+    EXPECT_EQ(positions[0], (uint64_t)SAMPLE_RATE / 2);
+    EXPECT_EQ(positions[1], positions[0]);
+    EXPECT_GT(networkPeaks[1], 0);
+    EXPECT_EQ(networkPeaks[1], networkPeaks[0]);
+    EXPECT_EQ(digests[1], digests[0]);
+}
+
+//openAsync() closes the previous session without blocking the only thread its prefetch can run on
+TEST_F(PlayerOpen, AsyncReopenOnSingleThread) {
+    ASSERT_TRUE(test::writeSource(test::NetworkFile, SAMPLE_RATE, 440));
+    ASSERT_TRUE(test::writeSource(test::PlayerFile, SAMPLE_RATE, 660));
+    async::ThreadPool pool(1);
+    Player player;
+    player.setOutputMode(OutputMode::Null);
+    async::blockOn(pool, player.openAsync(pool, networkUrl, filename));
+    player.play();
+    async::blockOn(pool, player.openAsync(pool, networkUrl, filename));
+    player.play();
+    while (player.getPosition() < SAMPLE_RATE / 10) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    async::blockOn(pool, player.closeAsync(pool));
+}
+
+namespace {
+
+    /**
+     * Plays both sources to the end in Checksum mode, starting at a frame.
+     *
+     * @return digest of the output, 0 if the player didn't end up at the end of the sources
+     */
+    uint64_t playFrom(char *networkUrl, char *filename, uint64_t start, uint64_t end) {
+        Player player;
+        player.setOutputMode(OutputMode::Checksum);
+        player.setRealtime(false);
+        player.open(networkUrl, filename).get();
+        if (start > 0) player.seek(start);
+        player.play();
+        while (!player.isFinished()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        uint64_t position = player.getPosition();
+        player.close();
+        return position == end ? player.outputChecksum() : 0;
+    }
+}
+
+//a seek continues both sources at exactly the target frame, within the prefetched network data and beyond it
+TEST_F(PlayerOpen, SeekIsSampleAccurate) {
+    const size_t length = SAMPLE_RATE;
+    for (uint64_t target : {1001, SAMPLE_RATE * 3 / 4 + 7}) {
+        ASSERT_TRUE(test::writeSource(test::NetworkFile, length, 440));
+        ASSERT_TRUE(test::writeSource(test::PlayerFile, length, 660));
+        uint64_t seeked = playFrom(networkUrl, filename, target, length);
+
+        //the same sources written from the target on
+        ASSERT_TRUE(test::writeSource(test::NetworkFile, length - target, 440, target));
+        ASSERT_TRUE(test::writeSource(test::PlayerFile, length - target, 660, target));
+        uint64_t tail = playFrom(networkUrl, filename, 0, length - target);
+        EXPECT_NE(seeked, 0u) << target;
+        EXPECT_EQ(seeked, tail) << target;
+    }
+}
+
+//the prefetch as a coroutine on a few shared threads delivers the same output as its own thread, for many players
+TEST_F(PlayerOpen, AsyncSessionsMatchThreaded) {
+    ASSERT_TRUE(test::writeSource(test::NetworkFile, SAMPLE_RATE / 2, 440));
+    ASSERT_TRUE(test::writeSource(test::PlayerFile, SAMPLE_RATE / 2, 660));
+    uint64_t expected = playFrom(networkUrl, filename, 0, SAMPLE_RATE / 2);
+    ASSERT_NE(expected, 0u);
+
+    async::ThreadPool pool(2);
+    const int sessions = 4;
+    Player players[sessions];
+    for (Player &player : players) {
+        player.setOutputMode(OutputMode::Checksum);
+        player.setRealtime(false);
+        async::blockOn(pool, player.openAsync(pool, networkUrl, filename));
+        async::blockOn(pool, player.playAsync(pool));
+    }
+    for (Player &player : players) {
+        while (!player.isFinished()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        EXPECT_EQ(player.getPosition(), (uint64_t)SAMPLE_RATE / 2);
+        async::blockOn(pool, player.closeAsync(pool));
+        EXPECT_EQ(player.outputChecksum(), expected);
+    }
+}
+
+//control calls made before the task of openAsync() ran apply to the new session, not to the one it closes
+TEST_F(PlayerOpen, ControlCallsBeforeAsyncOpenApply) {
+    const size_t length = SAMPLE_RATE / 2;
+    const uint64_t target = 1001;
+    ASSERT_TRUE(test::writeSource(test::NetworkFile, length, 440));
+    ASSERT_TRUE(test::writeSource(test::PlayerFile, length, 660));
+    uint64_t expected = playFrom(networkUrl, filename, target, length);
+    ASSERT_NE(expected, 0u);
+
+    async::ThreadPool pool(2);
+    Player player;
+    player.setOutputMode(OutputMode::Checksum);
+    player.setRealtime(false);
+    async::blockOn(pool, player.openAsync(pool, networkUrl, filename)); //a session to close, left paused
+    async::Task<void> reopen = player.openAsync(pool, networkUrl, filename);
+    player.seek(target);
+    player.play();
+    async::blockOn(pool, std::move(reopen));
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!player.isFinished() && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_TRUE(player.isFinished());
+    EXPECT_EQ(player.getPosition(), length);
+    async::blockOn(pool, player.closeAsync(pool));
+    EXPECT_EQ(player.outputChecksum(), expected);
+}
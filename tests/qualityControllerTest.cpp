@@ -0,0 +1,64 @@
+#include "../qualityController.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+namespace {
+
+    const uint32_t Rate = 48000;
+
+    /**
+     * Feeds reads that transferred at the given rate.
+     */
+    void measure(net::QualityController &controller, double bytesPerSecond, int reads = 20) {
+        for (int i = 0; i < reads; ++i) {
+            controller.addSample((size_t)(bytesPerSecond / 100), std::chrono::milliseconds(10));
+        }
+    }
+}
+
+TEST(QualityController, KeepsStartWithoutEstimate) {
+    net::QualityController controller(Rate, audio::StreamEncoding::MuLaw);
+    EXPECT_EQ(controller.select(0.0), audio::StreamEncoding::MuLaw);
+    EXPECT_EQ(controller.estimate(), 0);
+}
+
+//the estimate drops with the first slow read, but takes a while to trust a fast one again
+TEST(QualityController, EstimateQuickToDropSlowToRecover) {
+    net::QualityController controller(Rate, audio::StreamEncoding::Pcm16);
+    measure(controller, 1e6);
+    EXPECT_NEAR(controller.estimate(), 1e6, 1);
+    measure(controller, 1e5, 1);
+    EXPECT_LT(controller.estimate(), 6e5);
+    measure(controller, 1e6, 1);
+    EXPECT_LT(controller.estimate(), 9e5);
+}
+
+//downswitches go straight to the best representation that fits the bandwidth
+TEST(QualityController, DownswitchesAtOnce) {
+    net::QualityController controller(Rate, audio::StreamEncoding::Pcm16);
+    double adpcm = controller.bytesPerSecond(audio::StreamEncoding::ImaAdpcm);
+    measure(controller, 1.1 * adpcm);
+    EXPECT_EQ(controller.select(1.0), audio::StreamEncoding::ImaAdpcm);
+}
+
+//a draining buffer forces a step down even though the estimate still fits
+TEST(QualityController, PanicsOnLowBuffer) {
+    net::QualityController controller(Rate, audio::StreamEncoding::Pcm16);
+    measure(controller, 1e7);
+    EXPECT_EQ(controller.select(1.0), audio::StreamEncoding::Pcm16);
+    EXPECT_EQ(controller.select(0.1), audio::StreamEncoding::MuLaw);
+}
+
+//upswitches need a healthy buffer and the dwell time, and go one rung at a time
+TEST(QualityController, UpswitchesOneStepAfterDwell) {
+    net::QualityController controller(Rate, audio::StreamEncoding::ImaAdpcm);
+    measure(controller, 1e7);
+    EXPECT_EQ(controller.select(1.0), audio::StreamEncoding::ImaAdpcm); //just started
+    std::this_thread::sleep_for(std::chrono::milliseconds(3100));
+    EXPECT_EQ(controller.select(0.3), audio::StreamEncoding::ImaAdpcm); //buffer too low
+    EXPECT_EQ(controller.select(1.0), audio::StreamEncoding::MuLaw);
+    EXPECT_EQ(controller.select(1.0), audio::StreamEncoding::MuLaw); //dwell again
+}
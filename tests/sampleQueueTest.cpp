@@ -0,0 +1,63 @@
+#include "../sampleQueue.h"
+
+#include <gtest/gtest.h>
+
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+TEST(SampleQueue, CapacityHoldsLargestPush) {
+    audio::SampleQueue queue;
+    queue.reset(0, 0);
+    EXPECT_EQ(queue.capacity(), 1u); //never a zero-size ring
+    queue.reset(100, 8080);
+    EXPECT_EQ(queue.capacity(), 8080u);
+    queue.reset(24000, 8080);
+    EXPECT_EQ(queue.capacity(), 24000u);
+}
+
+TEST(SampleQueue, PushNeverTruncates) {
+    audio::SampleQueue queue;
+    queue.reset(10, 10);
+    std::vector<int16_t> samples(8);
+    std::iota(samples.begin(), samples.end(), 0);
+    EXPECT_EQ(queue.push(samples.data(), 8, 0), 8u);
+    EXPECT_THROW(queue.push(samples.data(), 3, 0), std::length_error);
+    EXPECT_EQ(queue.fill(), 8u);
+    EXPECT_EQ(queue.push(samples.data(), 2, 0), 2u);
+}
+
+//pushed and popped in sizes that don't divide the ring, so both wrap around
+TEST(SampleQueue, WrapsAroundInOrder) {
+    audio::SampleQueue queue;
+    queue.reset(7, 5);
+    std::vector<int16_t> in(1000), out;
+    std::iota(in.begin(), in.end(), 0);
+    int16_t buffer[5];
+    size_t pushed = 0;
+    while (out.size() < in.size()) {
+        size_t n = std::min<size_t>(5, in.size() - pushed);
+        if (n > 0 && queue.capacity() - queue.fill() >= n) {
+            queue.push(in.data() + pushed, n, 0);
+            pushed += n;
+        }
+        size_t popped = queue.pop(buffer, 3);
+        out.insert(out.end(), buffer, buffer + popped);
+    }
+    EXPECT_EQ(out, in);
+}
+
+TEST(SampleQueue, RestartDropsOldGeneration) {
+    audio::SampleQueue queue;
+    queue.reset(100, 10);
+    int16_t samples[10] = {};
+    queue.push(samples, 10, 0);
+    queue.restart(4800);
+    EXPECT_EQ(queue.fill(), 0u);
+    EXPECT_EQ(queue.push(samples, 10, 0), 0u); //still producing for the old position
+
+    uint64_t generation = 0, from = 0;
+    ASSERT_TRUE(queue.restarted(generation, from));
+    EXPECT_EQ(from, 4800u);
+    EXPECT_EQ(queue.push(samples, 10, generation), 10u);
+}
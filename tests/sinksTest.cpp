@@ -0,0 +1,86 @@
+#include "../sinks.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+    std::vector<char> pattern(size_t n) {
+        std::vector<char> data(n);
+        for (size_t i = 0; i < n; ++i) data[i] = (char)(i * 131 + (i >> 12));
+        return data;
+    }
+
+    uint64_t digest(const std::vector<char> &data, size_t split) {
+        io::ChecksumWriter writer;
+        for (size_t i = 0; i < data.size(); i += split) {
+            writer.write(data.data() + i, std::min(split, data.size() - i));
+        }
+        writer.close();
+        return writer.digest();
+    }
+}
+
+TEST(NullWriter, CountsBytes) {
+    io::NullWriter writer;
+    std::vector<char> data = pattern(1000);
+    writer.write(data.data(), 288);
+    writer.write(data.data(), 1000);
+    EXPECT_TRUE(writer.close());
+    EXPECT_EQ(writer.bytes(), 1288u);
+}
+
+//the digest depends on the bytes only, not on how they were split into writes
+TEST(ChecksumWriter, IndependentOfSplit) {
+    std::vector<char> data = pattern(10007);
+    uint64_t expected = digest(data, data.size());
+    for (size_t split : {1, 3, 8, 13, 288, 4096}) EXPECT_EQ(digest(data, split), expected) << split;
+}
+
+TEST(ChecksumWriter, DetectsChanges) {
+    std::vector<char> data = pattern(1001);
+    uint64_t original = digest(data, 288);
+    data[500] ^= 1;
+    EXPECT_NE(digest(data, 288), original);
+    data[500] ^= 1;
+    data.push_back(0); //zero padding alone must not hide a longer stream
+    EXPECT_NE(digest(data, 288), original);
+}
+
+TEST(PipeWriter, DeliversEverything) {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    std::vector<char> data = pattern(3 * io::PipeWriter::BufferSize + 123), received;
+    std::thread reader([&] {
+        char buffer[4096];
+        ssize_t n;
+        while ((n = read(fds[0], buffer, sizeof(buffer))) > 0) received.insert(received.end(), buffer, buffer + n);
+    });
+    io::PipeWriter writer;
+    ASSERT_TRUE(writer.open(fds[1]));
+    for (size_t i = 0; i < data.size(); i += 288) {
+        writer.write(data.data() + i, std::min<size_t>(288, data.size() - i));
+    }
+    EXPECT_TRUE(writer.close());
+    ::close(fds[1]);
+    reader.join();
+    ::close(fds[0]);
+    EXPECT_EQ(received, data);
+}
+
+//a reader that went away is reported by close() instead of killing the process with SIGPIPE
+TEST(PipeWriter, ReportsClosedReader) {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    ::close(fds[0]);
+    io::PipeWriter writer;
+    ASSERT_TRUE(writer.open(fds[1]));
+    std::vector<char> data = pattern(io::PipeWriter::BufferSize);
+    writer.write(data.data(), data.size());
+    EXPECT_FALSE(writer.close());
+    ::close(fds[1]);
+}
@@ -0,0 +1,81 @@
+#include "../streamCodec.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace {
+
+    /**
+     * One block at a time through adpcmStep(), the reference for the vector path.
+     */
+    std::vector<int16_t> adpcmReference(const std::vector<uint8_t> &in) {
+        std::vector<int16_t> out;
+        for (size_t b = 0; b + audio::codec::AdpcmBlockBytes <= in.size(); b += audio::codec::AdpcmBlockBytes) {
+            const uint8_t *block = in.data() + b;
+            int predictor = (int16_t)(block[0] | block[1] << 8);
+            int index = std::min<int>(block[2], 88);
+            out.push_back((int16_t)predictor);
+            for (size_t k = 4; k < audio::codec::AdpcmBlockBytes; ++k) {
+                audio::codec::adpcmStep(block[k] & 0x0F, predictor, index);
+                out.push_back((int16_t)predictor);
+                audio::codec::adpcmStep(block[k] >> 4, predictor, index);
+                out.push_back((int16_t)predictor);
+            }
+        }
+        return out;
+    }
+}
+
+//every byte value, at lengths leaving a tail for the table
+TEST(StreamCodec, G711MatchesScalar) {
+    std::mt19937 gen(3);
+    for (audio::StreamEncoding e : {audio::StreamEncoding::MuLaw, audio::StreamEncoding::ALaw}) {
+        for (size_t n : {size_t(7), size_t(256), size_t(1003)}) {
+            std::vector<uint8_t> in(n);
+            for (size_t i = 0; i < n; ++i) in[i] = n == 256 ? (uint8_t)i : (uint8_t)gen();
+            std::vector<int16_t> out(n);
+            ASSERT_EQ(audio::codec::decode(e, in.data(), n, out.data()), n);
+            for (size_t i = 0; i < n; ++i) {
+                int16_t expected = e == audio::StreamEncoding::MuLaw ? audio::codec::muLawDecode(in[i])
+                                                                     : audio::codec::aLawDecode(in[i]);
+                ASSERT_EQ(out[i], expected) << audio::name(e) << " byte " << (int)in[i];
+            }
+        }
+    }
+}
+
+//random payloads clamp the predictor and the step index, header indexes above 88 are clamped as well
+TEST(StreamCodec, AdpcmMatchesScalar) {
+    std::mt19937 gen(5);
+    for (size_t blocks : {size_t(1), size_t(8), size_t(16 + 3), size_t(40 + 7)}) {
+        std::vector<uint8_t> in(blocks * audio::codec::AdpcmBlockBytes + 100); //a partial block is ignored
+        for (uint8_t &byte : in) byte = (uint8_t)gen();
+        for (size_t b = 0; b < blocks; b += 2) in[b * audio::codec::AdpcmBlockBytes + 2] = (uint8_t)(89 + gen() % 167);
+        std::vector<int16_t> expected = adpcmReference(in);
+
+        std::vector<int16_t> out(audio::codec::maxDecodedSamples(audio::StreamEncoding::ImaAdpcm, in.size()));
+        size_t n = audio::codec::decode(audio::StreamEncoding::ImaAdpcm, in.data(), in.size(), out.data());
+        ASSERT_EQ(n, blocks * audio::codec::AdpcmBlockSamples);
+        out.resize(n);
+        EXPECT_EQ(out, expected) << blocks << " blocks";
+    }
+}
+
+//a sine survives encoding and decoding with a reasonable SNR
+TEST(StreamCodec, AdpcmRoundTrip) {
+    std::vector<int16_t> pcm(20 * audio::codec::AdpcmBlockSamples);
+    for (size_t i = 0; i < pcm.size(); ++i) pcm[i] = (int16_t)(12000 * std::sin(0.03 * (double)i));
+    std::vector<uint8_t> encoded;
+    audio::codec::encode(audio::StreamEncoding::ImaAdpcm, pcm.data(), pcm.size(), encoded);
+    std::vector<int16_t> out(audio::codec::maxDecodedSamples(audio::StreamEncoding::ImaAdpcm, encoded.size()));
+    ASSERT_EQ(audio::codec::decode(audio::StreamEncoding::ImaAdpcm, encoded.data(), encoded.size(), out.data()), pcm.size());
+    double signal = 0, noise = 0;
+    for (size_t i = 0; i < pcm.size(); ++i) {
+        signal += (double)pcm[i] * pcm[i];
+        noise += ((double)out[i] - pcm[i]) * ((double)out[i] - pcm[i]);
+    }
+    EXPECT_GT(10 * std::log10(signal / noise), 25); //dB
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * Helpers shared by the tests and the benchmarks. The player and the network simulator read their sources
+ * from fixed file names in the working directory, so these run in a scratch directory holding generated ones.
+ */
+namespace test {
+
+    const char *const NetworkFile = "audio2_s16le_mono_48k.raw";
+    const char *const PlayerFile = "audio1_s16le_mono_48k.raw";
+
+    /**
+     * Writes a 48kHz S16LE mono sine, one second at a time so long sources don't need the memory.
+     *
+     * @param first sample of the sine the file starts with, e.g. to write the tail of another source
+     * @return false if the file could not be written
+     */
+    inline bool writeSource(const char *path, size_t samples, double frequency, size_t first = 0) {
+        FILE *out = std::fopen(path, "wb");
+        if (!out) return false;
+        std::vector<int16_t> block(48000);
+        for (size_t s = 0; s < samples; s += block.size()) {
+            size_t n = std::min(block.size(), samples - s);
+            for (size_t i = 0; i < n; ++i) {
+                block[i] = (int16_t)(8000 * std::sin(2 * M_PI * frequency * (double)(first + s + i) / 48000));
+            }
+            std::fwrite(block.data(), sizeof(int16_t), n, out);
+        }
+        return std::fclose(out) == 0;
+    }
+
+    /**
+     * Temporary working directory, removed again with everything written into it.
+     */
+    class ScratchDirectory {
+    public:
+        explicit ScratchDirectory(const std::string &name) : m_path("/tmp/" + name + ".XXXXXX"), m_entered(false) {}
+        ~ScratchDirectory() { leave(); }
+
+        /**
+         * Creates the directory and makes it the working directory.
+         */
+        bool enter() {
+            if (!mkdtemp(&m_path[0]) || chdir(m_path.c_str()) != 0) return false;
+            m_entered = true;
+            return true;
+        }
+
+        /**
+         * Removes the files in it and the directory itself.
+         */
+        void leave() {
+            if (!m_entered) return;
+            m_entered = false;
+            if (DIR *dir = opendir(m_path.c_str())) {
+                while (dirent *entry = readdir(dir)) {
+                    std::string name = entry->d_name;
+                    if (name != "." && name != "..") unlink((m_path + "/" + name).c_str());
+                }
+                closedir(dir);
+            }
+            if (chdir("/") == 0) rmdir(m_path.c_str());
+        }
+
+    private:
+        std::string m_path;
+        bool m_entered;
+    };
+}
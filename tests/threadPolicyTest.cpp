@@ -0,0 +1,56 @@
+#include "../threadPolicy.h"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    /**
+     * @return locked memory of the process in kB, see proc(5)
+     */
+    long lockedKb() {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.compare(0, 6, "VmLck:") == 0) return std::stol(line.substr(6));
+        }
+        return -1;
+    }
+}
+
+//closing one player must not unlock the memory of the others
+TEST(MemoryLock, SharedBetweenHolders) {
+    std::vector<char> a(64 * 1024), b(64 * 1024);
+    sys::MemoryLock first, second;
+    std::string warnings;
+    bool locked = first.lock({{a.data(), a.size()}}, warnings);
+    if (!locked) GTEST_SKIP() << warnings;
+    ASSERT_TRUE(second.lock({{b.data(), b.size()}}, warnings));
+    EXPECT_GT(lockedKb(), 0);
+
+    first.unlock();
+    EXPECT_GE(lockedKb(), (long)(b.size() / 1024));
+    second.unlock();
+    EXPECT_EQ(lockedKb(), 0);
+}
+
+TEST(ThreadPolicy, PinsToCpu) {
+    sys::ThreadPolicy policy;
+    policy.cpus = {0};
+    policy.stackPrefault = 64 * 1024;
+    bool applied = false;
+    cpu_set_t set;
+    std::thread([&] {
+        std::string warnings;
+        applied = sys::applyToCurrentThread(policy, warnings);
+        CPU_ZERO(&set);
+        pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+    }).join();
+    ASSERT_TRUE(applied);
+    EXPECT_EQ(CPU_COUNT(&set), 1);
+    EXPECT_TRUE(CPU_ISSET(0, &set));
+}
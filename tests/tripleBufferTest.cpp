@@ -0,0 +1,79 @@
+#include "../tripleBuffer.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+namespace {
+
+    /**
+     * A value that shows if it was torn: every field is derived from the sequence number.
+     */
+    struct Block {
+        uint64_t sequence;
+        uint64_t fields[7];
+
+        static Block make(uint64_t sequence) {
+            Block b{sequence, {}};
+            for (size_t k = 0; k < 7; ++k) b.fields[k] = sequence * (k + 3);
+            return b;
+        }
+
+        bool consistent() const {
+            for (size_t k = 0; k < 7; ++k) {
+                if (fields[k] != sequence * (k + 3)) return false;
+            }
+            return true;
+        }
+    };
+}
+
+TEST(TripleBuffer, ReaderSeesNewestValue) {
+    audio::TripleBuffer<int> buffer(1);
+    EXPECT_FALSE(buffer.update());
+    EXPECT_EQ(buffer.current(), 1);
+
+    buffer.publish(2);
+    buffer.publish(3); //2 is skipped
+    EXPECT_TRUE(buffer.update());
+    EXPECT_EQ(buffer.current(), 3);
+    EXPECT_FALSE(buffer.update());
+    EXPECT_EQ(buffer.current(), 3);
+
+    buffer.publish(4);
+    EXPECT_TRUE(buffer.update());
+    EXPECT_EQ(buffer.current(), 4);
+}
+
+//the reader never sees a mix of two publications, and never goes back to an older one
+TEST(TripleBuffer, NeverTornUnderContention) {
+    const uint64_t publications = 1000000;
+    audio::TripleBuffer<Block> buffer(Block::make(0));
+    std::atomic<bool> done(false);
+    std::thread writer([&] {
+        for (uint64_t s = 1; s <= publications; ++s) buffer.publish(Block::make(s));
+        done = true;
+    });
+
+    uint64_t last = 0, updates = 0;
+    bool torn = false, backwards = false;
+    while (true) {
+        bool finished = done; //everything is published once this is seen, so an update after it gets the last value
+        if (!buffer.update()) {
+            if (finished) break;
+            continue;
+        }
+        const Block &b = buffer.current();
+        torn |= !b.consistent();
+        backwards |= b.sequence <= last;
+        last = b.sequence;
+        updates++;
+    }
+    writer.join();
+    EXPECT_FALSE(torn);
+    EXPECT_FALSE(backwards);
+    EXPECT_EQ(last, publications); //the last value always arrives
+    EXPECT_GT(updates, 0u);
+}
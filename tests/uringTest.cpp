@@ -0,0 +1,95 @@
+#include "../uring.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <unistd.h>
+
+namespace {
+
+    std::vector<char> pattern(size_t n, int seed) {
+        std::vector<char> data(n);
+        for (size_t i = 0; i < n; ++i) data[i] = (char)(i * 131 + (i >> 12) + seed);
+        return data;
+    }
+
+    std::vector<char> readFile(const std::string &path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    std::string scratchPath(int session) {
+        return "/dev/shm/uringTest." + std::to_string(getpid()) + "." + std::to_string(session);
+    }
+}
+
+//the sinks of sessions mixing on threads of their own share the service's ring and buffer pool
+TEST(UringFileWriter, SessionsShareRing) {
+    if (!io::Uring::supported()) GTEST_SKIP() << "io_uring is not available";
+    const int sessions = 4;
+    const size_t size = 3 * io::Uring::BufferCount * io::Uring::BufferSize / 2; //more than the whole pool
+    std::vector<char> closed(sessions); //not vector<bool>, the sessions set theirs concurrently
+    std::vector<std::thread> mixers;
+    for (int s = 0; s < sessions; ++s) {
+        mixers.emplace_back([s, size, &closed] {
+            std::vector<char> data = pattern(size, s);
+            io::UringFileWriter writer;
+            if (!writer.open(scratchPath(s))) return;
+            for (size_t i = 0; i < size; i += 288) writer.write(data.data() + i, std::min<size_t>(288, size - i));
+            closed[s] = writer.close();
+        });
+    }
+    for (auto &mixer : mixers) mixer.join();
+    for (int s = 0; s < sessions; ++s) {
+        EXPECT_TRUE(closed[s]) << s;
+        EXPECT_EQ(readFile(scratchPath(s)), pattern(size, s)) << s;
+        std::remove(scratchPath(s).c_str());
+    }
+}
+
+//every buffer returns to the pool, also the last, partially filled one of a session
+TEST(UringFileWriter, SequentialSessionsKeepPool) {
+    if (!io::Uring::supported()) GTEST_SKIP() << "io_uring is not available";
+    std::shared_ptr<io::UringService> service = io::UringService::shared(); //keeps the pool across sessions
+    for (int s = 0; s < 3 * (int)io::Uring::BufferCount; ++s) {
+        std::vector<char> data = pattern(1000 + s, s);
+        io::UringFileWriter writer;
+        ASSERT_TRUE(writer.open(scratchPath(0)));
+        writer.write(data.data(), data.size());
+        ASSERT_TRUE(writer.close());
+        ASSERT_EQ(readFile(scratchPath(0)), data) << s;
+    }
+    std::remove(scratchPath(0).c_str());
+}
+
+namespace {
+
+    size_t openFiles() {
+        size_t n = 0;
+        if (DIR *dir = opendir("/proc/self/fd")) {
+            while (readdir(dir)) ++n;
+            closedir(dir);
+        }
+        return n;
+    }
+}
+
+//a failed write is reported by close(), which still closes the file
+TEST(UringFileWriter, ClosesFileAfterFailedWrite) {
+    if (!io::Uring::supported()) GTEST_SKIP() << "io_uring is not available";
+    std::shared_ptr<io::UringService> service = io::UringService::shared(); //its ring is open before counting
+    size_t before = openFiles();
+    std::vector<char> data = pattern(1000, 0);
+    io::UringFileWriter writer;
+    ASSERT_TRUE(writer.open("/dev/full"));
+    writer.write(data.data(), data.size());
+    EXPECT_FALSE(writer.close());
+    EXPECT_EQ(openFiles(), before);
+}
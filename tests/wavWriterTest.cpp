@@ -0,0 +1,59 @@
+#include "../wavWriter.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+    std::vector<char> readFile(const std::string &path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    uint32_t get32(const std::vector<char> &file, size_t pos) {
+        const unsigned char *p = (const unsigned char*)file.data() + pos;
+        return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+    }
+}
+
+//the header sizes are patched on close(), odd data is padded to a word and the preallocation is not visible
+TEST(WavWriter, PatchesHeaderOnClose) {
+    for (size_t n : {size_t(0), size_t(3), size_t(4000), io::WavFileWriter::BufferSize + 7}) {
+        std::string path = "/tmp/wavWriterTest." + std::to_string(getpid()) + ".wav";
+        std::vector<char> data(n);
+        for (size_t i = 0; i < n; ++i) data[i] = (char)(i * 131 + (i >> 12));
+        io::WavFileWriter writer;
+        ASSERT_TRUE(writer.open(path, 48000, 2, 1024 * 1024));
+        for (size_t i = 0; i < n; i += 1000) writer.write(data.data() + i, std::min<size_t>(1000, n - i));
+        EXPECT_TRUE(writer.close());
+
+        std::vector<char> file = readFile(path);
+        size_t padded = n + (n & 1);
+        ASSERT_EQ(file.size(), io::WavFileWriter::HeaderSize + padded) << n << " bytes";
+        EXPECT_EQ(std::memcmp(file.data(), "RIFF", 4), 0);
+        EXPECT_EQ(get32(file, 4), io::WavFileWriter::HeaderSize - 8 + padded);
+        EXPECT_EQ(std::memcmp(file.data() + 12, "JUNK", 4), 0);
+        EXPECT_EQ(get32(file, 60), 48000u);
+        EXPECT_EQ(get32(file, 64), 48000u * 4);
+        EXPECT_EQ(std::memcmp(file.data() + 72, "data", 4), 0);
+        EXPECT_EQ(get32(file, 76), n);
+        EXPECT_TRUE(std::equal(data.begin(), data.end(), file.begin() + io::WavFileWriter::HeaderSize));
+        std::remove(path.c_str());
+    }
+}
+
+TEST(WavWriter, ReportsWriteError) {
+    io::WavFileWriter writer;
+    writer.open("/dev/full", 48000, 2, 0); //may already fail on the header
+    std::vector<char> data(io::WavFileWriter::BufferSize);
+    writer.write(data.data(), data.size());
+    EXPECT_FALSE(writer.close());
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace sys {
+
+    enum class SchedPolicy {
+        Default,   //whatever the thread inherited, usually SCHED_OTHER
+        Fifo,      //SCHED_FIFO
+        RoundRobin //SCHED_RR
+    };
+
+    /**
+     * Scheduling setup for a latency critical thread.
+     */
+    struct ThreadPolicy {
+        SchedPolicy policy;
+        int priority;           //clamped to the range of the policy
+        std::vector<int> cpus;  //CPUs to pin the thread to, empty leaves the affinity alone
+        size_t stackPrefault;   //bytes of stack to touch up front
+
+        ThreadPolicy() : policy(SchedPolicy::Default), priority(0), stackPrefault(256 * 1024) {}
+    };
+
+    /**
+     * Touches every page of a range so it is resident before the first real access.
+     */
+    inline void prefault(void *data, size_t bytes) {
+        const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        volatile char *p = (volatile char*)data;
+        for (size_t i = 0; i < bytes; i += page) p[i] = p[i];
+        if (bytes > 0) p[bytes - 1] = p[bytes - 1];
+    }
+
+    /**
+     * Touches the given amount of stack below the caller, so later calls don't page fault on it.
+     */
+    inline void __attribute__((noinline)) prefaultStack(size_t bytes) {
+        const size_t chunk = 16 * 1024;
+        volatile char frame[chunk];
+        std::memset((char*)frame, 0, chunk);
+        if (bytes > chunk) prefaultStack(bytes - chunk);
+    }
+
+    /**
+     * Applies a policy to the calling thread. Every step that fails (typically with EPERM for lack of
+     * CAP_SYS_NICE or an RLIMIT_RTPRIO of 0) is skipped and described in warnings; the thread keeps
+     * running with what it had.
+     *
+     * @return true if everything was applied
+     */
+    inline bool applyToCurrentThread(const ThreadPolicy &policy, std::string &warnings) {
+        bool ok = true;
+
+        if (!policy.cpus.empty()) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (int cpu : policy.cpus) {
+                if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+            }
+            int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            if (err != 0) {
+                warnings += std::string("cannot set CPU affinity: ") + std::strerror(err) + "\n";
+                ok = false;
+            }
+        }
+
+        if (policy.policy != SchedPolicy::Default) {
+            int native = policy.policy == SchedPolicy::Fifo ? SCHED_FIFO : SCHED_RR;
+            sched_param param;
+            std::memset(&param, 0, sizeof(param));
+            param.sched_priority = std::max(sched_get_priority_min(native),
+                                            std::min(sched_get_priority_max(native), policy.priority));
+            int err = pthread_setschedparam(pthread_self(), native, &param);
+            if (err != 0) {
+                warnings += std::string("cannot switch to real-time scheduling: ") + std::strerror(err) + "\n";
+                ok = false;
+            }
+        }
+
+        if (policy.stackPrefault > 0) prefaultStack(policy.stackPrefault);
+        return ok;
+    }
+
+    /**
+     * Keeps memory resident for as long as it is held. Several holders (e.g. the players of a process)
+     * share the process wide locks: the address space stays locked until the last holder that locked it
+     * unlocks, and a page locked by range stays locked until all holders covering it unlocked.
+     */
+    class MemoryLock {
+    public:
+        MemoryLock() : m_all(false) {}
+        ~MemoryLock() { unlock(); }
+        MemoryLock(const MemoryLock &) = delete;
+        MemoryLock &operator=(const MemoryLock &) = delete;
+
+        /**
+         * Locks the whole address space (current and future mappings) into memory. Without the privilege to
+         * do so (RLIMIT_MEMLOCK too low for the process) the given ranges are locked one by one instead, so
+         * at least the hot buffers stay resident. Releases what this holder locked before.
+         *
+         * @param ranges fallback ranges as (address, size) pairs
+         * @return true if either the address space or all fallback ranges were locked
+         */
+        bool lock(const std::vector<std::pair<const void*, size_t>> &ranges, std::string &warnings) {
+            unlock();
+            Shared &shared = state();
+            std::lock_guard<std::mutex> guard(shared.mutex);
+            if (shared.allHolders > 0 || mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+                shared.allHolders++;
+                m_all = true;
+                return true;
+            }
+            warnings += std::string("cannot lock the address space: ") + std::strerror(errno) + ", locking buffers only\n";
+
+            const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+            int error = 0;
+            for (const auto &range : ranges) {
+                if (range.second == 0) continue;
+                uintptr_t first = (uintptr_t)range.first / page * page;
+                uintptr_t end = ((uintptr_t)range.first + range.second + page - 1) / page * page;
+                for (uintptr_t p = first; p < end; p += page) {
+                    size_t &holders = shared.pages[p];
+                    if (holders == 0 && mlock((const void*)p, page) != 0) {
+                        error = errno;
+                        shared.pages.erase(p);
+                        continue;
+                    }
+                    holders++;
+                    m_pages.push_back(p);
+                }
+            }
+            if (error) warnings += std::string("cannot lock buffers: ") + std::strerror(error) + "\n";
+            return error == 0;
+        }
+
+        /**
+         * Releases what lock() took, as far as no other holder still needs it.
+         */
+        void unlock() {
+            if (!m_all && m_pages.empty()) return;
+            Shared &shared = state();
+            std::lock_guard<std::mutex> guard(shared.mutex);
+            const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            for (uintptr_t p : m_pages) {
+                auto it = shared.pages.find(p);
+                if (it == shared.pages.end() || --it->second > 0) continue;
+                munlock((const void*)p, page);
+                shared.pages.erase(it);
+            }
+            m_pages.clear();
+            if (m_all && --shared.allHolders == 0) {
+                munlockall();
+                for (const auto &p : shared.pages) mlock((const void*)p.first, page); //munlockall took these too
+            }
+            m_all = false;
+        }
+
+    private:
+        struct Shared {
+            std::mutex mutex;
+            size_t allHolders;                  //holders of the mlockall()
+            std::map<uintptr_t, size_t> pages;  //holders per page locked by range
+            Shared() : allHolders(0) {}
+        };
+
+        static Shared &state() {
+            static Shared shared;
+            return shared;
+        }
+
+        bool m_all;
+        std::vector<uintptr_t> m_pages;
+    };
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+
+namespace audio {
+
+    /**
+     * Wait-free single producer, single consumer exchange of a value, e.g. a parameter block.
+     *
+     * Three slots rotate between the writer (back), the reader (front) and a shared middle slot. publish()
+     * fills the back slot and swaps it with the middle one, update() swaps the middle slot into the front
+     * if it holds something newer. Both are a single atomic exchange, never wait for the other side and the
+     * reader always sees a complete value, never a mix of two publications. Intermediate values published
+     * between two updates are skipped.
+     */
+    template <class T>
+    class TripleBuffer {
+    public:
+        explicit TripleBuffer(const T &initial = T()) : m_back(0), m_middle(1), m_front(2) {
+            for (T &slot : m_slots) slot = initial;
+        }
+
+        /**
+         * Writer side: makes value the newest one.
+         */
+        void publish(const T &value) {
+            m_slots[m_back] = value;
+            m_back = m_middle.exchange(m_back | Fresh, std::memory_order_acq_rel) & IndexMask;
+        }
+
+        /**
+         * Reader side: picks up the newest published value, if any.
+         *
+         * @return true if current() changed
+         */
+        bool update() {
+            if (!(m_middle.load(std::memory_order_relaxed) & Fresh)) return false;
+            m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & IndexMask;
+            return true;
+        }
+
+        /**
+         * Reader side: value picked up by the last update().
+         */
+        const T &current() const {
+            return m_slots[m_front];
+        }
+
+    private:
+        static const unsigned IndexMask = 3;
+        static const unsigned Fresh = 4; //middle slot was published but not picked up yet
+
+        T m_slots[3];
+        alignas(64) unsigned m_back;            //writer only
+        alignas(64) std::atomic<unsigned> m_middle;
+        alignas(64) unsigned m_front;           //reader only
+    };
+}
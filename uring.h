@@ -0,0 +1,570 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace io {
+
+    /**
+     * Bookkeeping of one user of a ring (a sink or a file read).
+     * Requests of an owner may complete out of order; the owner only cares about how many are left.
+     */
+    struct UringOwner {
+        UringOwner() : inFlight(0), error(0), bytes(0) {}
+        unsigned inFlight;
+        int error;      //first errno reported by a completion
+        uint64_t bytes; //transferred by the completed requests
+    };
+
+    /**
+     * Minimal io_uring wrapper on top of the raw syscalls.
+     *
+     * Requests are batched, BatchSize of them per submission, and a pool of registered buffers is recycled as
+     * soon as the completion of the write using it has been reaped. A thread can have a ring of its own (see
+     * forThisThread()), the file read-ahead uses that; the sinks of all sessions share the ring of the
+     * UringService, since every Player mixes on a thread of its own.
+     *
+     * @note Not thread safe. A ring may be handed over to another thread (e.g. for close()) once its
+     *       original thread stopped using it.
+     */
+    class Uring {
+    public:
+        static const unsigned Entries = 64;
+        static const unsigned BatchSize = 8;
+        static const unsigned BufferCount = 16;
+        static const size_t BufferSize = 64 * 1024;
+
+        Uring() : m_fd(-1), m_sq(nullptr), m_cq(nullptr), m_sqes(nullptr), m_sqSize(0), m_cqSize(0),
+                  m_sqesSize(0), m_pending(0), m_fixed(false) {}
+
+        ~Uring() {
+            if (m_fd >= 0) {
+                submit();
+                reap(m_requests.size() - m_freeRequests.size());
+                ::close(m_fd);
+            }
+            if (m_sqes) munmap(m_sqes, m_sqesSize);
+            if (m_cq && m_cq != m_sq) munmap(m_cq, m_cqSize);
+            if (m_sq) munmap(m_sq, m_sqSize);
+            for (auto &iov : m_buffers) free(iov.iov_base);
+        }
+
+        Uring(const Uring&) = delete;
+        Uring& operator=(const Uring&) = delete;
+
+        /**
+         * @return true if the running kernel provides io_uring (checked once per process)
+         */
+        static bool supported() {
+            static const bool result = Uring().init();
+            return result;
+        }
+
+        /**
+         * @return a new ring, nullptr if io_uring is not available
+         */
+        static std::unique_ptr<Uring> create() {
+            std::unique_ptr<Uring> ring(new Uring());
+            if (!ring->init()) ring.reset();
+            return ring;
+        }
+
+        /**
+         * @return the ring of the calling thread, nullptr if io_uring is not available
+         */
+        static std::shared_ptr<Uring> forThisThread() {
+            static thread_local std::shared_ptr<Uring> ring;
+            static thread_local bool failed = false;
+            if (!ring && !failed) {
+                ring = std::make_shared<Uring>();
+                if (!ring->init()) {
+                    ring.reset();
+                    failed = true;
+                }
+            }
+            return ring;
+        }
+
+        /**
+         * Takes a buffer from the pool, reaping completions until one is recycled if necessary.
+         *
+         * @return buffer index
+         */
+        int acquireBuffer() {
+            while (m_freeBuffers.empty()) {
+                submit();
+                reap(1);
+            }
+            int index = m_freeBuffers.back();
+            m_freeBuffers.pop_back();
+            return index;
+        }
+
+        char *buffer(int index) {
+            return (char*)m_buffers[index].iov_base;
+        }
+
+        /**
+         * Queues a write of a pool buffer. The buffer returns to the pool once the write completed.
+         */
+        void write(UringOwner *owner, int fd, int index, size_t len, uint64_t offset) {
+            queue(owner, fd, index, buffer(index), len, offset, true);
+        }
+
+        /**
+         * Queues a read into caller-owned memory.
+         */
+        void read(UringOwner *owner, int fd, void *dst, size_t len, uint64_t offset) {
+            queue(owner, fd, -1, (char*)dst, len, offset, false);
+        }
+
+        /**
+         * Submits all queued requests with a single syscall.
+         */
+        void submit() {
+            if (m_pending > 0) enter(m_pending, 0);
+        }
+
+        /**
+         * Submits everything and blocks until all requests of the owner completed.
+         */
+        void wait(UringOwner *owner) {
+            submit();
+            while (owner->inFlight > 0) {
+                reap(1);
+            }
+        }
+
+        /**
+         * Blocks until a completion is available, without processing it (see poll()).
+         */
+        void waitForCompletion() {
+            if (*m_cqHead == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) enter(0, 1);
+        }
+
+        /**
+         * Processes the available completions without blocking.
+         */
+        void poll() {
+            reapAvailable();
+        }
+
+        /**
+         * @return true if no request is queued or in flight
+         */
+        bool idle() const {
+            return m_freeRequests.size() == m_requests.size();
+        }
+
+        size_t freeBuffers() const {
+            return m_freeBuffers.size();
+        }
+
+    private:
+        struct Request {
+            UringOwner *owner;
+            int fd;
+            int buffer;
+            char *data;
+            size_t len;
+            uint64_t offset;
+            bool write;
+        };
+
+        bool init() {
+            io_uring_params params;
+            std::memset(&params, 0, sizeof(params));
+            m_fd = (int)syscall(__NR_io_uring_setup, Entries, &params);
+            if (m_fd < 0) return false;
+
+            m_sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            m_cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (single) m_sqSize = m_cqSize = std::max(m_sqSize, m_cqSize);
+
+            m_sq = (char*)mmap(nullptr, m_sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+            if (m_sq == MAP_FAILED) { m_sq = nullptr; return false; }
+            if (single) {
+                m_cq = m_sq;
+            } else {
+                m_cq = (char*)mmap(nullptr, m_cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+                if (m_cq == MAP_FAILED) { m_cq = nullptr; return false; }
+            }
+            m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            m_sqes = (io_uring_sqe*)mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+            if (m_sqes == MAP_FAILED) { m_sqes = nullptr; return false; }
+
+            m_sqHead = (unsigned*)(m_sq + params.sq_off.head);
+            m_sqTail = (unsigned*)(m_sq + params.sq_off.tail);
+            m_sqMask = *(unsigned*)(m_sq + params.sq_off.ring_mask);
+            m_sqEntries = params.sq_entries;
+            m_sqArray = (unsigned*)(m_sq + params.sq_off.array);
+            m_cqHead = (unsigned*)(m_cq + params.cq_off.head);
+            m_cqTail = (unsigned*)(m_cq + params.cq_off.tail);
+            m_cqMask = *(unsigned*)(m_cq + params.cq_off.ring_mask);
+            m_cqes = (io_uring_cqe*)(m_cq + params.cq_off.cqes);
+
+            //never have more requests in flight than the completion queue can hold
+            m_requests.resize(params.cq_entries);
+            for (unsigned i = 0; i < params.cq_entries; ++i) m_freeRequests.push_back(params.cq_entries - 1 - i);
+
+            m_buffers.resize(BufferCount);
+            for (unsigned i = 0; i < BufferCount; ++i) {
+                void *mem = nullptr;
+                if (posix_memalign(&mem, 4096, BufferSize) != 0) return false;
+                m_buffers[i].iov_base = mem;
+                m_buffers[i].iov_len = BufferSize;
+                m_freeBuffers.push_back(BufferCount - 1 - i);
+            }
+            //registration may fail (e.g. RLIMIT_MEMLOCK), plain writes from the same buffers still work
+            m_fixed = syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, m_buffers.data(), BufferCount) == 0;
+            return true;
+        }
+
+        void queue(UringOwner *owner, int fd, int index, char *data, size_t len, uint64_t offset, bool write) {
+            while (m_freeRequests.empty()) {
+                submit();
+                reap(1);
+            }
+            unsigned slot = m_freeRequests.back();
+            m_freeRequests.pop_back();
+            Request &req = m_requests[slot];
+            req.owner = owner;
+            req.fd = fd;
+            req.buffer = index;
+            req.data = data;
+            req.len = len;
+            req.offset = offset;
+            req.write = write;
+            owner->inFlight++;
+            prepare(slot);
+        }
+
+        void prepare(unsigned slot) {
+            if (*m_sqTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) + m_pending >= m_sqEntries) {
+                submit();
+            }
+            const Request &req = m_requests[slot];
+            unsigned tail = *m_sqTail + m_pending;
+            unsigned index = tail & m_sqMask;
+            io_uring_sqe *sqe = &m_sqes[index];
+            std::memset(sqe, 0, sizeof(*sqe));
+            if (req.write) {
+                sqe->opcode = m_fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+                sqe->buf_index = m_fixed ? (uint16_t)req.buffer : 0;
+            } else {
+                sqe->opcode = IORING_OP_READ;
+            }
+            sqe->fd = req.fd;
+            sqe->off = req.offset;
+            sqe->addr = (uint64_t)(uintptr_t)req.data;
+            sqe->len = (uint32_t)req.len;
+            sqe->user_data = slot;
+            m_sqArray[index] = index;
+            m_pending++;
+            if (m_pending >= BatchSize) submit();
+        }
+
+        void enter(unsigned toSubmit, unsigned minComplete) {
+            if (toSubmit > 0) {
+                __atomic_store_n(m_sqTail, *m_sqTail + toSubmit, __ATOMIC_RELEASE);
+                m_pending = 0;
+            }
+            unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+            while (true) {
+                long ret = syscall(__NR_io_uring_enter, m_fd, toSubmit, minComplete, flags, nullptr, 0);
+                if (ret >= 0 || (errno != EINTR && errno != EAGAIN && errno != EBUSY)) break;
+                if (errno != EINTR) reapAvailable(); //make room in the completion queue
+            }
+        }
+
+        /**
+         * Blocks until at least minComplete completions have been processed.
+         */
+        void reap(size_t minComplete) {
+            size_t done = reapAvailable();
+            while (done < minComplete && m_freeRequests.size() < m_requests.size()) {
+                enter(m_pending, 1); //with what complete() requeued, e.g. the rest of a short transfer
+                done += reapAvailable();
+            }
+        }
+
+        size_t reapAvailable() {
+            size_t done = 0;
+            while (true) {
+                //re-read the head every time, complete() may resubmit and reap recursively
+                unsigned head = *m_cqHead;
+                if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) break;
+                io_uring_cqe cqe = m_cqes[head & m_cqMask];
+                __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+                complete((unsigned)cqe.user_data, cqe.res);
+                done++;
+            }
+            return done;
+        }
+
+        void complete(unsigned slot, int res) {
+            Request &req = m_requests[slot];
+            if (res < 0) {
+                if (res == -EINTR || res == -EAGAIN) {
+                    prepare(slot); //retry as is
+                    return;
+                }
+                if (!req.owner->error) req.owner->error = -res;
+            } else if ((size_t)res < req.len && res > 0) {
+                //short transfer, continue with the remainder
+                req.owner->bytes += res;
+                req.data += res;
+                req.len -= res;
+                req.offset += res;
+                prepare(slot);
+                return;
+            } else if (res == 0 && req.len > 0 && req.write) {
+                if (!req.owner->error) req.owner->error = EIO;
+            } else {
+                req.owner->bytes += res; //a read may end early at the end of the file
+            }
+            if (req.buffer >= 0) m_freeBuffers.push_back(req.buffer);
+            req.owner->inFlight--;
+            m_freeRequests.push_back(slot);
+        }
+
+        int m_fd;
+        char *m_sq;
+        char *m_cq;
+        io_uring_sqe *m_sqes;
+        size_t m_sqSize;
+        size_t m_cqSize;
+        size_t m_sqesSize;
+        unsigned *m_sqHead;
+        unsigned *m_sqTail;
+        unsigned m_sqMask;
+        unsigned m_sqEntries;
+        unsigned *m_sqArray;
+        unsigned *m_cqHead;
+        unsigned *m_cqTail;
+        unsigned m_cqMask;
+        io_uring_cqe *m_cqes;
+        unsigned m_pending;
+        bool m_fixed;
+        std::vector<Request> m_requests;
+        std::vector<unsigned> m_freeRequests;
+        std::vector<iovec> m_buffers;
+        std::vector<int> m_freeBuffers;
+    };
+
+    /**
+     * A ring shared by the sinks of all sessions. The mixers run on threads of their own, so they don't write
+     * to the ring themselves: they fill pool buffers and hand them over, and the service's thread submits all
+     * writes handed over since its last submission at once. While writes are in flight the next ones pile up
+     * until a completion comes in, so the busier the sessions, the larger the batches.
+     *
+     * The ring is only ever used by the service's thread. The pool buffers and the owners' counters are
+     * shared under the mutex.
+     */
+    class UringService {
+    public:
+        ~UringService() {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            m_work.notify_one();
+            m_thread.join();
+        }
+
+        UringService(const UringService&) = delete;
+        UringService& operator=(const UringService&) = delete;
+
+        /**
+         * @return the service of the process, started on first use and stopped once no sink holds it any
+         *         more; nullptr if io_uring is not available
+         */
+        static std::shared_ptr<UringService> shared() {
+            static std::mutex mutex;
+            static std::weak_ptr<UringService> current;
+            std::lock_guard<std::mutex> lock(mutex);
+            std::shared_ptr<UringService> service = current.lock();
+            if (!service) {
+                std::unique_ptr<Uring> ring = Uring::create();
+                if (!ring) return nullptr;
+                service.reset(new UringService(std::move(ring)));
+                current = service;
+            }
+            return service;
+        }
+
+        /**
+         * Takes a buffer from the pool, blocks until a write completed if none is free.
+         *
+         * @return buffer index
+         */
+        int acquireBuffer() {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [this]{ return !m_freeBuffers.empty(); });
+            int index = m_freeBuffers.back();
+            m_freeBuffers.pop_back();
+            return index;
+        }
+
+        char *buffer(int index) {
+            return m_ring->buffer(index);
+        }
+
+        /**
+         * Hands a write of a pool buffer over to the service. The buffer returns to the pool once the write
+         * completed.
+         */
+        void write(UringOwner *owner, int fd, int index, size_t len, uint64_t offset) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_queued.push_back({owner, fd, index, len, offset});
+                owner->inFlight++;
+            }
+            m_work.notify_one();
+        }
+
+        /**
+         * Blocks until all writes of the owner completed.
+         */
+        void wait(UringOwner *owner) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [owner]{ return owner->inFlight == 0; });
+        }
+
+    private:
+        struct Write {
+            UringOwner *owner;
+            int fd;
+            int buffer;
+            size_t len;
+            uint64_t offset;
+        };
+
+        explicit UringService(std::unique_ptr<Uring> ring) : m_ring(std::move(ring)), m_stopping(false) {
+            while (m_ring->freeBuffers() > 0) m_freeBuffers.push_back(m_ring->acquireBuffer());
+            m_thread = std::thread(&UringService::run, this);
+        }
+
+        void run() {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (true) {
+                m_work.wait(lock, [this]{ return m_stopping || !m_queued.empty() || !m_ring->idle(); });
+                if (m_queued.empty() && m_ring->idle()) break; //stopping, with nothing left to write
+
+                //the ring counts the owners' requests, so it's only touched with the lock held, except to wait
+                for (const Write &w : m_queued) {
+                    w.owner->inFlight--; //counted again by the ring
+                    m_ring->write(w.owner, w.fd, w.buffer, w.len, w.offset);
+                }
+                m_queued.clear();
+                m_ring->submit();
+
+                lock.unlock();
+                m_ring->waitForCompletion();
+                lock.lock();
+
+                m_ring->poll();
+                while (m_ring->freeBuffers() > 0) m_freeBuffers.push_back(m_ring->acquireBuffer());
+                m_changed.notify_all();
+            }
+        }
+
+        std::unique_ptr<Uring> m_ring;
+        std::mutex m_mutex;
+        std::condition_variable m_work;     //writes handed over or stopping, for the service's thread
+        std::condition_variable m_changed;  //buffers recycled and writes completed, for the sinks
+        std::vector<Write> m_queued;
+        std::vector<int> m_freeBuffers;
+        bool m_stopping;
+        std::thread m_thread;
+    };
+
+    /**
+     * Output file written through the shared ring of the UringService.
+     * Data is packed into pool buffers and each full buffer becomes one write at an explicit offset,
+     * so a sink costs one SQE per BufferSize bytes instead of one syscall per chunk, and shares the
+     * submission with the writes of the other sessions.
+     */
+    class UringFileWriter {
+    public:
+        UringFileWriter() : m_fd(-1), m_buffer(-1), m_used(0), m_offset(0) {}
+        ~UringFileWriter() { close(); }
+
+        bool open(const std::string &path) {
+            m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            m_offset = 0;
+            m_used = 0;
+            m_owner = UringOwner();
+            return m_fd >= 0;
+        }
+
+        /**
+         * Appends data. The service is picked up lazily, so a sink that is never written doesn't start it.
+         */
+        void write(const char *data, size_t len) {
+            if (!m_service) m_service = UringService::shared();
+            while (len > 0) {
+                if (m_buffer < 0) {
+                    m_buffer = m_service->acquireBuffer();
+                    m_used = 0;
+                }
+                size_t n = std::min(len, Uring::BufferSize - m_used);
+                std::memcpy(m_service->buffer(m_buffer) + m_used, data, n);
+                m_used += n;
+                data += n;
+                len -= n;
+                if (m_used == Uring::BufferSize) queueBuffer();
+            }
+        }
+
+        /**
+         * Writes out the partially filled buffer and waits for all writes of this file.
+         *
+         * @return false if any write failed
+         */
+        bool close() {
+            if (m_fd < 0) return true;
+            if (m_service) {
+                if (m_buffer >= 0 && m_used > 0) queueBuffer();
+                m_service->wait(&m_owner);
+                m_service.reset();
+            }
+            int rc = ::close(m_fd); //also after a failed write
+            bool ok = m_owner.error == 0 && rc == 0;
+            m_fd = -1;
+            return ok;
+        }
+
+    private:
+        void queueBuffer() {
+            m_service->write(&m_owner, m_fd, m_buffer, m_used, m_offset);
+            m_offset += m_used;
+            m_buffer = -1;
+            m_used = 0;
+        }
+
+        std::shared_ptr<UringService> m_service;
+        UringOwner m_owner;
+        int m_fd;
+        int m_buffer;
+        size_t m_used;
+        uint64_t m_offset;
+    };
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace io {
+
+    /**
+     * Streaming S16LE WAV writer that turns into RF64 when the data outgrows the 4 GiB RIFF limit.
+     *
+     * A placeholder header (with a JUNK chunk reserving room for the RF64 ds64 chunk) is written on open(),
+     * the file's extents are preallocated for the expected duration so a long recording does not fragment,
+     * and the sizes are patched in on close(). Preallocated space that was not used is released again.
+     */
+    class WavFileWriter {
+    public:
+        static const size_t HeaderSize = 80;
+        static const size_t BufferSize = 256 * 1024;
+
+        WavFileWriter() : m_fd(-1), m_used(0), m_dataBytes(0), m_allocated(0), m_growth(0), m_sampleRate(0),
+                          m_channels(0), m_error(0) {}
+        ~WavFileWriter() { close(); }
+
+        /**
+         * @param path output file
+         * @param sampleRate frames per second
+         * @param channels interleaved channels per frame
+         * @param expectedBytes expected amount of audio data, used to preallocate extents (0 to skip)
+         */
+        bool open(const std::string &path, uint32_t sampleRate, uint16_t channels, uint64_t expectedBytes) {
+            m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (m_fd < 0) {
+                m_error = errno;
+                return false;
+            }
+            m_sampleRate = sampleRate;
+            m_channels = channels;
+            m_dataBytes = 0;
+            m_allocated = 0;
+            m_used = 0;
+            m_error = 0;
+            m_buffer.resize(BufferSize);
+            //past the expected size, keep preallocating in steps of a quarter of it (at least 16 MiB)
+            m_growth = std::max<uint64_t>(expectedBytes / 4, 16 * 1024 * 1024);
+            preallocate(HeaderSize + expectedBytes);
+
+            uint8_t header[HeaderSize];
+            writeHeader(header, false);
+            writeAt((const char*)header, HeaderSize, 0);
+            return m_error == 0;
+        }
+
+        void write(const char *data, size_t len) {
+            while (len > 0) {
+                size_t n = std::min(len, BufferSize - m_used);
+                std::memcpy(m_buffer.data() + m_used, data, n);
+                m_used += n;
+                data += n;
+                len -= n;
+                if (m_used == BufferSize) flushBuffer();
+            }
+        }
+
+        /**
+         * Writes the remaining data, patches the header sizes and releases unused preallocated space.
+         *
+         * @return false if any write failed
+         */
+        bool close() {
+            if (m_fd < 0) return true;
+            flushBuffer();
+
+            uint64_t end = HeaderSize + m_dataBytes;
+            if (m_dataBytes & 1) { //RIFF chunks are word aligned
+                char pad = 0;
+                writeAt(&pad, 1, end);
+                end++;
+            }
+            uint8_t header[HeaderSize];
+            writeHeader(header, end - 8 > 0xFFFFFFFFull || m_dataBytes > 0xFFFFFFFFull);
+            writeAt((const char*)header, HeaderSize, 0);
+
+            if (m_allocated > end && m_allocated != UINT64_MAX) {
+                fallocate(m_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)end, (off_t)(m_allocated - end));
+            }
+            if (::close(m_fd) != 0 && !m_error) m_error = errno;
+            m_fd = -1;
+            return m_error == 0;
+        }
+
+    private:
+        void flushBuffer() {
+            if (m_used == 0) return;
+            uint64_t offset = HeaderSize + m_dataBytes;
+            if (offset + m_used > m_allocated) preallocate(offset + m_used + m_growth);
+            writeAt(m_buffer.data(), m_used, offset);
+            m_dataBytes += m_used;
+            m_used = 0;
+        }
+
+        /**
+         * Allocates extents up to the given file offset without changing the visible file size.
+         * Filesystems without fallocate support simply grow the file on write.
+         */
+        void preallocate(uint64_t upTo) {
+            if (upTo <= m_allocated) return;
+            if (fallocate(m_fd, FALLOC_FL_KEEP_SIZE, (off_t)m_allocated, (off_t)(upTo - m_allocated)) == 0) {
+                m_allocated = upTo;
+            } else {
+                m_allocated = UINT64_MAX; //not supported, don't try again
+            }
+        }
+
+        void writeAt(const char *data, size_t len, uint64_t offset) {
+            while (len > 0 && !m_error) {
+                ssize_t n = pwrite(m_fd, data, len, (off_t)offset);
+                if (n < 0) {
+                    if (errno != EINTR) m_error = errno;
+                    continue;
+                }
+                if (n == 0) { //no progress, retrying would spin
+                    m_error = EIO;
+                    break;
+                }
+                data += n;
+                offset += n;
+                len -= n;
+            }
+        }
+
+        void writeHeader(uint8_t *h, bool rf64) const {
+            uint64_t riffSize = HeaderSize - 8 + m_dataBytes + (m_dataBytes & 1);
+            uint16_t blockAlign = (uint16_t)(m_channels * sizeof(int16_t));
+
+            std::memcpy(h, rf64 ? "RF64" : "RIFF", 4);
+            put32(h + 4, rf64 ? 0xFFFFFFFFu : (uint32_t)riffSize);
+            std::memcpy(h + 8, "WAVE", 4);
+
+            //JUNK placeholder, rewritten as ds64 for RF64
+            std::memcpy(h + 12, rf64 ? "ds64" : "JUNK", 4);
+            put32(h + 16, 28);
+            std::memset(h + 20, 0, 28);
+            if (rf64) {
+                put64(h + 20, riffSize);
+                put64(h + 28, m_dataBytes);
+                put64(h + 36, m_dataBytes / blockAlign);
+            }
+
+            std::memcpy(h + 48, "fmt ", 4);
+            put32(h + 52, 16);
+            put16(h + 56, 1); //PCM
+            put16(h + 58, m_channels);
+            put32(h + 60, m_sampleRate);
+            put32(h + 64, m_sampleRate * blockAlign);
+            put16(h + 68, blockAlign);
+            put16(h + 70, 16);
+
+            std::memcpy(h + 72, "data", 4);
+            put32(h + 76, rf64 ? 0xFFFFFFFFu : (uint32_t)m_dataBytes);
+        }
+
+        static void put16(uint8_t *p, uint16_t v) {
+            p[0] = (uint8_t)v;
+            p[1] = (uint8_t)(v >> 8);
+        }
+
+        static void put32(uint8_t *p, uint32_t v) {
+            put16(p, (uint16_t)v);
+            put16(p + 2, (uint16_t)(v >> 16));
+        }
+
+        static void put64(uint8_t *p, uint64_t v) {
+            put32(p, (uint32_t)v);
+            put32(p + 4, (uint32_t)(v >> 32));
+        }
+
+        int m_fd;
+        std::vector<char> m_buffer;
+        size_t m_used;
+        uint64_t m_dataBytes;
+        uint64_t m_allocated;
+        uint64_t m_growth;
+        uint32_t m_sampleRate;
+        uint16_t m_channels;
+        int m_error;
+    };
+}